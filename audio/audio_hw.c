@@ -20,9 +20,13 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/time.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <cutils/atomic.h>
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
 #include <cutils/properties.h>
@@ -38,6 +42,7 @@
 #include <audio_effects/effect_aec.h>
 
 #include "ril_interface.h"
+#include "poly_resampler.h"
 
 #define F_ALOG ALOGV("%s, line: %d", __FUNCTION__, __LINE__);
 
@@ -171,8 +176,9 @@ D/tinyalsa(  602): mix id:15 name:ADC Input Mux
 /* number of periods for capture */
 // #define CAPTURE_PERIOD_COUNT 2
 #define CAPTURE_PERIOD_COUNT 4
-/* minimum sleep time in out_write() when write threshold is not reached */
-#define MIN_WRITE_SLEEP_US 5000
+/* out_write() does not sleep for less than this, the excess is left in the
+ * kernel buffer */
+#define MIN_WRITE_SLEEP_NS 100000
 
 // add for capture
 #define CAPTURE_PERIOD_SIZE 4096	// can not less than 8192
@@ -257,6 +263,9 @@ D/tinyalsa(  602): mix id:15 name:ADC Input Mux
 #define PRODUCT_DEVICE_TORO     "toro"
 #define PRODUCT_NAME_YAKJU      "yakju"
 
+/* resampler quality of the streams opened next: low, medium or high */
+#define RESAMPLER_QUALITY_PROPERTY "audio.resampler.quality"
+
 enum tty_modes {
     TTY_MODE_OFF,
     TTY_MODE_VCO,
@@ -292,6 +301,11 @@ struct pcm_config pcm_config_vx = {
 
 #define MIN(x, y) ((x) > (y) ? (y) : (x))
 
+/* adev->io_state: bit 0 is the low power flag, the other bits a version */
+#define IO_STATE_LOW_POWER 0x1
+#define IO_STATE_VERSION_STEP 0x2
+#define IO_STATE_VERSION(x) ((x) & ~IO_STATE_LOW_POWER)
+
 struct route_setting
 {
     char *ctl_name;
@@ -520,10 +534,32 @@ struct mixer_ctls
     struct mixer_ctl *earpiece_volume;
 };
 
+/* adev->lock hold times, see adev_lock() */
+struct lock_stats {
+    unsigned int count;
+    int64_t hold_ns_sum;
+    int64_t hold_ns_max;
+    const char *hold_max_owner;     /* function that held it longest */
+};
+
+/* out_write() and in_read() entry: fast path on the stream lock only, or slow
+ * path through adev->lock */
+struct io_lock_stats {
+    unsigned int fast;
+    unsigned int slow;
+    int64_t wait_ns_sum;            /* blocked on locks before the I/O */
+    int64_t wait_ns_max;
+};
+
 struct tuna_audio_device {
     struct audio_hw_device hw_device;
 
     pthread_mutex_t lock;       /* see note below on mutex acquisition order */
+    struct lock_stats lock_stats;
+    const char *lock_owner;
+    int64_t lock_time_ns;
+    /* state the I/O fast path reads without the lock, see publish_io_state() */
+    volatile int32_t io_state;
     struct mixer *mixer;
     struct mixer_ctls mixer_ctls;
     int mode;
@@ -547,6 +583,18 @@ struct tuna_audio_device {
 #endif
 };
 
+/* out_write() pacing statistics, since the stream left standby */
+struct out_pacing_stats {
+    struct timespec start;          /* CLOCK_MONOTONIC */
+    unsigned int writes;
+    unsigned int sleeps;
+    int64_t latency_ns_sum;         /* written frames to DAC */
+    int64_t latency_ns_max;
+    int64_t latency_ns_last;
+    int64_t oversleep_ns_sum;       /* woken past the deadline */
+    int64_t oversleep_ns_max;
+};
+
 struct tuna_stream_out {
     struct audio_stream_out stream;
 
@@ -560,10 +608,26 @@ struct tuna_stream_out {
     struct tuna_audio_device *dev;
     int write_threshold;
     bool low_power;
+    struct out_pacing_stats pacing;
+    int32_t io_version;         /* adev->io_state version checked under adev->lock */
+    struct io_lock_stats io_stats;
 };
 
 #define MAX_PREPROCESSORS 3 /* maximum one AGC + one NS + one AEC per input stream */
 
+/* Frames read for the pre processors and not consumed yet. Single producer
+ * (read_frames()) and single consumer (the pre processors), both on the capture
+ * thread with the input stream mutex held. The buffer is allocated when the
+ * stream is opened, rd and wr count frames and run free; each side gets the
+ * contiguous part up to the end of the buffer, so no frame is ever moved. */
+struct frame_ring {
+    int16_t *buf;
+    size_t size;                /* frames */
+    size_t channels;
+    size_t rd;
+    size_t wr;
+};
+
 struct tuna_stream_in {
     struct audio_stream_in stream;
 
@@ -582,13 +646,13 @@ struct tuna_stream_in {
     bool need_echo_reference;
     effect_handle_t preprocessors[MAX_PREPROCESSORS];
     int num_preprocessors;
-    int16_t *proc_buf;
-    size_t proc_buf_size;
-    size_t proc_frames_in;
+    struct frame_ring proc_ring;
     int16_t *ref_buf;
     size_t ref_buf_size;
     size_t ref_frames_in;
     int read_status;
+    int32_t io_version;         /* adev->io_state version checked under adev->lock */
+    struct io_lock_stats io_stats;
 
     struct tuna_audio_device *dev;
 };
@@ -616,6 +680,88 @@ static int is_device_toro(void)
     return strcmp(property, PRODUCT_DEVICE_TORO) == 0;
 }
 
+/* Returns the resampler quality set by RESAMPLER_QUALITY_PROPERTY, low trades
+ * stop band attenuation for CPU */
+static int get_resampler_quality(void)
+{
+    char property[PROPERTY_VALUE_MAX];
+    int quality;
+
+    property_get(RESAMPLER_QUALITY_PROPERTY, property, "");
+    for (quality = 0; quality < POLY_RESAMPLER_QUALITY_COUNT; quality++) {
+        if (strcmp(property, poly_resampler_quality_name(quality)) == 0)
+            return quality;
+    }
+    return POLY_RESAMPLER_QUALITY_DEFAULT;
+}
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static void ns_to_timespec(int64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / 1000000000LL;
+    ts->tv_nsec = ns % 1000000000LL;
+}
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(&ts);
+}
+
+#define adev_lock(adev) adev_lock_from(adev, __func__)
+
+static void adev_lock_from(struct tuna_audio_device *adev, const char *owner)
+{
+    pthread_mutex_lock(&adev->lock);
+    adev->lock_owner = owner;
+    adev->lock_time_ns = monotonic_ns();
+}
+
+static void adev_unlock(struct tuna_audio_device *adev)
+{
+    int64_t hold_ns = monotonic_ns() - adev->lock_time_ns;
+
+    adev->lock_stats.count++;
+    adev->lock_stats.hold_ns_sum += hold_ns;
+    if (hold_ns > adev->lock_stats.hold_ns_max) {
+        adev->lock_stats.hold_ns_max = hold_ns;
+        adev->lock_stats.hold_max_owner = adev->lock_owner;
+    }
+    pthread_mutex_unlock(&adev->lock);
+}
+
+/* Publishes the device state that out_write() and in_read() read without
+ * adev->lock, and moves its version on. A stream seeing a version it has not
+ * checked under adev->lock takes the slow path once. Also called before taking
+ * a stream lock with adev->lock held, so that the I/O thread queues on
+ * adev->lock behind this thread instead of taking the stream lock again.
+ * must be called with hw device mutex locked */
+static void publish_io_state(struct tuna_audio_device *adev)
+{
+    int32_t state = IO_STATE_VERSION(adev->io_state) + IO_STATE_VERSION_STEP;
+
+    if (adev->low_power && !adev->active_input)
+        state |= IO_STATE_LOW_POWER;
+    android_atomic_release_store(state, &adev->io_state);
+}
+
+static void update_io_lock_stats(struct io_lock_stats *stats, bool fast, int64_t wait_ns)
+{
+    if (fast)
+        stats->fast++;
+    else
+        stats->slow++;
+    stats->wait_ns_sum += wait_ns;
+    if (wait_ns > stats->wait_ns_max)
+        stats->wait_ns_max = wait_ns;
+}
+
 /* The enable flag when 0 makes the assumption that enums are disabled by
  * "Off" and integers/booleans by 0 */
 static int set_route_by_array(struct mixer *mixer, struct route_setting *route,
@@ -719,7 +865,7 @@ void audio_set_wb_amr_callback(void *data, int enable)
 {
     struct tuna_audio_device *adev = (struct tuna_audio_device *)data;
 
-    pthread_mutex_lock(&adev->lock);
+    adev_lock(adev);
     if (adev->wb_amr != enable) {
         adev->wb_amr = enable;
 
@@ -730,7 +876,7 @@ void audio_set_wb_amr_callback(void *data, int enable)
             start_call(adev);
         }
     }
-    pthread_mutex_unlock(&adev->lock);
+    adev_unlock(adev);
 }
 
 static void set_incall_device(struct tuna_audio_device *adev)
@@ -895,6 +1041,8 @@ static void force_all_standby(struct tuna_audio_device *adev)
     struct tuna_stream_in *in;
     struct tuna_stream_out *out;
 
+    publish_io_state(adev);
+
     if (adev->active_output) {
         out = adev->active_output;
         pthread_mutex_lock(&out->lock);
@@ -1091,6 +1239,9 @@ static void select_output_device(struct tuna_audio_device *adev)
     }
 
     mixer_ctl_set_value(adev->mixer_ctls.sidetone_capture, 0, sidetone_capture_on);
+
+    /* routing version */
+    publish_io_state(adev);
 }
 
 static void select_input_device(struct tuna_audio_device *adev)
@@ -1136,6 +1287,9 @@ static void select_input_device(struct tuna_audio_device *adev)
     }
 
     set_input_volumes(adev, main_mic_on, headset_on, sub_mic_on);
+
+    /* routing version */
+    publish_io_state(adev);
 }
 
 /* must be called with hw device and output stream mutexes locked */
@@ -1184,6 +1338,9 @@ static int start_output_stream(struct tuna_stream_out *out)
 
     out->resampler->reset(out->resampler);
 
+    memset(&out->pacing, 0, sizeof(out->pacing));
+    clock_gettime(CLOCK_MONOTONIC, &out->pacing.start);
+
     return 0;
 }
 
@@ -1385,16 +1542,90 @@ static int out_standby(struct audio_stream *stream)
     struct tuna_stream_out *out = (struct tuna_stream_out *)stream;
     int status;
 
-    pthread_mutex_lock(&out->dev->lock);
+    adev_lock(out->dev);
     pthread_mutex_lock(&out->lock);
     status = do_output_standby(out);
     pthread_mutex_unlock(&out->lock);
-    pthread_mutex_unlock(&out->dev->lock);
+    adev_unlock(out->dev);
     return status;
 }
 
+static int dump_io_lock_stats(int fd, const struct io_lock_stats *stats)
+{
+    char buffer[256];
+    unsigned int count = stats->fast + stats->slow;
+    int len;
+
+    len = snprintf(buffer, sizeof(buffer),
+            "    I/O path: %u fast, %u through adev->lock, lock wait us: avg %.1f max %.1f\n",
+            stats->fast, stats->slow,
+            count ? stats->wait_ns_sum / 1e3 / count : 0.0,
+            stats->wait_ns_max / 1e3);
+    return write(fd, buffer, len);
+}
+
+static int dump_resampler_stats(int fd, const struct poly_resampler_stats *stats)
+{
+    char buffer[256];
+    /* output frames in 10 ms */
+    double blocks = stats->frames_out / (stats->out_rate / 100.0);
+    int len;
+
+    len = snprintf(buffer, sizeof(buffer),
+            "    resampler: %u -> %u, %s quality (%u taps), cpu us per 10 ms: avg %.1f max %.1f\n",
+            stats->in_rate, stats->out_rate, poly_resampler_quality_name(stats->quality),
+            stats->taps, blocks > 0 ? stats->cpu_ns / 1e3 / blocks : 0.0,
+            stats->cpu_ns_max_10ms / 1e3);
+    return write(fd, buffer, len);
+}
+
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+    struct tuna_stream_out *out = (struct tuna_stream_out *)stream;
+    struct out_pacing_stats pacing;
+    struct io_lock_stats io_stats;
+    struct poly_resampler_stats rsmp_stats;
+    char buffer[512];
+    int64_t elapsed_ns;
+    int standby;
+    int len;
+
+    pthread_mutex_lock(&out->lock);
+    pacing = out->pacing;
+    io_stats = out->io_stats;
+    standby = out->standby;
+    poly_resampler_get_stats(out->resampler, &rsmp_stats);
+    pthread_mutex_unlock(&out->lock);
+
+    dump_io_lock_stats(fd, &io_stats);
+    if (rsmp_stats.runs)
+        dump_resampler_stats(fd, &rsmp_stats);
+
+    elapsed_ns = monotonic_ns() - timespec_to_ns(&pacing.start);
+    if (pacing.writes == 0 || elapsed_ns <= 0) {
+        len = snprintf(buffer, sizeof(buffer),
+                "  output: %s, no write since standby\n", standby ? "standby" : "active");
+        write(fd, buffer, len);
+        return 0;
+    }
+
+    len = snprintf(buffer, sizeof(buffer),
+            "  output: %s, %s, threshold %d frames, %u writes in %lld ms\n"
+            "    wakeups/s: %.1f (writes %.1f, pacing sleeps %.1f)\n"
+            "    write to DAC latency ms: last %.2f avg %.2f max %.2f\n"
+            "    oversleep us: avg %.1f max %.1f\n",
+            standby ? "standby" : "active", out->low_power ? "low power" : "low latency",
+            out->write_threshold, pacing.writes, elapsed_ns / 1000000LL,
+            (pacing.writes + pacing.sleeps) * 1e9 / elapsed_ns,
+            pacing.writes * 1e9 / elapsed_ns,
+            pacing.sleeps * 1e9 / elapsed_ns,
+            pacing.latency_ns_last / 1e6,
+            pacing.latency_ns_sum / 1e6 / pacing.writes,
+            pacing.latency_ns_max / 1e6,
+            pacing.sleeps ? pacing.oversleep_ns_sum / 1e3 / pacing.sleeps : 0.0,
+            pacing.oversleep_ns_max / 1e3);
+    write(fd, buffer, len);
+
     return 0;
 }
 
@@ -1414,7 +1645,8 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_ROUTING, value, sizeof(value));
     if (ret >= 0) {
         val = atoi(value);
-        pthread_mutex_lock(&adev->lock);
+        adev_lock(adev);
+        publish_io_state(adev);
         pthread_mutex_lock(&out->lock);
         if (((adev->devices & AUDIO_DEVICE_OUT_ALL) != val) && (val != 0)) {
             if (out == adev->active_output) {
@@ -1441,7 +1673,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
             do_input_standby(in);
             pthread_mutex_unlock(&in->lock);
         }
-        pthread_mutex_unlock(&adev->lock);
+        adev_unlock(adev);
     }
 
     str_parms_destroy(parms);
@@ -1466,6 +1698,57 @@ static int out_set_volume(struct audio_stream_out *stream, float left,
     return -ENOSYS;
 }
 
+/* Sleeps until no more than out->write_threshold frames are left in the kernel
+ * buffer. The stream runs with PCM_NOIRQ, there is no period interrupt that
+ * pcm_wait() could block on, so the deadline is computed from the fill level
+ * and the sample rate, and slept to in one clock_nanosleep().
+ * Returns the frames estimated in the kernel buffer on return, or -1.
+ * must be called with output stream mutex locked */
+static int out_pace_write(struct tuna_stream_out *out)
+{
+    struct timespec time_stamp;
+    struct timespec deadline;
+    unsigned int avail;
+    int64_t now_ns;
+    int64_t sleep_ns;
+    int64_t woken_ns;
+    int64_t oversleep_ns;
+    int kernel_frames;
+    int ret;
+
+    if (pcm_get_htimestamp(out->pcm, &avail, &time_stamp) < 0)
+        return -1;
+    /* the driver time stamp need not be CLOCK_MONOTONIC, the deadline is taken
+     * from the monotonic time the fill level was read at */
+    now_ns = monotonic_ns();
+    kernel_frames = pcm_get_buffer_size(out->pcm) - avail;
+
+    if (kernel_frames <= out->write_threshold)
+        return kernel_frames;
+
+    sleep_ns = (int64_t)(kernel_frames - out->write_threshold) * 1000000000LL /
+            out->config.rate;
+    if (sleep_ns < MIN_WRITE_SLEEP_NS)
+        return kernel_frames;
+
+    ns_to_timespec(now_ns + sleep_ns, &deadline);
+    /* POSIX returns the error, older bionic returns -1 and sets errno */
+    do {
+        ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    } while (ret == EINTR || (ret == -1 && errno == EINTR));
+
+    woken_ns = monotonic_ns();
+    oversleep_ns = woken_ns - (now_ns + sleep_ns);
+    out->pacing.sleeps++;
+    out->pacing.oversleep_ns_sum += oversleep_ns;
+    if (oversleep_ns > out->pacing.oversleep_ns_max)
+        out->pacing.oversleep_ns_max = oversleep_ns;
+
+    /* the DAC kept playing while this thread slept past the deadline */
+    kernel_frames -= (int)((woken_ns - now_ns) * out->config.rate / 1000000000LL);
+    return kernel_frames > 0 ? kernel_frames : 0;
+}
+
 static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
                          size_t bytes)
 {
@@ -1479,28 +1762,42 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
     struct tuna_stream_in *in;
     bool low_power;
     int kernel_frames;
+    int32_t io_state;
+    int64_t lock_start_ns;
     void *buf;
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the output stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
+    /* steady state takes the output stream mutex only. Leaving standby, or a device
+     * state that changed, goes through the hw device mutex. A thread that holds the
+     * hw device mutex and wants the output stream mutex moves the state version on
+     * first (e.g. select_mode()), so that this thread waits behind it.
      */
-    pthread_mutex_lock(&adev->lock);
+    lock_start_ns = monotonic_ns();
+    io_state = android_atomic_acquire_load(&adev->io_state);
     pthread_mutex_lock(&out->lock);
-    if (out->standby) {
-        ret = start_output_stream(out);
-        if (ret != 0) {
-            pthread_mutex_unlock(&adev->lock);
-            goto exit;
+    if (out->standby || IO_STATE_VERSION(io_state) != out->io_version) {
+        pthread_mutex_unlock(&out->lock);
+        adev_lock(adev);
+        pthread_mutex_lock(&out->lock);
+        update_io_lock_stats(&out->io_stats, false, monotonic_ns() - lock_start_ns);
+        if (out->standby) {
+            ret = start_output_stream(out);
+            if (ret != 0) {
+                adev_unlock(adev);
+                goto exit;
+            }
+            out->standby = 0;
+            /* a change in output device may change the microphone selection */
+            if (adev->active_input &&
+                    adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
+                force_input_standby = true;
         }
-        out->standby = 0;
-        /* a change in output device may change the microphone selection */
-        if (adev->active_input &&
-                adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
-            force_input_standby = true;
+        io_state = adev->io_state;
+        out->io_version = IO_STATE_VERSION(io_state);
+        adev_unlock(adev);
+    } else {
+        update_io_lock_stats(&out->io_stats, true, monotonic_ns() - lock_start_ns);
     }
-    low_power = adev->low_power && !adev->active_input;
-    pthread_mutex_unlock(&adev->lock);
+    low_power = (io_state & IO_STATE_LOW_POWER) != 0;
 
     if (low_power != out->low_power) {
         if (low_power) {
@@ -1535,25 +1832,20 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
         out->echo_reference->write(out->echo_reference, &b);
     }
 
-    /* do not allow more than out->write_threshold frames in kernel pcm driver buffer */
-    do {
-        struct timespec time_stamp;
-
-        if (pcm_get_htimestamp(out->pcm, (unsigned int *)&kernel_frames, &time_stamp) < 0)
-            break;
-        kernel_frames = pcm_get_buffer_size(out->pcm) - kernel_frames;
-
-        if (kernel_frames > out->write_threshold) {
-            unsigned long time = (unsigned long)
-                    (((int64_t)(kernel_frames - out->write_threshold) * 1000000) /
-                            MM_FULL_POWER_SAMPLING_RATE);
-            if (time < MIN_WRITE_SLEEP_US)
-                time = MIN_WRITE_SLEEP_US;
-            usleep(time);
-        }
-    } while (kernel_frames > out->write_threshold);
+    /* do not allow more than out->write_threshold frames in kernel pcm driver buffer:
+     * sleep once, until the DAC has played the excess */
+    kernel_frames = out_pace_write(out);
 
     ret = pcm_mmap_write(out->pcm, (void *)buf, out_frames * frame_size);
+    if (ret == 0 && kernel_frames >= 0) {
+        int64_t latency_ns = (int64_t)kernel_frames * 1000000000LL / out->config.rate;
+
+        out->pacing.writes++;
+        out->pacing.latency_ns_last = latency_ns;
+        out->pacing.latency_ns_sum += latency_ns;
+        if (latency_ns > out->pacing.latency_ns_max)
+            out->pacing.latency_ns_max = latency_ns;
+    }
 
 exit:
     pthread_mutex_unlock(&out->lock);
@@ -1564,14 +1856,14 @@ exit:
     }
 
     if (force_input_standby) {
-        pthread_mutex_lock(&adev->lock);
+        adev_lock(adev);
         if (adev->active_input) {
             in = adev->active_input;
             pthread_mutex_lock(&in->lock);
             do_input_standby(in);
             pthread_mutex_unlock(&in->lock);
         }
-        pthread_mutex_unlock(&adev->lock);
+        adev_unlock(adev);
     }
 
     return bytes;
@@ -1595,6 +1887,49 @@ static int out_remove_audio_effect(const struct audio_stream *stream, effect_han
 
 /** audio_stream_in implementation **/
 
+static int frame_ring_init(struct frame_ring *ring, size_t frames, size_t channels)
+{
+    ring->buf = malloc(frames * channels * sizeof(int16_t));
+    if (!ring->buf)
+        return -ENOMEM;
+    ring->size = frames;
+    ring->channels = channels;
+    ring->rd = 0;
+    ring->wr = 0;
+    return 0;
+}
+
+static inline void frame_ring_reset(struct frame_ring *ring)
+{
+    ring->rd = 0;
+    ring->wr = 0;
+}
+
+static inline size_t frame_ring_frames(const struct frame_ring *ring)
+{
+    return ring->wr - ring->rd;
+}
+
+/* contiguous frames readable at the returned address */
+static inline int16_t *frame_ring_read_ptr(const struct frame_ring *ring, size_t *frames)
+{
+    size_t offset = ring->rd % ring->size;
+    size_t avail = frame_ring_frames(ring);
+
+    *frames = (avail < ring->size - offset) ? avail : ring->size - offset;
+    return ring->buf + offset * ring->channels;
+}
+
+/* contiguous frames writable at the returned address */
+static inline int16_t *frame_ring_write_ptr(const struct frame_ring *ring, size_t *frames)
+{
+    size_t offset = ring->wr % ring->size;
+    size_t room = ring->size - frame_ring_frames(ring);
+
+    *frames = (room < ring->size - offset) ? room : ring->size - offset;
+    return ring->buf + offset * ring->channels;
+}
+
 /* must be called with hw device and input stream mutexes locked */
 static int start_input_stream(struct tuna_stream_in *in)
 {
@@ -1603,6 +1938,7 @@ static int start_input_stream(struct tuna_stream_in *in)
     struct tuna_audio_device *adev = in->dev;
 
     adev->active_input = in;
+    publish_io_state(adev);
 
     if (adev->mode != AUDIO_MODE_IN_CALL) {
         adev->devices &= ~AUDIO_DEVICE_IN_ALL;
@@ -1622,6 +1958,7 @@ static int start_input_stream(struct tuna_stream_in *in)
         ALOGE("cannot open pcm_in driver: %s", pcm_get_error(in->pcm));
         pcm_close(in->pcm);
         adev->active_input = NULL;
+        publish_io_state(adev);
         return -ENOMEM;
     }
 
@@ -1631,6 +1968,8 @@ static int start_input_stream(struct tuna_stream_in *in)
         in->resampler->reset(in->resampler);
         in->frames_in = 0;
     }
+    /* frames left from before standby are stale */
+    frame_ring_reset(&in->proc_ring);
 	F_ALOG;
     return 0;
 }
@@ -1687,6 +2026,7 @@ static int do_input_standby(struct tuna_stream_in *in)
         in->pcm = NULL;
 
         adev->active_input = 0;
+        publish_io_state(adev);
         if (adev->mode != AUDIO_MODE_IN_CALL) {
             adev->devices &= ~AUDIO_DEVICE_IN_ALL;
             select_input_device(adev);
@@ -1709,16 +2049,29 @@ static int in_standby(struct audio_stream *stream)
     struct tuna_stream_in *in = (struct tuna_stream_in *)stream;
     int status;
 
-    pthread_mutex_lock(&in->dev->lock);
+    adev_lock(in->dev);
     pthread_mutex_lock(&in->lock);
     status = do_input_standby(in);
     pthread_mutex_unlock(&in->lock);
-    pthread_mutex_unlock(&in->dev->lock);
+    adev_unlock(in->dev);
     return status;
 }
 
 static int in_dump(const struct audio_stream *stream, int fd)
 {
+    struct tuna_stream_in *in = (struct tuna_stream_in *)stream;
+    struct io_lock_stats io_stats;
+    struct poly_resampler_stats rsmp_stats;
+
+    pthread_mutex_lock(&in->lock);
+    io_stats = in->io_stats;
+    if (in->resampler)
+        poly_resampler_get_stats(in->resampler, &rsmp_stats);
+    pthread_mutex_unlock(&in->lock);
+
+    dump_io_lock_stats(fd, &io_stats);
+    if (in->resampler)
+        dump_resampler_stats(fd, &rsmp_stats);
     return 0;
 }
 
@@ -1736,7 +2089,8 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_INPUT_SOURCE, value, sizeof(value));
 
-    pthread_mutex_lock(&adev->lock);
+    adev_lock(adev);
+    publish_io_state(adev);
     pthread_mutex_lock(&in->lock);
     if (ret >= 0) {
         val = atoi(value);
@@ -1759,7 +2113,7 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
     if (do_standby)
         do_input_standby(in);
     pthread_mutex_unlock(&in->lock);
-    pthread_mutex_unlock(&adev->lock);
+    adev_unlock(adev);
 
     str_parms_destroy(parms);
     return ret;
@@ -1800,7 +2154,7 @@ static void get_capture_delay(struct tuna_stream_in *in,
     /* read frames available in audio HAL input buffer
      * add number of frames being read as we want the capture time of first sample
      * in current buffer */
-    buf_delay = (long)(((int64_t)(in->frames_in + in->proc_frames_in) * 1000000000)
+    buf_delay = (long)(((int64_t)(in->frames_in + frame_ring_frames(&in->proc_ring)) * 1000000000)
                                     / in->config.rate);
     /* add delay introduced by resampler */
     rsmp_delay = 0;
@@ -1816,10 +2170,10 @@ static void get_capture_delay(struct tuna_stream_in *in,
     buffer->delay_ns   = delay_ns;
     ALOGV("get_capture_delay time_stamp = [%ld].[%ld], delay_ns: [%d],"
          " kernel_delay:[%ld], buf_delay:[%ld], rsmp_delay:[%ld], kernel_frames:[%d], "
-         "in->frames_in:[%d], in->proc_frames_in:[%d], frames:[%d]",
+         "in->frames_in:[%d], proc frames:[%d], frames:[%d]",
          buffer->time_stamp.tv_sec , buffer->time_stamp.tv_nsec, buffer->delay_ns,
          kernel_delay, buf_delay, rsmp_delay, kernel_frames,
-         in->frames_in, in->proc_frames_in, frames);
+         in->frames_in, frame_ring_frames(&in->proc_ring), frames);
 
 }
 
@@ -2026,39 +2380,39 @@ static ssize_t process_frames(struct tuna_stream_in *in, void* buffer, ssize_t f
     ssize_t frames_wr = 0;
     audio_buffer_t in_buf;
     audio_buffer_t out_buf;
+    struct frame_ring *ring = &in->proc_ring;
+    size_t contig;
+    int16_t *p;
     int i;
 
     while (frames_wr < frames) {
-        /* first reload enough frames at the end of process input buffer */
-        if (in->proc_frames_in < (size_t)frames) {
+        /* first reload enough frames at the write end of the ring, up to the
+         * end of the buffer */
+        if (frame_ring_frames(ring) < (size_t)frames) {
             ssize_t frames_rd;
 
-            if (in->proc_buf_size < (size_t)frames) {
-                in->proc_buf_size = (size_t)frames;
-                in->proc_buf = (int16_t *)realloc(in->proc_buf,
-                                         in->proc_buf_size *
-                                             in->config.channels * sizeof(int16_t));
-                ALOGV("process_frames(): in->proc_buf %p size extended to %d frames",
-                     in->proc_buf, in->proc_buf_size);
-            }
-            frames_rd = read_frames(in,
-                                    in->proc_buf +
-                                        in->proc_frames_in * in->config.channels,
-                                    frames - in->proc_frames_in);
-            if (frames_rd < 0) {
-                frames_wr = frames_rd;
-                break;
+            p = frame_ring_write_ptr(ring, &contig);
+            if (contig > (size_t)frames - frame_ring_frames(ring))
+                contig = (size_t)frames - frame_ring_frames(ring);
+            if (contig > 0) {
+                frames_rd = read_frames(in, p, contig);
+                if (frames_rd < 0) {
+                    frames_wr = frames_rd;
+                    break;
+                }
+                ring->wr += frames_rd;
             }
-            in->proc_frames_in += frames_rd;
         }
 
         if (in->echo_reference != NULL)
-            push_echo_reference(in, in->proc_frames_in);
+            push_echo_reference(in, frame_ring_frames(ring));
 
          /* in_buf.frameCount and out_buf.frameCount indicate respectively
-          * the maximum number of frames to be consumed and produced by process() */
-        in_buf.frameCount = in->proc_frames_in;
-        in_buf.s16 = in->proc_buf;
+          * the maximum number of frames to be consumed and produced by process().
+          * The input is the contiguous part of the ring, the rest follows on
+          * the next pass */
+        in_buf.s16 = frame_ring_read_ptr(ring, &contig);
+        in_buf.frameCount = contig;
         out_buf.frameCount = frames - frames_wr;
         out_buf.s16 = (int16_t *)buffer + frames_wr * in->config.channels;
 
@@ -2068,14 +2422,8 @@ static ssize_t process_frames(struct tuna_stream_in *in, void* buffer, ssize_t f
                                                &out_buf);
 
         /* process() has updated the number of frames consumed and produced in
-         * in_buf.frameCount and out_buf.frameCount respectively
-         * move remaining frames to the beginning of in->proc_buf */
-        in->proc_frames_in -= in_buf.frameCount;
-        if (in->proc_frames_in) {
-            memcpy(in->proc_buf,
-                   in->proc_buf + in_buf.frameCount * in->config.channels,
-                   in->proc_frames_in * in->config.channels * sizeof(int16_t));
-        }
+         * in_buf.frameCount and out_buf.frameCount respectively */
+        ring->rd += in_buf.frameCount;
 
         /* if not enough frames were passed to process(), read more and retry. */
         if (out_buf.frameCount == 0)
@@ -2094,19 +2442,28 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     struct tuna_stream_in *in = (struct tuna_stream_in *)stream;
     struct tuna_audio_device *adev = in->dev;
     size_t frames_rq = bytes / audio_stream_frame_size(&stream->common);
+    int32_t io_state;
+    int64_t lock_start_ns;
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the input stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
-     */
-    pthread_mutex_lock(&adev->lock);
+    /* steady state takes the input stream mutex only, see out_write() */
+    lock_start_ns = monotonic_ns();
+    io_state = android_atomic_acquire_load(&adev->io_state);
     pthread_mutex_lock(&in->lock);
-    if (in->standby) {
-        ret = start_input_stream(in);
-        if (ret == 0)
-            in->standby = 0;
+    if (in->standby || IO_STATE_VERSION(io_state) != in->io_version) {
+        pthread_mutex_unlock(&in->lock);
+        adev_lock(adev);
+        pthread_mutex_lock(&in->lock);
+        update_io_lock_stats(&in->io_stats, false, monotonic_ns() - lock_start_ns);
+        if (in->standby) {
+            ret = start_input_stream(in);
+            if (ret == 0)
+                in->standby = 0;
+        }
+        in->io_version = IO_STATE_VERSION(adev->io_state);
+        adev_unlock(adev);
+    } else {
+        update_io_lock_stats(&in->io_stats, true, monotonic_ns() - lock_start_ns);
     }
-    pthread_mutex_unlock(&adev->lock);
 
     if (ret < 0)
         goto exit;
@@ -2145,7 +2502,7 @@ static int in_add_audio_effect(const struct audio_stream *stream,
     int status;
     effect_descriptor_t desc;
 
-    pthread_mutex_lock(&in->dev->lock);
+    adev_lock(in->dev);
     pthread_mutex_lock(&in->lock);
     if (in->num_preprocessors >= MAX_PREPROCESSORS) {
         status = -ENOSYS;
@@ -2166,7 +2523,7 @@ static int in_add_audio_effect(const struct audio_stream *stream,
 exit:
 
     pthread_mutex_unlock(&in->lock);
-    pthread_mutex_unlock(&in->dev->lock);
+    adev_unlock(in->dev);
     return status;
 }
 
@@ -2179,7 +2536,7 @@ static int in_remove_audio_effect(const struct audio_stream *stream,
     bool found = false;
     effect_descriptor_t desc;
 
-    pthread_mutex_lock(&in->dev->lock);
+    adev_lock(in->dev);
     pthread_mutex_lock(&in->lock);
     if (in->num_preprocessors <= 0) {
         status = -ENOSYS;
@@ -2214,7 +2571,7 @@ static int in_remove_audio_effect(const struct audio_stream *stream,
 exit:
 
     pthread_mutex_unlock(&in->lock);
-    pthread_mutex_unlock(&in->dev->lock);
+    adev_unlock(in->dev);
     return status;
 }
 
@@ -2236,12 +2593,12 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     if (!out)
         return -ENOMEM;
 
-    ret = create_resampler(DEFAULT_OUT_SAMPLING_RATE,
-                           MM_FULL_POWER_SAMPLING_RATE,
-                           2,
-                           RESAMPLER_QUALITY_DEFAULT,
-                           NULL,
-                           &out->resampler);
+    ret = create_poly_resampler(DEFAULT_OUT_SAMPLING_RATE,
+                                MM_FULL_POWER_SAMPLING_RATE,
+                                2,
+                                get_resampler_quality(),
+                                NULL,
+                                &out->resampler);
     if (ret != 0)
         goto err_open;
     out->buffer = malloc(RESAMPLER_BUFFER_SIZE); /* todo: allow for reallocing */
@@ -2297,7 +2654,7 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
     if (out->buffer)
         free(out->buffer);
     if (out->resampler)
-        release_resampler(out->resampler);
+        release_poly_resampler(out->resampler);
     free(stream);
 }
 
@@ -2325,13 +2682,13 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
         else
             return -EINVAL;
 
-        pthread_mutex_lock(&adev->lock);
+        adev_lock(adev);
         if (tty_mode != adev->tty_mode) {
             adev->tty_mode = tty_mode;
             if (adev->mode == AUDIO_MODE_IN_CALL)
                 select_output_device(adev);
         }
-        pthread_mutex_unlock(&adev->lock);
+        adev_unlock(adev);
     }
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_NREC, value, sizeof(value));
@@ -2344,10 +2701,13 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
 #if 0
     ret = str_parms_get_str(parms, "screen_state", value, sizeof(value));
     if (ret >= 0) {
+        adev_lock(adev);
         if (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0)
             adev->low_power = false;
         else
             adev->low_power = true;
+        publish_io_state(adev);
+        adev_unlock(adev);
     }
 #endif
     str_parms_destroy(parms);
@@ -2386,12 +2746,12 @@ static int adev_set_mode(struct audio_hw_device *dev, int mode)
 {
     struct tuna_audio_device *adev = (struct tuna_audio_device *)dev;
 
-    pthread_mutex_lock(&adev->lock);
+    adev_lock(adev);
     if (adev->mode != mode) {
         adev->mode = mode;
         select_mode(adev);
     }
-    pthread_mutex_unlock(&adev->lock);
+    adev_unlock(adev);
 
     return 0;
 }
@@ -2476,16 +2836,26 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         goto err;
     }
 
+    /* pre processing input, two buffers of in_get_buffer_size() */
+    ret = frame_ring_init(&in->proc_ring,
+                          2 * get_input_buffer_size(in->requested_rate,
+                                                    AUDIO_FORMAT_PCM_16_BIT,
+                                                    in->config.channels) /
+                              audio_stream_frame_size(&in->stream.common),
+                          in->config.channels);
+    if (ret != 0)
+        goto err;
+
     if (in->requested_rate != in->config.rate) {
         in->buf_provider.get_next_buffer = get_next_buffer;
         in->buf_provider.release_buffer = release_buffer;
 
-        ret = create_resampler(in->config.rate,
-                               in->requested_rate,
-                               in->config.channels,
-                               RESAMPLER_QUALITY_DEFAULT,
-                               &in->buf_provider,
-                               &in->resampler);
+        ret = create_poly_resampler(in->config.rate,
+                                    in->requested_rate,
+                                    in->config.channels,
+                                    get_resampler_quality(),
+                                    &in->buf_provider,
+                                    &in->resampler);
         if (ret != 0) {
             ret = -EINVAL;
             goto err;
@@ -2501,8 +2871,10 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
 
 err:
     if (in->resampler)
-        release_resampler(in->resampler);
+        release_poly_resampler(in->resampler);
 
+    free(in->proc_ring.buf);
+    free(in->buffer);
     free(in);
     return ret;
 }
@@ -2519,8 +2891,9 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 		in->buffer = 0;
 	}
     if (in->resampler) {
-        release_resampler(in->resampler);
+        release_poly_resampler(in->resampler);
     }
+    free(in->proc_ring.buf);
 
     free(stream);
     return;
@@ -2528,6 +2901,23 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 
 static int adev_dump(const audio_hw_device_t *device, int fd)
 {
+    struct tuna_audio_device *adev = (struct tuna_audio_device *)device;
+    struct lock_stats stats;
+    char buffer[256];
+    int len;
+
+    adev_lock(adev);
+    stats = adev->lock_stats;
+    adev_unlock(adev);
+
+    len = snprintf(buffer, sizeof(buffer),
+            "  adev->lock: %u holds, hold us: avg %.1f max %.1f (%s)\n",
+            stats.count,
+            stats.count ? stats.hold_ns_sum / 1e3 / stats.count : 0.0,
+            stats.hold_ns_max / 1e3,
+            stats.hold_max_owner ? stats.hold_max_owner : "-");
+    write(fd, buffer, len);
+
     return 0;
 }
 
@@ -2599,7 +2989,9 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->hw_device.open_input_stream = adev_open_input_stream;
     adev->hw_device.close_input_stream = adev_close_input_stream;
     adev->hw_device.dump = adev_dump;
-	
+
+    /* The sun4i codec has none of these OMAP4 controls: the mixer stays
+     * closed, adev->mixer is NULL and the route writes below do nothing. */
 /*
     adev->mixer = mixer_open(0);
     if (!adev->mixer) {
@@ -2677,7 +3069,7 @@ static int adev_open(const hw_module_t* module, const char* name,
 */
 
     /* Set the default route before the PCM stream is opened */
-    pthread_mutex_lock(&adev->lock);
+    adev_lock(adev);
     set_route_by_array(adev->mixer, defaults, 1);
     adev->mode = AUDIO_MODE_NORMAL;
     adev->devices = AUDIO_DEVICE_OUT_SPEAKER | AUDIO_DEVICE_IN_BUILTIN_MIC;
@@ -2695,7 +3087,7 @@ static int adev_open(const hw_module_t* module, const char* name,
 #ifdef __ENABLE_RIL
     ril_open(&adev->ril);
 #endif
-    pthread_mutex_unlock(&adev->lock);
+    adev_unlock(adev);
 
 #ifdef __ENABLE_RIL
     /* register callback for wideband AMR setting */
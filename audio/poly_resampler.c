@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "poly_resampler"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/log.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+#include "poly_resampler.h"
+
+/* phases of the largest ratio the HAL needs: 44100 <-> 48000 is 147 / 160,
+ * 48000 -> 11025 is 640 / 147 */
+#define MAX_PHASES 256
+
+/* input frames kept beyond the filter history, refilled as they are used */
+#define INPUT_FRAMES 512
+
+struct quality_params {
+    unsigned int taps;          /* at the lower rate, multiple of 8 for NEON */
+    double beta;                /* Kaiser window */
+    double cutoff;              /* of the lower Nyquist frequency */
+};
+
+static const struct quality_params quality_params[POLY_RESAMPLER_QUALITY_COUNT] = {
+    [POLY_RESAMPLER_QUALITY_LOW]    = { 8,  5.0, 0.85 },
+    [POLY_RESAMPLER_QUALITY_MEDIUM] = { 16, 7.0, 0.91 },
+    [POLY_RESAMPLER_QUALITY_HIGH]   = { 32, 9.0, 0.95 },
+};
+
+static const char *quality_names[POLY_RESAMPLER_QUALITY_COUNT] = {
+    [POLY_RESAMPLER_QUALITY_LOW]    = "low",
+    [POLY_RESAMPLER_QUALITY_MEDIUM] = "medium",
+    [POLY_RESAMPLER_QUALITY_HIGH]   = "high",
+};
+
+struct poly_resampler {
+    struct resampler_itfe itfe;
+
+    struct resampler_buffer_provider *provider;
+    uint32_t in_rate;
+    uint32_t out_rate;
+    uint32_t channels;
+    int quality;
+
+    unsigned int phases;        /* L */
+    unsigned int step_int;      /* M / L */
+    unsigned int step_frac;     /* M % L */
+    unsigned int taps;
+    int16_t *coefs;             /* phases * taps, Q15, in input order */
+
+    /* input frames: taps - 1 frames of history, then the frames to use */
+    int16_t *buf;
+    size_t buf_size;            /* frames */
+    size_t buf_frames;
+    size_t pos;                 /* newest input frame of the next output */
+    unsigned int phase;
+
+    struct poly_resampler_stats stats;
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double k;
+
+    for (k = 1.0; term > sum * 1e-12; k += 1.0) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/* Windowed sinc prototype of phases * taps points at the upsampled rate, split
+ * in its phases. Phase p holds the prototype points p, p + L, p + 2L... which
+ * weigh the input frames pos, pos - 1, pos - 2...; they are stored reversed to
+ * be read along with the input. Each phase is scaled to a gain of 1. */
+static int init_coefs(struct poly_resampler *rs, unsigned int decimation)
+{
+    const struct quality_params *params = &quality_params[rs->quality];
+    unsigned int length = rs->phases * rs->taps;
+    double center = (length - 1) / 2.0;
+    double cutoff;
+    double norm = bessel_i0(params->beta);
+    double *proto;
+    unsigned int p, k, n;
+
+    rs->coefs = malloc(length * sizeof(int16_t));
+    proto = malloc(length * sizeof(double));
+    if (!rs->coefs || !proto) {
+        free(proto);
+        return -ENOMEM;
+    }
+
+    /* cycles per upsampled sample, below both Nyquist frequencies */
+    cutoff = params->cutoff * 0.5 /
+             (rs->phases > decimation ? rs->phases : decimation);
+
+    for (n = 0; n < length; n++) {
+        double t = n - center;
+        double w = t / (center + 0.5);
+        double x = 2.0 * M_PI * cutoff * t;
+
+        proto[n] = (t == 0.0) ? 1.0 : sin(x) / x;
+        proto[n] *= bessel_i0(params->beta * sqrt(1.0 - w * w)) / norm;
+    }
+
+    for (p = 0; p < rs->phases; p++) {
+        int16_t *coefs = rs->coefs + p * rs->taps;
+        double sum = 0.0;
+
+        for (k = 0; k < rs->taps; k++)
+            sum += proto[p + k * rs->phases];
+
+        for (k = 0; k < rs->taps; k++) {
+            long c = lrint(proto[p + k * rs->phases] / sum * 32768.0);
+
+            if (c > 32767)
+                c = 32767;
+            else if (c < -32768)
+                c = -32768;
+            coefs[rs->taps - 1 - k] = (int16_t)c;
+        }
+    }
+
+    free(proto);
+    return 0;
+}
+
+#ifdef __ARM_NEON__
+
+static inline void dot_mono(const int16_t *x, const int16_t *c,
+                            unsigned int taps, int16_t *out)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    int32x2_t sum;
+    unsigned int i;
+
+    for (i = 0; i < taps; i += 8) {
+        int16x8_t s = vld1q_s16(x + i);
+        int16x8_t k = vld1q_s16(c + i);
+
+        acc = vmlal_s16(acc, vget_low_s16(s), vget_low_s16(k));
+        acc = vmlal_s16(acc, vget_high_s16(s), vget_high_s16(k));
+    }
+    sum = vpadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    sum = vpadd_s32(sum, sum);
+    out[0] = vget_lane_s16(vqrshrn_n_s32(vcombine_s32(sum, sum), 15), 0);
+}
+
+static inline void dot_stereo(const int16_t *x, const int16_t *c,
+                              unsigned int taps, int16_t *out)
+{
+    int32x4_t acc_l = vdupq_n_s32(0);
+    int32x4_t acc_r = vdupq_n_s32(0);
+    int32x2_t sum;
+    int16x4_t res;
+    unsigned int i;
+
+    for (i = 0; i < taps; i += 8) {
+        int16x8x2_t s = vld2q_s16(x + 2 * i);   /* deinterleaves L and R */
+        int16x8_t k = vld1q_s16(c + i);
+
+        acc_l = vmlal_s16(acc_l, vget_low_s16(s.val[0]), vget_low_s16(k));
+        acc_l = vmlal_s16(acc_l, vget_high_s16(s.val[0]), vget_high_s16(k));
+        acc_r = vmlal_s16(acc_r, vget_low_s16(s.val[1]), vget_low_s16(k));
+        acc_r = vmlal_s16(acc_r, vget_high_s16(s.val[1]), vget_high_s16(k));
+    }
+    sum = vpadd_s32(vpadd_s32(vget_low_s32(acc_l), vget_high_s32(acc_l)),
+                    vpadd_s32(vget_low_s32(acc_r), vget_high_s32(acc_r)));
+    res = vqrshrn_n_s32(vcombine_s32(sum, sum), 15);
+    out[0] = vget_lane_s16(res, 0);
+    out[1] = vget_lane_s16(res, 1);
+}
+
+#else
+
+static inline int16_t clamp_q15(int32_t acc)
+{
+    acc = (acc + (1 << 14)) >> 15;
+    if (acc > 32767)
+        return 32767;
+    if (acc < -32768)
+        return -32768;
+    return (int16_t)acc;
+}
+
+static inline void dot_mono(const int16_t *x, const int16_t *c,
+                            unsigned int taps, int16_t *out)
+{
+    int32_t acc = 0;
+    unsigned int i;
+
+    for (i = 0; i < taps; i++)
+        acc += x[i] * c[i];
+    out[0] = clamp_q15(acc);
+}
+
+static inline void dot_stereo(const int16_t *x, const int16_t *c,
+                              unsigned int taps, int16_t *out)
+{
+    int32_t acc_l = 0;
+    int32_t acc_r = 0;
+    unsigned int i;
+
+    for (i = 0; i < taps; i++) {
+        acc_l += x[2 * i] * c[i];
+        acc_r += x[2 * i + 1] * c[i];
+    }
+    out[0] = clamp_q15(acc_l);
+    out[1] = clamp_q15(acc_r);
+}
+
+#endif
+
+static int64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Filters the buffered input into up to 'frames' output frames, then drops the
+ * input no longer needed. Returns the frames written. */
+static size_t run_filter(struct poly_resampler *rs, int16_t *out, size_t frames)
+{
+    const unsigned int taps = rs->taps;
+    const unsigned int channels = rs->channels;
+    int64_t start = thread_cpu_ns();
+    int64_t cpu_ns;
+    size_t done = 0;
+    size_t shift;
+
+    while (done < frames && rs->pos < rs->buf_frames) {
+        const int16_t *x = rs->buf + (rs->pos + 1 - taps) * channels;
+        const int16_t *c = rs->coefs + rs->phase * taps;
+
+        if (channels == 2)
+            dot_stereo(x, c, taps, out + done * 2);
+        else
+            dot_mono(x, c, taps, out + done);
+        done++;
+
+        rs->pos += rs->step_int;
+        rs->phase += rs->step_frac;
+        if (rs->phase >= rs->phases) {
+            rs->phase -= rs->phases;
+            rs->pos++;
+        }
+    }
+
+    /* only the history of the next output frame stays, a step shorter than
+     * the filter keeps it within the buffered input */
+    shift = rs->pos + 1 - taps;
+    if (shift > 0) {
+        memmove(rs->buf, rs->buf + shift * channels,
+                (rs->buf_frames - shift) * channels * sizeof(int16_t));
+        rs->buf_frames -= shift;
+        rs->pos -= shift;
+    }
+
+    if (done > 0) {
+        cpu_ns = thread_cpu_ns() - start;
+        rs->stats.runs++;
+        rs->stats.frames_out += done;
+        rs->stats.cpu_ns += cpu_ns;
+        cpu_ns = cpu_ns * rs->out_rate / 100 / done;
+        if (cpu_ns > rs->stats.cpu_ns_max_10ms)
+            rs->stats.cpu_ns_max_10ms = cpu_ns;
+    }
+
+    return done;
+}
+
+static size_t add_input(struct poly_resampler *rs, const int16_t *in, size_t frames)
+{
+    size_t room = rs->buf_size - rs->buf_frames;
+
+    if (frames > room)
+        frames = room;
+    memcpy(rs->buf + rs->buf_frames * rs->channels, in,
+           frames * rs->channels * sizeof(int16_t));
+    rs->buf_frames += frames;
+    return frames;
+}
+
+static void poly_reset(struct resampler_itfe *resampler)
+{
+    struct poly_resampler *rs = (struct poly_resampler *)resampler;
+
+    /* silence before the first frame */
+    memset(rs->buf, 0, (rs->taps - 1) * rs->channels * sizeof(int16_t));
+    rs->buf_frames = rs->taps - 1;
+    rs->pos = rs->taps - 1;
+    rs->phase = 0;
+}
+
+static int poly_resample_from_provider(struct resampler_itfe *resampler,
+                                       int16_t *out,
+                                       size_t *outFrameCount)
+{
+    struct poly_resampler *rs = (struct poly_resampler *)resampler;
+    size_t done = 0;
+
+    if (rs->provider == NULL || out == NULL || outFrameCount == NULL) {
+        if (outFrameCount)
+            *outFrameCount = 0;
+        return -EINVAL;
+    }
+
+    while (done < *outFrameCount) {
+        if (rs->pos >= rs->buf_frames) {
+            struct resampler_buffer buf;
+
+            buf.raw = NULL;
+            buf.frame_count = rs->buf_size - rs->buf_frames;
+            rs->provider->get_next_buffer(rs->provider, &buf);
+            if (buf.raw == NULL || buf.frame_count == 0)
+                break;
+            buf.frame_count = add_input(rs, buf.i16, buf.frame_count);
+            rs->provider->release_buffer(rs->provider, &buf);
+        }
+        done += run_filter(rs, out + done * rs->channels, *outFrameCount - done);
+    }
+
+    *outFrameCount = done;
+    return 0;
+}
+
+static int poly_resample_from_input(struct resampler_itfe *resampler,
+                                    int16_t *in,
+                                    size_t *inFrameCount,
+                                    int16_t *out,
+                                    size_t *outFrameCount)
+{
+    struct poly_resampler *rs = (struct poly_resampler *)resampler;
+    size_t used = 0;
+    size_t done = 0;
+
+    if (in == NULL || inFrameCount == NULL || out == NULL || outFrameCount == NULL)
+        return -EINVAL;
+
+    while (done < *outFrameCount) {
+        if (rs->pos >= rs->buf_frames) {
+            if (used == *inFrameCount)
+                break;
+            used += add_input(rs, in + used * rs->channels, *inFrameCount - used);
+        }
+        done += run_filter(rs, out + done * rs->channels, *outFrameCount - done);
+    }
+
+    *inFrameCount = used;
+    *outFrameCount = done;
+    return 0;
+}
+
+/* half the filter plus the input not filtered yet */
+static int32_t poly_delay_ns(struct resampler_itfe *resampler)
+{
+    struct poly_resampler *rs = (struct poly_resampler *)resampler;
+    int64_t frames = rs->taps / 2;
+
+    if (rs->buf_frames > rs->pos)
+        frames += rs->buf_frames - rs->pos;
+    return (int32_t)(frames * 1000000000LL / rs->in_rate);
+}
+
+int create_poly_resampler(uint32_t in_rate,
+                          uint32_t out_rate,
+                          uint32_t channels,
+                          int quality,
+                          struct resampler_buffer_provider *provider,
+                          struct resampler_itfe **resampler)
+{
+    struct poly_resampler *rs;
+    uint32_t div;
+    unsigned int decimation;
+    int ret;
+
+    if (resampler == NULL)
+        return -EINVAL;
+    *resampler = NULL;
+
+    if (in_rate == 0 || out_rate == 0 || (channels != 1 && channels != 2))
+        return -EINVAL;
+    if (quality < 0 || quality >= POLY_RESAMPLER_QUALITY_COUNT)
+        quality = POLY_RESAMPLER_QUALITY_DEFAULT;
+
+    div = gcd(in_rate, out_rate);
+    decimation = in_rate / div;
+
+    rs = calloc(1, sizeof(struct poly_resampler));
+    if (!rs)
+        return -ENOMEM;
+
+    rs->itfe.reset = poly_reset;
+    rs->itfe.resample_from_provider = poly_resample_from_provider;
+    rs->itfe.resample_from_input = poly_resample_from_input;
+    rs->itfe.delay_ns = poly_delay_ns;
+
+    rs->provider = provider;
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->channels = channels;
+    rs->quality = quality;
+    rs->phases = out_rate / div;
+    rs->step_int = decimation / rs->phases;
+    rs->step_frac = decimation % rs->phases;
+    /* downsampling, the filter spans as many output frames as upsampling does */
+    rs->taps = quality_params[quality].taps *
+               ((decimation + rs->phases - 1) / rs->phases);
+
+    if (rs->phases > MAX_PHASES) {
+        ALOGE("%s: ratio %u/%u not supported", __func__, in_rate, out_rate);
+        free(rs);
+        return -EINVAL;
+    }
+
+    ret = init_coefs(rs, decimation);
+    if (ret != 0) {
+        free(rs->coefs);
+        free(rs);
+        return ret;
+    }
+
+    rs->buf_size = rs->taps - 1 + INPUT_FRAMES;
+    rs->buf = malloc(rs->buf_size * channels * sizeof(int16_t));
+    if (!rs->buf) {
+        free(rs->coefs);
+        free(rs);
+        return -ENOMEM;
+    }
+
+    rs->stats.in_rate = in_rate;
+    rs->stats.out_rate = out_rate;
+    rs->stats.quality = quality;
+    rs->stats.taps = rs->taps;
+
+    poly_reset(&rs->itfe);
+
+    ALOGV("%s: %u -> %u, %u phases of %u taps, %s quality", __func__,
+          in_rate, out_rate, rs->phases, rs->taps, quality_names[quality]);
+
+    *resampler = &rs->itfe;
+    return 0;
+}
+
+void release_poly_resampler(struct resampler_itfe *resampler)
+{
+    struct poly_resampler *rs = (struct poly_resampler *)resampler;
+
+    if (rs == NULL)
+        return;
+
+    free(rs->buf);
+    free(rs->coefs);
+    free(rs);
+}
+
+void poly_resampler_get_stats(struct resampler_itfe *resampler,
+                              struct poly_resampler_stats *stats)
+{
+    struct poly_resampler *rs = (struct poly_resampler *)resampler;
+
+    *stats = rs->stats;
+}
+
+const char *poly_resampler_quality_name(int quality)
+{
+    if (quality < 0 || quality >= POLY_RESAMPLER_QUALITY_COUNT)
+        return "?";
+    return quality_names[quality];
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef POLY_RESAMPLER_H
+#define POLY_RESAMPLER_H
+
+#include <stdint.h>
+#include <audio_utils/resampler.h>
+
+/* Fixed ratio polyphase resampler for 16 bit mono or stereo PCM.
+ *
+ * in_rate / out_rate is reduced to L / M, the filter has L phases of a number
+ * of taps set by the quality. Its Q15 coefficients are computed once, when the
+ * resampler is created; per output frame there is one dot product over the
+ * last taps input frames, with NEON when the HAL is built for it.
+ *
+ * Implements struct resampler_itfe, so that it is used as the audio_utils
+ * resampler is, except that it is released by release_poly_resampler().
+ */
+
+/* taps per phase, stop band attenuation */
+enum poly_resampler_quality {
+    POLY_RESAMPLER_QUALITY_LOW,     /* 8, about 45 dB */
+    POLY_RESAMPLER_QUALITY_MEDIUM,  /* 16, about 70 dB */
+    POLY_RESAMPLER_QUALITY_HIGH,    /* 32, about 90 dB */
+    POLY_RESAMPLER_QUALITY_COUNT,
+};
+
+#define POLY_RESAMPLER_QUALITY_DEFAULT POLY_RESAMPLER_QUALITY_MEDIUM
+
+struct poly_resampler_stats {
+    uint32_t in_rate;
+    uint32_t out_rate;
+    int quality;
+    unsigned int taps;
+    unsigned int runs;          /* filter passes */
+    uint64_t frames_out;
+    int64_t cpu_ns;             /* thread CPU time spent filtering */
+    int64_t cpu_ns_max_10ms;    /* worst pass, scaled to 10 ms of output */
+};
+
+int create_poly_resampler(uint32_t in_rate,
+                          uint32_t out_rate,
+                          uint32_t channels,
+                          int quality,
+                          struct resampler_buffer_provider *provider,
+                          struct resampler_itfe **resampler);
+
+void release_poly_resampler(struct resampler_itfe *resampler);
+
+void poly_resampler_get_stats(struct resampler_itfe *resampler,
+                              struct poly_resampler_stats *stats);
+
+const char *poly_resampler_quality_name(int quality);
+
+#endif
@@ -52,7 +52,11 @@ LOCAL_SRC_FILES := \
 	PreviewWindow.cpp \
 	CallbackNotifier.cpp \
 	JpegCompressor.cpp \
-	CCameraConfig.cpp
+	CCameraConfig.cpp \
+	CaptureBackend.cpp \
+	FileCaptureBackend.cpp \
+	FrameTrace.cpp \
+	FocusController.cpp
 
 
 LOCAL_MODULE := camera.$(TARGET_BOARD_PLATFORM)
@@ -60,3 +64,119 @@ LOCAL_MODULE := camera.$(TARGET_BOARD_PLATFORM)
 LOCAL_MODULE_TAGS := optional
 include $(BUILD_SHARED_LIBRARY)
 
+
+# C / NEON converter equivalence test, on the device, and on the build host
+# where only the C converters and the transforms are checked
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog
+
+LOCAL_SRC_FILES := \
+	tests/ConvertersTest.cpp
+
+LOCAL_MODULE := camera_converters_test
+
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_STATIC_LIBRARIES := \
+	libcutils \
+	liblog
+
+LOCAL_SRC_FILES := \
+	tests/ConvertersTest.cpp
+
+LOCAL_MODULE := camera_converters_test
+
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+# Raw NV21 JPEG encoder, C and NEON deinterleave, against a scanline encode
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := \
+	libutils \
+	libcutils \
+	libjpeg \
+	libskia \
+	libandroid_runtime
+
+LOCAL_C_INCLUDES += \
+	external/jpeg \
+	external/skia/include/core \
+	frameworks/base/core/jni/android/graphics
+
+LOCAL_SRC_FILES := \
+	tests/JpegCompressorTest.cpp
+
+LOCAL_MODULE := camera_jpeg_test
+
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+# Cold open latency of camera.cfg, table parser against the fgets one
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := \
+	libutils \
+	libcutils
+
+LOCAL_SRC_FILES := \
+	tests/CameraConfigBench.cpp \
+	CCameraConfig.cpp
+
+LOCAL_MODULE := camera_config_bench
+
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+# Headless benchmark of the HAL, on replayed frames when camera.cfg points
+# the camera at a file, see tests/CameraBench.cpp
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := \
+	libutils \
+	libcutils \
+	libhardware \
+	libcamera_client
+
+LOCAL_C_INCLUDES += \
+	frameworks/native/include
+
+LOCAL_SRC_FILES := \
+	tests/CameraBench.cpp
+
+LOCAL_MODULE := camera_bench
+
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+# Host profiling of the SW pipeline stages on replayed frames, the pieces of
+# the HAL that build without CedarX, G2D and binder, see tests/PipelineBench.cpp
+include $(CLEAR_VARS)
+
+LOCAL_STATIC_LIBRARIES := \
+	libutils \
+	libcutils \
+	liblog
+
+LOCAL_C_INCLUDES += \
+	hardware/libhardware/include
+
+LOCAL_SRC_FILES := \
+	tests/PipelineBench.cpp \
+	CaptureBackend.cpp \
+	FileCaptureBackend.cpp \
+	FrameTrace.cpp \
+	Converters.cpp
+
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := camera_pipeline_bench
+
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
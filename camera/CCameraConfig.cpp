@@ -2,15 +2,208 @@
 #define LOG_TAG "CCameraConfig"
 #include <utils/Log.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
 #include "CCameraConfig.h"
 
+typedef struct CameraConfigEntry
+{
+	const char *				key;
+	const char *				value;
+	struct CameraConfigEntry *	next;
+}CameraConfigEntry;
+
+// keys before the first "camera_id" line, or after one of them
+typedef struct CameraConfigSection
+{
+	int							cameraId;		// -1 for the global section
+	CameraConfigEntry *			buckets[CONFIG_HASH_SIZE];
+}CameraConfigSection;
+
+struct CameraConfigTable
+{
+	CameraConfigSection			sections[MAX_CONFIG_SECTIONS];
+	int							sectionCount;
+	char *						strings;		// keys and values, NUL terminated
+	CameraConfigEntry *			entries;
+};
+
+static CameraConfigTable * gConfigTable = NULL;
+static pthread_once_t gConfigOnce = PTHREAD_ONCE_INIT;
+
+static unsigned int hashKey(const char * key)
+{
+	unsigned int hash = 5381;
+	while (*key)
+	{
+		hash = hash * 33 + (unsigned char)*key++;
+	}
+	return hash % CONFIG_HASH_SIZE;
+}
+
+static inline bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// one pass over the mapped file: every "key = value" line is copied into
+// the string pool, the value with its blanks removed as readKey always did
+static CameraConfigTable * parseConfig(const char * data, size_t size)
+{
+	CameraConfigTable * table = (CameraConfigTable *)::calloc(1, sizeof(CameraConfigTable));
+	if (table == NULL)
+	{
+		return NULL;
+	}
+
+	// a line holds at most its own length of key and value plus two NULs,
+	// and needs at least three bytes "k=\n" to make an entry
+	table->strings = (char *)::malloc(size + 2);
+	table->entries = (CameraConfigEntry *)::malloc((size / 3 + 1) * sizeof(CameraConfigEntry));
+	if (table->strings == NULL || table->entries == NULL)
+	{
+		::free(table->strings);
+		::free(table->entries);
+		::free(table);
+		return NULL;
+	}
+
+	table->sections[0].cameraId = -1;
+	table->sectionCount = 1;
+
+	char * out = table->strings;
+	int entryCount = 0;
+	const char * end = data + size;
+	const char * line = data;
+	while (line < end)
+	{
+		const char * eol = (const char *)memchr(line, '\n', end - line);
+		if (eol == NULL)
+		{
+			eol = end;
+		}
+
+		const char * p = line;
+		while (p < eol && isBlank(*p))
+		{
+			p++;
+		}
+
+		const char * eq = (p < eol && *p != ';') ? (const char *)memchr(p, '=', eol - p) : NULL;
+		if (eq != NULL && eq > p)
+		{
+			const char * keyEnd = eq;
+			while (keyEnd > p && isBlank(keyEnd[-1]))
+			{
+				keyEnd--;
+			}
+
+			char * key = out;
+			memcpy(out, p, keyEnd - p);
+			out += keyEnd - p;
+			*out++ = 0;
+
+			char * value = out;
+			for (const char * v = eq + 1; v < eol; v++)
+			{
+				if (!isBlank(*v))
+				{
+					*out++ = *v;
+				}
+			}
+			*out++ = 0;
+
+			if (!strcmp(key, "camera_id"))
+			{
+				if (table->sectionCount < MAX_CONFIG_SECTIONS)
+				{
+					table->sections[table->sectionCount++].cameraId = atoi(value);
+				}
+				else
+				{
+					ALOGW("too many camera sections in %s", CAMERA_KEY_CONFIG_PATH);
+				}
+			}
+			else
+			{
+				CameraConfigSection * section = &table->sections[table->sectionCount - 1];
+				unsigned int hash = hashKey(key);
+				CameraConfigEntry * entry = &table->entries[entryCount++];
+				entry->key = key;
+				entry->value = value;
+				entry->next = NULL;
+
+				// keep file order in the chain, the first definition wins
+				CameraConfigEntry ** pp = &section->buckets[hash];
+				while (*pp != NULL)
+				{
+					pp = &(*pp)->next;
+				}
+				*pp = entry;
+			}
+		}
+
+		line = eol + 1;
+	}
+
+	return table;
+}
+
+static void loadConfigTable()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	int64_t start = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+	int fd = ::open(CAMERA_KEY_CONFIG_PATH, O_RDONLY);
+	if (fd < 0)
+	{
+		ALOGV("open file %s failed", CAMERA_KEY_CONFIG_PATH);
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0)
+	{
+		ALOGW("empty camera config file %s", CAMERA_KEY_CONFIG_PATH);
+		::close(fd);
+		return;
+	}
+
+	void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		ALOGE("mmap %s failed", CAMERA_KEY_CONFIG_PATH);
+		return;
+	}
+
+	gConfigTable = parseConfig((const char *)data, st.st_size);
+	munmap(data, st.st_size);
+
+	gettimeofday(&tv, NULL);
+	ALOGV("parsed %s in %lld us", CAMERA_KEY_CONFIG_PATH,
+		(int64_t)tv.tv_sec * 1000000 + tv.tv_usec - start);
+}
+
+const CameraConfigTable * CCameraConfig::getTable()
+{
+	pthread_once(&gConfigOnce, loadConfigTable);
+	return gConfigTable;
+}
+
 #define READ_KEY_VALUE(key, val)						\
 	val = (char*)::malloc(KEY_LENGTH);					\
 	if (val == 0){										\
 		ALOGV("malloc %s failed", val);					\
 	}													\
 	memset(val, 0, KEY_LENGTH);							\
-	if (readKey(key, val)){								\
+	if (readKey(key, val, KEY_LENGTH)){					\
 		ALOGV("read key: %s = %s", key, val);			\
 	}
 
@@ -18,7 +211,7 @@
 	memcpy(mUsed##key, "0\0", 2);										\
 	mSupport##key##Value = 0;											\
 	mDefault##key##Value = 0;											\
-	if (readKey((char*)kUSED_##KEY, mUsed##key))								\
+	if (readKey((char*)kUSED_##KEY, mUsed##key, sizeof(mUsed##key)))			\
 	{                                                                   \
 		if (usedKey(mUsed##key))                                        \
 		{                                                               \
@@ -31,6 +224,10 @@
 		}                                                               \
  	}
 
+#define CLEAR_POINTER(key)				\
+	mSupport##key##Value = 0;			\
+	mDefault##key##Value = 0;
+
 #define CHECK_FREE_POINTER(key)			\
 	if(mSupport##key##Value != 0){		\
 		::free(mSupport##key##Value);	\
@@ -75,26 +272,34 @@ MEMBER_FUNCTION(SceneMode)
 MEMBER_FUNCTION(WhiteBalance)
 
 CCameraConfig::CCameraConfig(int id)
-:mhKeyFile(0)
+:mTable(0)
 ,mCurCameraId(id)
 ,mNumberOfCamera(0)
 ,mCameraFacing(0)
 ,mDeviceID(0)
+,mBufferCount(0)
+,mZslBufferCount(0)
 {
-	mhKeyFile = ::fopen(CAMERA_KEY_CONFIG_PATH, "rb");
-	if (!mhKeyFile)
+	// initParameters may never run, for a config only read for metadata
+	CLEAR_POINTER(PreviewSize)
+	CLEAR_POINTER(PictureSize)
+	CLEAR_POINTER(FlashMode)
+	CLEAR_POINTER(ColorEffect)
+	CLEAR_POINTER(FrameRate)
+	CLEAR_POINTER(FocusMode)
+	CLEAR_POINTER(SceneMode)
+	CLEAR_POINTER(WhiteBalance)
+
+	mTable = getTable();
+	if (!mTable)
 	{
-		ALOGV("open file %s failed", CAMERA_KEY_CONFIG_PATH);
+		ALOGV("no camera config from %s", CAMERA_KEY_CONFIG_PATH);
 		return;
 	}
-	else
-	{
-		ALOGV("open file %s OK", CAMERA_KEY_CONFIG_PATH);
-	}
 
 	// get number of camera
 	char numberOfCamera[2];
-	if(readKey((char*)kNUMBER_OF_CAMERA, numberOfCamera))
+	if(readKey((char*)kNUMBER_OF_CAMERA, numberOfCamera, sizeof(numberOfCamera)))
 	{
 		mNumberOfCamera = atoi(numberOfCamera);
 		ALOGV("read number: %d", mNumberOfCamera);
@@ -102,7 +307,7 @@ CCameraConfig::CCameraConfig(int id)
 
 	// get camera facing
 	char cameraFacing[2];
-	if(readKey((char*)kCAMERA_FACING, cameraFacing))
+	if(readKey((char*)kCAMERA_FACING, cameraFacing, sizeof(cameraFacing)))
 	{
 		mCameraFacing = atoi(cameraFacing);
 		ALOGV("camera facing %s", (mCameraFacing == 0) ? "back" : "front");
@@ -110,23 +315,39 @@ CCameraConfig::CCameraConfig(int id)
 
 	// get camera device driver
 	memset(mCameraDevice, 0, sizeof(mCameraDevice));
-	if(readKey((char*)kCAMERA_DEVICE, mCameraDevice))
+	if(readKey((char*)kCAMERA_DEVICE, mCameraDevice, sizeof(mCameraDevice)))
 	{
 		ALOGV("camera device %s", mCameraDevice);
 	}
 
 	// get device id
 	char deviceID[2];
-	if(readKey((char*)kDEVICE_ID, deviceID))
+	if(readKey((char*)kDEVICE_ID, deviceID, sizeof(deviceID)))
 	{
 		mDeviceID = atoi(deviceID);
 		ALOGV("camera device id %d", mDeviceID);
 	}
+
+	// get v4l2 buffer count
+	char bufferCount[KEY_LENGTH];
+	if(readKey((char*)kBUFFER_COUNT, bufferCount, sizeof(bufferCount)))
+	{
+		mBufferCount = atoi(bufferCount);
+		ALOGV("camera buffer count %d", mBufferCount);
+	}
+
+	// get zsl buffer count
+	char zslBufferCount[KEY_LENGTH];
+	if(readKey((char*)kZSL_BUFFER_COUNT, zslBufferCount, sizeof(zslBufferCount)))
+	{
+		mZslBufferCount = atoi(zslBufferCount);
+		ALOGV("camera zsl buffer count %d", mZslBufferCount);
+	}
 }
 
 CCameraConfig::~CCameraConfig()
 {	
-	if (mhKeyFile != 0)
+	if (mTable != 0)
 	{
 		CHECK_FREE_POINTER(PreviewSize)
 		CHECK_FREE_POINTER(PictureSize)
@@ -136,9 +357,9 @@ CCameraConfig::~CCameraConfig()
 		CHECK_FREE_POINTER(FocusMode)
 		CHECK_FREE_POINTER(SceneMode)
 		CHECK_FREE_POINTER(WhiteBalance)
-		
-		::fclose(mhKeyFile);
-		mhKeyFile = 0;
+
+		// the table itself is shared, and kept for the life of the process
+		mTable = 0;
 	}
 }
 
@@ -149,9 +370,9 @@ bool CCameraConfig::usedKey(char *value)
 
 void CCameraConfig::initParameters()
 {	
-	if (mhKeyFile == 0)
+	if (mTable == 0)
 	{
-		ALOGW("invalid camera config file hadle");
+		ALOGW("invalid camera config table");
 		return ;
 	}
 
@@ -170,14 +391,14 @@ void CCameraConfig::initParameters()
 	memset(mMinExposureCompensation, 0, 4);
 	memset(mStepExposureCompensation, 0, 4);
 	memset(mDefaultExposureCompensation, 0, 4);
-	if (readKey((char*)kUSED_EXPOSURE_COMPENSATION, mUsedExposureCompensation))	
+	if (readKey((char*)kUSED_EXPOSURE_COMPENSATION, mUsedExposureCompensation, sizeof(mUsedExposureCompensation)))	
 	{
 		if (usedKey(mUsedExposureCompensation)) 
 		{
-			readKey((char*)kMIN_EXPOSURE_COMPENSATION, mMinExposureCompensation);
-			readKey((char*)kMAX_EXPOSURE_COMPENSATION, mMaxExposureCompensation);
-			readKey((char*)kSTEP_EXPOSURE_COMPENSATION, mStepExposureCompensation);
-			readKey((char*)kDEFAULT_EXPOSURE_COMPENSATION, mDefaultExposureCompensation);
+			readKey((char*)kMIN_EXPOSURE_COMPENSATION, mMinExposureCompensation, sizeof(mMinExposureCompensation));
+			readKey((char*)kMAX_EXPOSURE_COMPENSATION, mMaxExposureCompensation, sizeof(mMaxExposureCompensation));
+			readKey((char*)kSTEP_EXPOSURE_COMPENSATION, mStepExposureCompensation, sizeof(mStepExposureCompensation));
+			readKey((char*)kDEFAULT_EXPOSURE_COMPENSATION, mDefaultExposureCompensation, sizeof(mDefaultExposureCompensation));
 		}
 		else
 		{
@@ -192,15 +413,15 @@ void CCameraConfig::initParameters()
 	memset(mZoomRatios, 0, KEY_LENGTH);
 	memset(mMaxZoom, 0, 4);
 	memset(mDefaultZoom, 0, 4);
-	if (readKey((char*)kUSED_ZOOM, mUsedZoom))	
+	if (readKey((char*)kUSED_ZOOM, mUsedZoom, sizeof(mUsedZoom)))	
 	{
 		if (usedKey(mUsedZoom)) 
 		{
-			readKey((char*)kZOOM_SUPPORTED, mZoomSupported);
-			readKey((char*)kSMOOTH_ZOOM_SUPPORTED, mSmoothZoomSupported);
-			readKey((char*)kZOOM_RATIOS, mZoomRatios);
-			readKey((char*)kMAX_ZOOM, mMaxZoom);
-			readKey((char*)kDEFAULT_ZOOM, mDefaultZoom);
+			readKey((char*)kZOOM_SUPPORTED, mZoomSupported, sizeof(mZoomSupported));
+			readKey((char*)kSMOOTH_ZOOM_SUPPORTED, mSmoothZoomSupported, sizeof(mSmoothZoomSupported));
+			readKey((char*)kZOOM_RATIOS, mZoomRatios, sizeof(mZoomRatios));
+			readKey((char*)kMAX_ZOOM, mMaxZoom, sizeof(mMaxZoom));
+			readKey((char*)kDEFAULT_ZOOM, mDefaultZoom, sizeof(mDefaultZoom));
 		}
 		else
 		{
@@ -211,9 +432,9 @@ void CCameraConfig::initParameters()
 
 void CCameraConfig::dumpParameters()
 {
-	if (mhKeyFile == 0)
+	if (mTable == 0)
 	{
-		ALOGW("invalid camera config file hadle");
+		ALOGW("invalid camera config table");
 		return ;
 	}
 	
@@ -245,82 +466,65 @@ void CCameraConfig::dumpParameters()
 	ALOGV("/*------------------------------------------------------*/");
 }
 
-void CCameraConfig::getValue(char *line, char *value)
+bool CCameraConfig::readKey(char *key, char *value, size_t size)
 {
-	char * ptemp = line;
-	while(*ptemp)
+	if (key == 0 || value == 0 || size == 0)
 	{
-		if (*ptemp++ == '=')
-		{
-			break;
-		}
+		ALOGV("error input para");
+		return false;
 	}
 
-	char *pval = ptemp;
-	const char *seps = " \n\r\t";
-	int offset = 0;
-	pval = strtok(pval, seps);
-	while (pval != NULL)
+	if (mTable == 0)
 	{
-		strncpy(value + offset, pval, strlen(pval));
-		offset += strlen(pval);
-		pval = strtok(NULL, seps);
+		ALOGV("error config table");
+		return false;
 	}
-	*(value + offset) = 0;
-}
 
-bool CCameraConfig::readKey(char *key, char *value)
-{
-	bool bRet = false;
-	bool bFlagBegin = false;
-	char strId[2];
-	char str[KEY_LENGTH];
-
-	if (key == 0 || value == 0)
+	// number_of_camera is read from the top, the other keys from the section
+	// of this camera on, the first definition in the file wins
+	int first = -1;
+	if (!strcmp(key, kNUMBER_OF_CAMERA))
 	{
-		ALOGV("error input para");
-		return false;
+		first = 0;
+	}
+	else
+	{
+		for (int i = 1; i < mTable->sectionCount; i++)
+		{
+			if (mTable->sections[i].cameraId == mCurCameraId)
+			{
+				first = i;
+				break;
+			}
+		}
 	}
 
-	if (mhKeyFile == 0)
+	if (first < 0)
 	{
-		ALOGV("error key file handle");
 		return false;
 	}
 
-	fseek(mhKeyFile, 0L, SEEK_SET);
-
-	memset(str, 0, KEY_LENGTH);
-	while (fgets(str, KEY_LENGTH , mhKeyFile))
+	unsigned int hash = hashKey(key);
+	for (int i = first; i < mTable->sectionCount; i++)
 	{
-		if (!strcmp(key, "number_of_camera"))
-		{
-			bFlagBegin = true;
-		}
-
-		if (!bFlagBegin)
+		const CameraConfigEntry * entry = mTable->sections[i].buckets[hash];
+		while (entry != NULL)
 		{
-			if (!strncmp(str, "camera_id", strlen("camera_id")))
+			if (!strcmp(entry->key, key))
 			{
-				getValue(str, strId);
-				if (atoi(strId) == mCurCameraId)
+				// truncated to the caller's buffer, always terminated
+				size_t len = strlen(entry->value);
+				if (len > size - 1)
 				{
-					bFlagBegin = true;
+					len = size - 1;
 				}
+				memcpy(value, entry->value, len);
+				value[len] = 0;
+				return true;
 			}
-			continue;
+			entry = entry->next;
 		}
+	}
 
-		if (!strncmp(key, str, strlen(key)))
-		{
-			getValue(str, value);
-
-			bRet = true;
-			break;
-		}
-		memset(str, 0, KEY_LENGTH);
-	}	
-
-	return bRet;
+	return false;
 }
-
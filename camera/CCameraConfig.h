@@ -9,10 +9,16 @@
 
 #define KEY_LENGTH	256
 
+// keys of one "camera_id" section are hashed into this many buckets
+#define CONFIG_HASH_SIZE	32
+#define MAX_CONFIG_SECTIONS	8
+
 #define kNUMBER_OF_CAMERA					"number_of_camera"
 #define kCAMERA_FACING						"camera_facing"
 #define kCAMERA_DEVICE						"camera_device"
 #define kDEVICE_ID							"device_id"
+#define kBUFFER_COUNT						"buffer_count"
+#define kZSL_BUFFER_COUNT					"zsl_buffer_count"
 
 #define kUSED_PREVIEW_SIZE					"used_preview_size"
 #define kSUPPORT_PREVIEW_SIZE				"key_support_preview_size"
@@ -59,6 +65,9 @@
 #define kMAX_ZOOM             				"key_max_zoom"
 #define kDEFAULT_ZOOM         				"key_default_zoom"	
 
+// camera.cfg parsed once per process, shared by every CCameraConfig
+struct CameraConfigTable;
+
 #define MEMBER_DEF(mem)				\
 	char mUsed##mem[2];				\
 	char * mSupport##mem##Value;	\
@@ -93,6 +102,18 @@ public:
 		return mDeviceID;
 	}
 
+	// V4L2 buffer queue depth, 0 if not configured
+	int getBufferCount()
+	{
+		return mBufferCount;
+	}
+
+	// frames kept for zero shutter lag, 0 if ZSL is not supported
+	int getZslBufferCount()
+	{
+		return mZslBufferCount;
+	}
+
 	bool supportPreviewSize();
 	char * supportPreviewSizeValue();
 	char * defaultPreviewSizeValue();
@@ -183,17 +204,20 @@ public:
 	}
 
 private:
-	bool readKey(char *key, char *value);
-	void getValue(char *line, char *value);
+	bool readKey(char *key, char *value, size_t size);
 	bool usedKey(char *value);
 
-	FILE * mhKeyFile;
+	static const CameraConfigTable * getTable();
+
+	const CameraConfigTable * mTable;
 
 	int mCurCameraId;
 	int mNumberOfCamera;
 	int mCameraFacing;
 	char mCameraDevice[64];
 	int mDeviceID;
+	int mBufferCount;
+	int mZslBufferCount;
 
 	MEMBER_DEF(PreviewSize)
 	MEMBER_DEF(PictureSize)
@@ -30,8 +30,21 @@
 
 extern "C" int JpegEnc(void * pBufOut, int * bufSize, JPEG_ENC_t *jpeg_enc);
 
+// pictures waiting for the encoder, the camera worker thread blocks when full
+#define PICTURE_JOB_NUM		2
+
 namespace android {
 
+/* A picture waiting for, or in, the encoder. The capture buffer stays
+ * referenced until JpegEnc is done with it. */
+struct PictureJob
+{
+	JPEG_ENC_t		jpeg_enc;
+	V4L2Camera *	camera_dev;
+	int				index;			// V4L2 buffer index
+	int				frame_size;		// for RAW_IMAGE_NOTIFY and POSTVIEW_FRAME
+};
+
 /* String representation of camera messages. */
 static const char* lCameraMessages[] =
 {
@@ -45,7 +58,8 @@ static const char* lCameraMessages[] =
     "CAMERA_MSG_RAW_IMAGE",
     "CAMERA_MSG_COMPRESSED_IMAGE",
     "CAMERA_MSG_RAW_IMAGE_NOTIFY",
-    "CAMERA_MSG_PREVIEW_METADATA"
+    "CAMERA_MSG_PREVIEW_METADATA",
+    "CAMERA_MSG_FOCUS_MOVE"
 };
 static const int lCameraMessagesNum = sizeof(lCameraMessages) / sizeof(char*);
 
@@ -94,11 +108,19 @@ CallbackNotifier::CallbackNotifier()
       mGetMemoryCB(NULL),
       mCallbackCookie(NULL),
       mLastFrameTimestamp(0),
-      mFrameRefreshFreq(0),
+      mVideoFps(0),
+      mScheduleStart(0),
+      mScheduleFrames(0),
+      mInputInterval(0),
+      mVideoFramesDelivered(0),
+      mVideoFramesDecimated(0),
+      mVideoFramesSkipped(0),
       mMessageEnabler(0),
       mJpegQuality(90),
       mVideoRecEnabled(false),
       mTakingPicture(false),
+      mPicturesLeft(0),
+      mPicturesCount(0),
       mUseMetaDataBufferMode(false),
       mGpsLatitude(0.0),
 	  mGpsLongitude(0.0),
@@ -106,13 +128,44 @@ CallbackNotifier::CallbackNotifier()
 	  mGpsTimestamp(0),
 	  mThumbWidth(0),
 	  mThumbHeight(0),
-	  mFocalLength(0.0)
+	  mFocalLength(0.0),
+	  mPictureThread(NULL),
+	  mPictureThreadExit(false),
+	  mPictureJobs(NULL),
+	  mPictureJobHead(0),
+	  mPictureJobCount(0),
+	  mPictureFramesHeld(0),
+	  mJpegOutBuf(NULL),
+	  mJpegOutBufSize(0),
+	  mPreviewHeap(NULL),
+	  mPreviewHeapSize(0),
+	  mPreviewHeapIndex(0),
+	  mVideoHeap(NULL),
+	  mVideoHeapSize(0),
+	  mVideoFramesHeld(0),
+	  mAllocCount(0),
+	  mAllocCountLastSecond(0),
+	  mAllocCountWindow(0),
+	  mAllocWindowStart(0)
 {
 	memset(mGpsMethod, 0, 100);
+	memset(mVideoSlotBusy, 0, sizeof(mVideoSlotBusy));
+	memset(mVideoSlotFrame, 0xff, sizeof(mVideoSlotFrame));
+	mPictureJobs = new PictureJob[PICTURE_JOB_NUM];
 }
 
 CallbackNotifier::~CallbackNotifier()
 {
+	stopPictureThread();
+
+	releaseCallbackHeaps();
+
+	delete[] mPictureJobs;
+	if (mJpegOutBuf != NULL)
+	{
+		free(mJpegOutBuf);
+		mJpegOutBuf = NULL;
+	}
 }
 
 /****************************************************************************
@@ -162,10 +215,25 @@ status_t CallbackNotifier::enableVideoRecording(int fps)
 {
     ALOGV("%s: FPS = %d", __FUNCTION__, fps);
 
-    Mutex::Autolock locker(&mObjectLock);
-    mVideoRecEnabled = true;
-    mLastFrameTimestamp = 0;
-    mFrameRefreshFreq = 1000000000LL / fps;
+    {
+        Mutex::Autolock locker(&mObjectLock);
+        mVideoRecEnabled = true;
+        mLastFrameTimestamp = 0;
+        mVideoFps = fps;
+        mScheduleStart = 0;
+        mScheduleFrames = 0;
+        mInputInterval = 0;
+        mVideoFramesDelivered = 0;
+        mVideoFramesDecimated = 0;
+        mVideoFramesSkipped = 0;
+    }
+
+	// metadata slots are allocated before the first frame, and reused
+	// for every frame of the recording
+	if (mUseMetaDataBufferMode && mGetMemoryCB != NULL)
+	{
+		getCallbackHeap(&mVideoHeap, &mVideoHeapSize, sizeof(V4L2BUF_t), CB_VIDEO_BUFFERS);
+	}
 
     return NO_ERROR;
 }
@@ -177,13 +245,49 @@ void CallbackNotifier::disableVideoRecording()
     Mutex::Autolock locker(&mObjectLock);
     mVideoRecEnabled = false;
     mLastFrameTimestamp = 0;
-    mFrameRefreshFreq = 0;
+    mVideoFps = 0;
 }
 
-void CallbackNotifier::releaseRecordingFrame(const void* opaque)
+int CallbackNotifier::releaseRecordingFrame(const void* opaque)
 {
-    /* We don't really have anything to release here, since we report video
-     * frames by copying them directly to the camera memory. */
+	/* The encoder is done with this slot of the video heap. */
+	Mutex::Autolock locker(&mHeapLock);
+	if (mVideoHeap == NULL)
+	{
+		return -1;
+	}
+
+	const uint8_t * base = (const uint8_t *)mVideoHeap->data;
+	const uint8_t * p = (const uint8_t *)opaque;
+	if (p < base || p >= base + mVideoHeapSize * CB_VIDEO_BUFFERS)
+	{
+		return -1;
+	}
+
+	// a slot released twice, or after the device stopped, holds nothing
+	int slot = (p - base) / mVideoHeapSize;
+	if (!mVideoSlotBusy[slot])
+	{
+		ALOGW("%s: video slot %d is not held", __FUNCTION__, slot);
+		return -1;
+	}
+
+	int frame = mVideoSlotFrame[slot];
+	mVideoSlotBusy[slot] = false;
+	mVideoSlotFrame[slot] = -1;
+	if (frame >= 0)
+	{
+		mVideoFramesHeld--;
+	}
+	return frame;
+}
+
+void CallbackNotifier::resetVideoSlots()
+{
+	Mutex::Autolock locker(&mHeapLock);
+	memset(mVideoSlotBusy, 0, sizeof(mVideoSlotBusy));
+	memset(mVideoSlotFrame, 0xff, sizeof(mVideoSlotFrame));
+	mVideoFramesHeld = 0;
 }
 
 status_t CallbackNotifier::storeMetaDataInBuffers(bool enable)
@@ -204,6 +308,9 @@ status_t CallbackNotifier::storeMetaDataInBuffers(bool enable)
 
 void CallbackNotifier::cleanupCBNotifier()
 {
+	// pending pictures still need the callbacks
+	stopPictureThread();
+
     Mutex::Autolock locker(&mObjectLock);
     mMessageEnabler = 0;
     mNotifyCB = NULL;
@@ -212,10 +319,12 @@ void CallbackNotifier::cleanupCBNotifier()
     mGetMemoryCB = NULL;
     mCallbackCookie = NULL;
     mLastFrameTimestamp = 0;
-    mFrameRefreshFreq = 0;
+    mVideoFps = 0;
     mJpegQuality = 90;
     mVideoRecEnabled = false;
     mTakingPicture = false;
+
+	releaseCallbackHeaps();
 }
 
 void CallbackNotifier::onNextFrameAvailable(const void* frame,
@@ -240,28 +349,38 @@ void CallbackNotifier::onNextFrameHW(const void* frame,
 	if (isMessageEnabled(CAMERA_MSG_VIDEO_FRAME) && isVideoRecordingEnabled() &&
             isNewVideoFrameTime(timestamp)) 
 	{
-        camera_memory_t* cam_buff = mGetMemoryCB(-1, sizeof(V4L2BUF_t), 1, NULL);
-        if (NULL != cam_buff && NULL != cam_buff->data) 
-		{
-            memcpy(cam_buff->data, frame, sizeof(V4L2BUF_t));
-            mDataCBTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME,
-                               cam_buff, 0, mCallbackCookie);
-			cam_buff->release(cam_buff);
-        } 
-		else 
+		// the slot carries the V4L2 buffer descriptor, the encoder reads the
+		// frame at its physical address, no frame data is copied
+		const V4L2BUF_t * pbuf = (const V4L2BUF_t *)frame;
+        camera_memory_t* cam_buff = 
+			getCallbackHeap(&mVideoHeap, &mVideoHeapSize, sizeof(V4L2BUF_t), CB_VIDEO_BUFFERS);
+
+		// the driver keeps one buffer to fill, and preview another
+		int index = getFreeVideoSlot(pbuf->index, camera_dev->getBufferCount() - 2);
+        if (NULL == cam_buff)
 		{
             ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
         }
+		else if (index >= 0)
+		{
+            memcpy((uint8_t *)cam_buff->data + index * sizeof(V4L2BUF_t), pbuf, sizeof(V4L2BUF_t));
+			// the encoder owns the buffer until releaseRecordingFrame
+			camera_dev->acquirePreviewFrame(pbuf->index);
+			camera_dev->getFrameTrace().mark(pbuf->index, FRAME_STAGE_ENCODE_START);
+            mDataCBTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME,
+                               cam_buff, index, mCallbackCookie);
+        } 
     }
 
     if (isMessageEnabled(CAMERA_MSG_PREVIEW_FRAME)) 
 	{
-        camera_memory_t* cam_buff = mGetMemoryCB(-1, sizeof(V4L2BUF_t), 1, NULL);
-        if (NULL != cam_buff && NULL != cam_buff->data) 
+        camera_memory_t* cam_buff = 
+			getCallbackHeap(&mPreviewHeap, &mPreviewHeapSize, sizeof(V4L2BUF_t), CB_PREVIEW_BUFFERS);
+        if (NULL != cam_buff) 
 		{
-            memcpy(cam_buff->data, frame, sizeof(V4L2BUF_t));
-			mDataCB(CAMERA_MSG_PREVIEW_FRAME, cam_buff, 0, NULL, mCallbackCookie);
-			cam_buff->release(cam_buff);
+			mPreviewHeapIndex = (mPreviewHeapIndex + 1) % CB_PREVIEW_BUFFERS;
+            memcpy((uint8_t *)cam_buff->data + mPreviewHeapIndex * sizeof(V4L2BUF_t), frame, sizeof(V4L2BUF_t));
+			mDataCB(CAMERA_MSG_PREVIEW_FRAME, cam_buff, mPreviewHeapIndex, NULL, mCallbackCookie);
         } 
 		else 
 		{
@@ -276,36 +395,49 @@ void CallbackNotifier::onNextFrameSW(const void* frame,
 {
 	if (isMessageEnabled(CAMERA_MSG_VIDEO_FRAME) && isVideoRecordingEnabled() &&
             isNewVideoFrameTime(timestamp)) {
+        const int size = camera_dev->getFrameBufferSize();
         camera_memory_t* cam_buff =
-            mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, NULL);
-        if (NULL != cam_buff && NULL != cam_buff->data) {
-            memcpy(cam_buff->data, frame, camera_dev->getFrameBufferSize());
+            getCallbackHeap(&mVideoHeap, &mVideoHeapSize, size, CB_VIDEO_BUFFERS);
+        int index = getFreeVideoSlot(-1, CB_VIDEO_BUFFERS);
+        if (NULL != cam_buff && index >= 0) {
+            memcpy((uint8_t *)cam_buff->data + index * size, frame, size);
             mDataCBTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME,
-                               cam_buff, 0, mCallbackCookie);
-			cam_buff->release(cam_buff);		// star add
+                               cam_buff, index, mCallbackCookie);
         } else {
             ALOGE("%s: Memory failure in CAMERA_MSG_VIDEO_FRAME", __FUNCTION__);
         }
     }
 
     if (isMessageEnabled(CAMERA_MSG_PREVIEW_FRAME)) {
+        /* The device scales the frame to the preview size and format when
+         * the capture runs at another one. */
+        int size = camera_dev->getFrameBufferSize();
+        const void* cb_frame = camera_dev->getPreviewCallbackFrame(frame, &size);
+        if (cb_frame != NULL) {
+            frame = cb_frame;
+        }
         camera_memory_t* cam_buff =
-            mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, NULL);
-        if (NULL != cam_buff && NULL != cam_buff->data) {
-            memcpy(cam_buff->data, frame, camera_dev->getFrameBufferSize());
-            mDataCB(CAMERA_MSG_PREVIEW_FRAME, cam_buff, 0, NULL, mCallbackCookie);
-            cam_buff->release(cam_buff);
+            getCallbackHeap(&mPreviewHeap, &mPreviewHeapSize, size, CB_PREVIEW_BUFFERS);
+        if (NULL != cam_buff) {
+            mPreviewHeapIndex = (mPreviewHeapIndex + 1) % CB_PREVIEW_BUFFERS;
+            memcpy((uint8_t *)cam_buff->data + mPreviewHeapIndex * size, frame, size);
+            mDataCB(CAMERA_MSG_PREVIEW_FRAME, cam_buff, mPreviewHeapIndex, NULL, mCallbackCookie);
         } else {
             ALOGE("%s: Memory failure in CAMERA_MSG_PREVIEW_FRAME", __FUNCTION__);
         }
     }
 }
 
-status_t CallbackNotifier::autoFocus()
+void CallbackNotifier::notifyFocus(bool success)
 {
 	if (isMessageEnabled(CAMERA_MSG_FOCUS))
-        mNotifyCB(CAMERA_MSG_FOCUS, true, 0, mCallbackCookie);
-    return NO_ERROR;
+		mNotifyCB(CAMERA_MSG_FOCUS, success, 0, mCallbackCookie);
+}
+
+void CallbackNotifier::notifyFocusMove(bool start)
+{
+	if (isMessageEnabled(CAMERA_MSG_FOCUS_MOVE))
+		mNotifyCB(CAMERA_MSG_FOCUS_MOVE, start, 0, mCallbackCookie);
 }
 
 void CallbackNotifier::takePicture(const void* frame, V4L2Camera* camera_dev, bool bUseMataData)
@@ -326,10 +458,231 @@ void CallbackNotifier::takePictureHW(const void* frame, V4L2Camera* camera_dev)
 	{
 		return ;
 	}
+
+	// the client stopped taking compressed images during a burst, end the
+	// burst instead of encoding frames nobody receives
+	if (mPicturesLeft < mPicturesCount
+		&& !isMessageEnabled(CAMERA_MSG_COMPRESSED_IMAGE))
+	{
+		ALOGD("%s: burst ended after %d of %d pictures", __FUNCTION__,
+			mPicturesCount - mPicturesLeft, mPicturesCount);
+		mPicturesLeft = 0;
+		mTakingPicture = false;
+		memset(mGpsMethod, 0, sizeof(mGpsMethod));
+		camera_dev->endBurst();
+		return ;
+	}
 	
 	ALOGD("%s, taking photo begin", __FUNCTION__);
-    /* This happens just once. */
-    mTakingPicture = false;
+    /* This happens once, or once per frame of a burst. */
+	if (--mPicturesLeft <= 0)
+	{
+	    mTakingPicture = false;
+	}
+
+	if (startPictureThread() != NO_ERROR)
+	{
+		return ;
+	}
+
+	V4L2BUF_t * pbuf = (V4L2BUF_t *)frame;
+	PictureJob job;
+	int pic_w, pic_h;
+
+	camera_dev->getPictureSize(&pic_w, &pic_h);
+
+	JPEG_ENC_t & jpeg_enc	= job.jpeg_enc;
+	memset(&jpeg_enc, 0, sizeof(jpeg_enc));
+	jpeg_enc.addrY			= pbuf->addrPhyY;
+	jpeg_enc.addrC			= pbuf->addrPhyY + camera_dev->getFrameWidth() * camera_dev->getFrameHeight();
+	jpeg_enc.src_w			= camera_dev->getFrameWidth();
+	jpeg_enc.src_h			= camera_dev->getFrameHeight();
+	jpeg_enc.pic_w			= pic_w;
+	jpeg_enc.pic_h			= pic_h;
+	jpeg_enc.colorFormat	= JPEG_COLOR_YUV420;
+	jpeg_enc.quality		= mJpegQuality;
+	jpeg_enc.rotate			= mJpegRotate;
+	
+	// do not use thumb now
+	jpeg_enc.thumbWidth		= 0; // mThumbWidth;
+	jpeg_enc.thumbHeight	= 0; // mThumbHeight;
+
+	jpeg_enc.focal_length	= mFocalLength;
+
+	if (0 != strlen(mGpsMethod))
+	{
+		jpeg_enc.enable_gps			= 1;
+		jpeg_enc.gps_latitude		= mGpsLatitude;
+		jpeg_enc.gps_longitude		= mGpsLongitude;
+		jpeg_enc.gps_altitude		= mGpsAltitude;
+		jpeg_enc.gps_timestamp		= mGpsTimestamp;
+		strcpy(jpeg_enc.gps_processing_method, mGpsMethod);
+		if (!mTakingPicture)
+		{
+			// keep it for the rest of a burst
+			memset(mGpsMethod, 0, sizeof(mGpsMethod));
+		}
+	}
+	else
+	{
+		jpeg_enc.enable_gps			= 0;
+	}
+
+	job.camera_dev	= camera_dev;
+	job.index		= pbuf->index;
+	job.frame_size	= camera_dev->getFrameBufferSize();
+
+	// the encoder reads the capture buffer after we return
+	camera_dev->acquirePreviewFrame(job.index);
+
+	Mutex::Autolock locker(&mPictureLock);
+	while (mPictureJobCount == PICTURE_JOB_NUM)
+	{
+		mPictureDoneCond.wait(mPictureLock);
+	}
+	mPictureJobs[(mPictureJobHead + mPictureJobCount) % PICTURE_JOB_NUM] = job;
+	mPictureJobCount++;
+	mPictureFramesHeld++;
+	mPictureJobCond.signal();
+}
+
+camera_memory_t * CallbackNotifier::getCallbackHeap(camera_memory_t ** heap, 
+														int * heap_size, int size, int count)
+{
+	Mutex::Autolock locker(&mHeapLock);
+
+	if (*heap != NULL && *heap_size == size)
+	{
+		return *heap;
+	}
+
+	// geometry changed, frames still held by the framework keep the old
+	// heap alive through their own references
+	if (*heap != NULL)
+	{
+		(*heap)->release(*heap);
+		*heap = NULL;
+		*heap_size = 0;
+	}
+	if (heap == &mVideoHeap)
+	{
+		memset(mVideoSlotBusy, 0, sizeof(mVideoSlotBusy));
+		memset(mVideoSlotFrame, 0xff, sizeof(mVideoSlotFrame));
+		mVideoFramesHeld = 0;
+	}
+
+	camera_memory_t * mem = mGetMemoryCB(-1, size, count, NULL);
+	countAlloc();
+	if (mem == NULL || mem->data == NULL)
+	{
+		return NULL;
+	}
+
+	ALOGD("%s: %d x %d bytes", __FUNCTION__, count, size);
+	*heap = mem;
+	*heap_size = size;
+
+	return mem;
+}
+
+// takes a slot for a copy (frame -1) or for V4L2 buffer 'frame', of which
+// the encoder holds at most 'max_frames'
+int CallbackNotifier::getFreeVideoSlot(int frame, int max_frames)
+{
+	Mutex::Autolock locker(&mHeapLock);
+
+	if (frame >= 0 && mVideoFramesHeld >= max_frames)
+	{
+		mVideoFramesSkipped++;
+		return -1;
+	}
+
+	for (int i = 0; i < CB_VIDEO_BUFFERS; i++)
+	{
+		if (!mVideoSlotBusy[i])
+		{
+			mVideoSlotBusy[i] = true;
+			mVideoSlotFrame[i] = frame;
+			if (frame >= 0)
+			{
+				mVideoFramesHeld++;
+			}
+			return i;
+		}
+	}
+
+	ALOGW("%s: all %d video buffers are held by the encoder", __FUNCTION__, CB_VIDEO_BUFFERS);
+	return -1;
+}
+
+void CallbackNotifier::releaseCallbackHeaps()
+{
+	Mutex::Autolock locker(&mHeapLock);
+
+	if (mPreviewHeap != NULL)
+	{
+		mPreviewHeap->release(mPreviewHeap);
+		mPreviewHeap = NULL;
+		mPreviewHeapSize = 0;
+	}
+	if (mVideoHeap != NULL)
+	{
+		mVideoHeap->release(mVideoHeap);
+		mVideoHeap = NULL;
+		mVideoHeapSize = 0;
+	}
+	memset(mVideoSlotBusy, 0, sizeof(mVideoSlotBusy));
+	memset(mVideoSlotFrame, 0xff, sizeof(mVideoSlotFrame));
+	mVideoFramesHeld = 0;
+}
+
+void CallbackNotifier::countAlloc()
+{
+	// called with mHeapLock held
+	nsecs_t now = systemTime();
+	if (now - mAllocWindowStart >= 1000000000LL)
+	{
+		mAllocCountLastSecond = (now - mAllocWindowStart < 2000000000LL) ? mAllocCountWindow : 0;
+		mAllocCountWindow = 0;
+		mAllocWindowStart = now;
+	}
+	mAllocCountWindow++;
+	mAllocCount++;
+}
+
+void CallbackNotifier::dump(String8 & result)
+{
+	Mutex::Autolock locker(&mHeapLock);
+
+	// an idle window since the last allocation counts as zero
+	nsecs_t now = systemTime();
+	uint32_t last_second = mAllocCountLastSecond;
+	if (now - mAllocWindowStart >= 2000000000LL)
+	{
+		last_second = 0;
+	}
+	else if (now - mAllocWindowStart >= 1000000000LL)
+	{
+		last_second = mAllocCountWindow;
+	}
+
+	result.appendFormat("  callback heaps: preview %d x %d bytes, video %d x %d bytes\n",
+		mPreviewHeap ? CB_PREVIEW_BUFFERS : 0, mPreviewHeapSize,
+		mVideoHeap ? CB_VIDEO_BUFFERS : 0, mVideoHeapSize);
+	result.appendFormat("  callback heap allocations: %u total, %u in the last second\n",
+		mAllocCount, last_second);
+	result.appendFormat("  video frames: %u delivered, %u decimated, %u skipped (encoder busy), %d fps requested\n",
+		mVideoFramesDelivered, mVideoFramesDecimated, mVideoFramesSkipped, mVideoFps);
+	result.appendFormat("  video slots: %d capture buffers held by the encoder (%s)\n",
+		mVideoFramesHeld, mUseMetaDataBufferMode ? "metadata" : "copies");
+}
+
+void CallbackNotifier::deliverPicture(PictureJob * job)
+{
+	JPEG_ENC_t * jpeg_enc = &job->jpeg_enc;
+	int bufSize = 0;
+	int ret = -1;
+
     /* The sequence of callbacks during picture taking is:
      *  - CAMERA_MSG_SHUTTER
      *  - CAMERA_MSG_RAW_IMAGE_NOTIFY
@@ -340,15 +693,64 @@ void CallbackNotifier::takePictureHW(const void* frame, V4L2Camera* camera_dev)
 		F_LOG;
         mNotifyCB(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
     }
+
+	if (isMessageEnabled(CAMERA_MSG_COMPRESSED_IMAGE)) 
+	{
+		ALOGD("addrY: %x, src: %dx%d, pic: %dx%d, quality: %d, rotate: %d,Gps method: %s, thumbW: %d, thumbH: %d", 
+			jpeg_enc->addrY, 
+			jpeg_enc->src_w, jpeg_enc->src_h,
+			jpeg_enc->pic_w, jpeg_enc->pic_h,
+			jpeg_enc->quality, jpeg_enc->rotate,
+			jpeg_enc->gps_processing_method,
+			jpeg_enc->thumbWidth,
+			jpeg_enc->thumbHeight);
+
+		int outSize = jpeg_enc->pic_w * jpeg_enc->pic_h << 2;
+		if (outSize > mJpegOutBufSize)
+		{
+			if (mJpegOutBuf != NULL)
+			{
+				free(mJpegOutBuf);
+			}
+			mJpegOutBuf = malloc(outSize);
+			mJpegOutBufSize = (mJpegOutBuf != NULL) ? outSize : 0;
+		}
+
+		if (mJpegOutBuf == NULL)
+		{
+			ALOGE("malloc picture memory failed");
+		}
+		else
+		{
+			int64_t lastTime = systemTime() / 1000;
+			job->camera_dev->getFrameTrace().mark(job->index, FRAME_STAGE_ENCODE_START);
+			ret = JpegEnc(mJpegOutBuf, &bufSize, jpeg_enc);
+			job->camera_dev->getFrameTrace().mark(job->index, FRAME_STAGE_ENCODE_END);
+			ALOGD("JpegEnc %dx%d takes %lld (ms)", 
+				jpeg_enc->pic_w, jpeg_enc->pic_h, (systemTime() / 1000 - lastTime) / 1000);
+			if (ret < 0)
+			{
+				ALOGE("JpegEnc failed");
+			}
+		}
+	}
+
+	// the capture buffer is no longer needed
+	job->camera_dev->releasePreviewFrame(job->index);
+	{
+		Mutex::Autolock locker(&mPictureLock);
+		mPictureFramesHeld--;
+		mPictureDoneCond.broadcast();
+	}
 	
     if (isMessageEnabled(CAMERA_MSG_RAW_IMAGE_NOTIFY)) 
 	{
 		F_LOG;
 		camera_memory_t* cam_buff =
-        	mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, NULL);
+        	mGetMemoryCB(-1, job->frame_size, 1, NULL);
         if (NULL != cam_buff && NULL != cam_buff->data) 
 		{
-            memset(cam_buff->data, 0xff, camera_dev->getFrameBufferSize());
+            memset(cam_buff->data, 0xff, job->frame_size);
 			mDataCB(CAMERA_MSG_RAW_IMAGE_NOTIFY, cam_buff, 0, NULL, mCallbackCookie);
 			// mNotifyCB(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCallbackCookie);
 			// mNotifyCB(CAMERA_MSG_RAW_IMAGE_NOTIFY, cam_buff, 0, NULL, mCallbackCookie);
@@ -360,75 +762,17 @@ void CallbackNotifier::takePictureHW(const void* frame, V4L2Camera* camera_dev)
         }
     }
 	
-    if (isMessageEnabled(CAMERA_MSG_COMPRESSED_IMAGE)) 
-	{
-		V4L2BUF_t * pbuf = (V4L2BUF_t *)frame;
-		void * pOutBuf = NULL;
-		int bufSize = 0;
-		int pic_w, pic_h;
-
-		camera_dev->getPictureSize(&pic_w, &pic_h);
-			
-        JPEG_ENC_t jpeg_enc;
-		memset(&jpeg_enc, 0, sizeof(jpeg_enc));
-		jpeg_enc.addrY			= pbuf->addrPhyY;
-		jpeg_enc.addrC			= pbuf->addrPhyY + camera_dev->getFrameWidth() * camera_dev->getFrameHeight();
-		jpeg_enc.src_w			= camera_dev->getFrameWidth();
-		jpeg_enc.src_h			= camera_dev->getFrameHeight();
-		jpeg_enc.pic_w			= pic_w;
-		jpeg_enc.pic_h			= pic_h;
-		jpeg_enc.colorFormat	= JPEG_COLOR_YUV420;
-		jpeg_enc.quality		= mJpegQuality;
-		jpeg_enc.rotate			= mJpegRotate;
-		
-		// do not use thumb now
-		jpeg_enc.thumbWidth		= 0; // mThumbWidth;
-		jpeg_enc.thumbHeight	= 0; // mThumbHeight;
-
-		jpeg_enc.focal_length	= mFocalLength;
-
-		if (0 != strlen(mGpsMethod))
-		{
-			jpeg_enc.enable_gps			= 1;
-			jpeg_enc.gps_latitude		= mGpsLatitude;
-			jpeg_enc.gps_longitude		= mGpsLongitude;
-			jpeg_enc.gps_altitude		= mGpsAltitude;
-			jpeg_enc.gps_timestamp		= mGpsTimestamp;
-			strcpy(jpeg_enc.gps_processing_method, mGpsMethod);
-			memset(mGpsMethod, 0, sizeof(mGpsMethod));
-		}
-		else
-		{
-			jpeg_enc.enable_gps			= 0;
-		}
-		
-		ALOGD("addrY: %x, src: %dx%d, pic: %dx%d, quality: %d, rotate: %d,Gps method: %s, thumbW: %d, thumbH: %d", 
-			jpeg_enc.addrY, 
-			jpeg_enc.src_w, jpeg_enc.src_h,
-			jpeg_enc.pic_w, jpeg_enc.pic_h,
-			jpeg_enc.quality, jpeg_enc.rotate,
-			jpeg_enc.gps_processing_method,
-			jpeg_enc.thumbWidth,
-			jpeg_enc.thumbHeight);
-		
-		pOutBuf = (void *)malloc(jpeg_enc.pic_w * jpeg_enc.pic_h << 2);
-		if (pOutBuf == NULL)
-		{
-			ALOGE("malloc picture memory failed");
-			return ;
-		}
-		
-		int ret = JpegEnc(pOutBuf, &bufSize, &jpeg_enc);
-		if (ret < 0)
-		{
-			ALOGE("JpegEnc failed");
-			return ;			
-		}
-
+    if (ret >= 0 && isMessageEnabled(CAMERA_MSG_COMPRESSED_IMAGE)) 
+	{
+		// JpegEnc cannot encode into a recycled callback heap: the framework
+		// hands the client an IMemory of the whole buffer, its size is the
+		// JPEG length, and that is only known after encoding. The client may
+		// also still read a delivered heap when the next picture is encoded.
+		// So the picture is copied once, into a heap of its exact size.
 		camera_memory_t* jpeg_buff = mGetMemoryCB(-1, bufSize, 1, NULL);
 		if (NULL != jpeg_buff && NULL != jpeg_buff->data) 
 		{
-			memcpy(jpeg_buff->data, (uint8_t *)pOutBuf, bufSize); 
+			memcpy(jpeg_buff->data, (uint8_t *)mJpegOutBuf, bufSize); 
 			mDataCB(CAMERA_MSG_COMPRESSED_IMAGE, jpeg_buff, 0, NULL, mCallbackCookie);
 			jpeg_buff->release(jpeg_buff);
 		} 
@@ -436,13 +780,8 @@ void CallbackNotifier::takePictureHW(const void* frame, V4L2Camera* camera_dev)
 		{
 			ALOGE("%s: Memory failure in CAMERA_MSG_COMPRESSED_IMAGE", __FUNCTION__);
 		}
-
-		if(pOutBuf != NULL)
-		{
-			free(pOutBuf);
-			pOutBuf = NULL;
-		}
     }
+	job->camera_dev->onPictureDelivered();
 
 	ALOGD("taking photo to CAMERA_MSG_POSTVIEW_FRAME");
 
@@ -450,10 +789,10 @@ void CallbackNotifier::takePictureHW(const void* frame, V4L2Camera* camera_dev)
 	{
 		F_LOG;
 		camera_memory_t* cam_buff =
-        	mGetMemoryCB(-1, camera_dev->getFrameBufferSize(), 1, NULL);
+        	mGetMemoryCB(-1, job->frame_size, 1, NULL);
         if (NULL != cam_buff && NULL != cam_buff->data) 
 		{
-            memset(cam_buff->data, 0xff, camera_dev->getFrameBufferSize());
+            memset(cam_buff->data, 0xff, job->frame_size);
 			mDataCB(CAMERA_MSG_POSTVIEW_FRAME, cam_buff, 0, NULL, mCallbackCookie);
             cam_buff->release(cam_buff);
         } 
@@ -466,6 +805,81 @@ void CallbackNotifier::takePictureHW(const void* frame, V4L2Camera* camera_dev)
 	ALOGD("taking photo end");
 }
 
+bool CallbackNotifier::pictureThread()
+{
+	PictureJob * job;
+	{
+		Mutex::Autolock locker(&mPictureLock);
+		while (mPictureJobCount == 0 && !mPictureThreadExit)
+		{
+			mPictureJobCond.wait(mPictureLock);
+		}
+
+		// queued pictures are delivered before the thread exits
+		if (mPictureJobCount == 0)
+		{
+			return false;
+		}
+
+		// the slot is not reused until the job is popped below
+		job = &mPictureJobs[mPictureJobHead];
+	}
+
+	deliverPicture(job);
+
+	Mutex::Autolock locker(&mPictureLock);
+	mPictureJobHead = (mPictureJobHead + 1) % PICTURE_JOB_NUM;
+	mPictureJobCount--;
+	mPictureDoneCond.broadcast();
+
+	return true;
+}
+
+status_t CallbackNotifier::startPictureThread()
+{
+	if (mPictureThread != NULL)
+	{
+		return NO_ERROR;
+	}
+
+	mPictureThreadExit = false;
+	mPictureThread = new PictureThread(this);
+	status_t res = mPictureThread->run("CameraPictureThread", ANDROID_PRIORITY_FOREGROUND);
+	if (res != NO_ERROR)
+	{
+		ALOGE("%s: Unable to start picture thread: %d", __FUNCTION__, res);
+		mPictureThread.clear();
+	}
+
+	return res;
+}
+
+void CallbackNotifier::stopPictureThread()
+{
+	if (mPictureThread == NULL)
+	{
+		return ;
+	}
+
+	{
+		Mutex::Autolock locker(&mPictureLock);
+		mPictureThreadExit = true;
+		mPictureJobCond.signal();
+	}
+
+	mPictureThread->requestExitAndWait();
+	mPictureThread.clear();
+}
+
+void CallbackNotifier::waitPictureFrames()
+{
+	Mutex::Autolock locker(&mPictureLock);
+	while (mPictureFramesHeld > 0)
+	{
+		mPictureDoneCond.wait(mPictureLock);
+	}
+}
+
 void CallbackNotifier::takePictureSW(const void* frame, V4L2Camera* camera_dev)
 {
 	if (!mTakingPicture) 
@@ -524,14 +938,42 @@ void CallbackNotifier::onCameraDeviceError(int err)
 
 bool CallbackNotifier::isNewVideoFrameTime(nsecs_t timestamp)
 {
-    return true;		// to do here
-	
     Mutex::Autolock locker(&mObjectLock);
-    if ((timestamp - mLastFrameTimestamp) >= mFrameRefreshFreq) {
-        mLastFrameTimestamp = timestamp;
+    if (mVideoFps <= 0) {
         return true;
     }
-    return false;
+
+    if (mLastFrameTimestamp != 0 && timestamp > mLastFrameTimestamp) {
+        const nsecs_t delta = timestamp - mLastFrameTimestamp;
+        mInputInterval = (mInputInterval == 0) ? delta : (mInputInterval * 3 + delta) / 4;
+    }
+    mLastFrameTimestamp = timestamp;
+
+    if (mScheduleStart == 0) {
+        mScheduleStart = timestamp;
+        mScheduleFrames = 1;
+        mVideoFramesDelivered++;
+        return true;
+    }
+
+    /* Slot of the next frame, computed from the start so that fractional
+     * intervals do not accumulate rounding errors. */
+    const nsecs_t slot = mScheduleStart + mScheduleFrames * 1000000LL / mVideoFps;
+    if (timestamp + mInputInterval / 2 < slot) {
+        mVideoFramesDecimated++;
+        return false;
+    }
+
+    if (timestamp - slot >= 1000000LL / mVideoFps) {
+        /* Capture fell behind the schedule (dropped frames, or a slower
+         * sensor), restart it here instead of bursting to catch up. */
+        mScheduleStart = timestamp;
+        mScheduleFrames = 1;
+    } else {
+        mScheduleFrames++;
+    }
+    mVideoFramesDelivered++;
+    return true;
 }
 
 }; /* namespace android */
@@ -22,9 +22,17 @@
  * via set_callbacks, enable_msg_type, and disable_msg_type camera HAL API.
  */
 
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+// buffers in the recycled preview / video callback heaps
+#define CB_PREVIEW_BUFFERS	4
+#define CB_VIDEO_BUFFERS	8
+
 namespace android {
 
 class V4L2Camera;
+struct PictureJob;
 
 /* Manages callbacks set via set_callbacks, enable_msg_type, and disable_msg_type
  * camera HAL API.
@@ -100,8 +108,17 @@ public:
     /* Releases video frame, sent to the framework.
      * This method is called by the containing V4L2Camera object when it is
      * handing the camera_device_ops_t::release_recording_frame callback.
+     * Return:
+     *  Index of the V4L2 buffer the encoder held through this frame, which
+     *  the caller must release, or -1 if the frame was a copy, or is stale.
+     */
+    int releaseRecordingFrame(const void* opaque);
+
+    /* Forgets the video frames held by the encoder. Called once the device
+     * has stopped and taken its buffers back, releases that come later are
+     * ignored.
      */
-    void releaseRecordingFrame(const void* opaque);
+    void resetVideoSlots();
 
     /* Actual handler for camera_device_ops_t::msg_type_enabled callback.
      * This method is called by the containing V4L2Camera object when it is
@@ -177,9 +194,14 @@ public:
     /* Sets, or resets taking picture state.
      * This state control whether or not to notify the framework about compressed
      * image, shutter, and other picture related events.
+     * Param:
+     *  taking - Taking picture state.
+     *  count - Number of pictures to deliver, more than one for a burst.
      */
-    void setTakingPicture(bool taking)
+    void setTakingPicture(bool taking, int count = 1)
     {
+        mPicturesCount = taking ? count : 0;
+        mPicturesLeft = mPicturesCount;
         mTakingPicture = taking;
     }
 
@@ -195,9 +217,11 @@ public:
 
 protected:
     /* Checks if it's time to push new video frame.
-     * Note that this method must be called while object is locked.
+     * Frames are picked on an exact schedule of 1/fps steps, so that 30 -> 24
+     * fps comes out even, and a frame within half an input period of its
+     * slot counts as on time to absorb capture jitter.
      * Param:
-     *  timestamp - Timestamp for the new frame. */
+     *  timestamp - Timestamp for the new frame, in microseconds. */
     bool isNewVideoFrameTime(nsecs_t timestamp);
 
     /****************************************************************************
@@ -218,11 +242,24 @@ protected:
     camera_request_memory           mGetMemoryCB;
     void*                           mCallbackCookie;
 
-    /* Timestamp when last frame has been delivered to the framework. */
+    /* Timestamp of the last frame seen while recording. */
     nsecs_t                         mLastFrameTimestamp;
 
-    /* Video frequency in nanosec. */
-    nsecs_t                         mFrameRefreshFreq;
+    /* Video frame rate requested for recording. */
+    int                             mVideoFps;
+
+    /* Start of the current output schedule, and frames delivered on it. */
+    nsecs_t                         mScheduleStart;
+    int64_t                         mScheduleFrames;
+
+    /* Smoothed interval between captured frames. */
+    nsecs_t                         mInputInterval;
+
+    /* Video frames delivered, dropped by the decimator, and skipped because
+     * the encoder held every buffer it may take from the capture queue. */
+    uint32_t                        mVideoFramesDelivered;
+    uint32_t                        mVideoFramesDecimated;
+    uint32_t                        mVideoFramesSkipped;
 
     /* Message enabler. */
     uint32_t                        mMessageEnabler;
@@ -236,6 +273,12 @@ protected:
     /* Picture taking status. */
     bool                            mTakingPicture;
 
+    /* Pictures left to deliver while taking pictures. */
+    int                             mPicturesLeft;
+
+    /* Pictures asked for by the last takePicture, more than one for a burst. */
+    int                             mPicturesCount;
+
 	// -------------------------------------------------------------------------
 	// extended interfaces here <***** star *****>
 	// -------------------------------------------------------------------------
@@ -288,13 +331,53 @@ public:
 		mFocalLength = val;
 	}
 	
-	status_t autoFocus();
+	// auto focus result, and lens moves of the continuous modes
+	void notifyFocus(bool success);
+	void notifyFocusMove(bool start);
 
 	void takePicture(const void* frame, V4L2Camera* camera_dev, bool bUseMataData);
 	void takePictureHW(const void* frame, V4L2Camera* camera_dev);
 	void takePictureSW(const void* frame, V4L2Camera* camera_dev);
+
+	// waits until no queued or running picture job holds a capture buffer
+	void waitPictureFrames();
+
+	// appends callback memory statistics for dumpCamera
+	void dump(String8 & result);
 	
 protected:
+	// encodes queued pictures and delivers their callbacks, so that the
+	// camera worker thread goes straight back to preview
+	class PictureThread : public Thread
+	{
+	public:
+		PictureThread(CallbackNotifier * notifier)
+			: Thread(false),
+			  mNotifier(notifier)
+		{
+		}
+
+	private:
+		bool threadLoop()
+		{
+			return mNotifier->pictureThread();
+		}
+
+		CallbackNotifier * mNotifier;
+	};
+
+	// returns a recycled callback heap of 'count' buffers of 'size' bytes,
+	// reallocated only when the size changes
+	camera_memory_t * getCallbackHeap(camera_memory_t ** heap, int * heap_size, int size, int count);
+	int getFreeVideoSlot(int frame, int max_frames);
+	void releaseCallbackHeaps();
+	void countAlloc();
+
+	bool pictureThread();
+	status_t startPictureThread();
+	void stopPictureThread();
+	void deliverPicture(PictureJob * job);
+
 	bool 							mUseMetaDataBufferMode;
 
 	// JPEG rotate used to compress frame during picture taking.
@@ -311,6 +394,47 @@ protected:
 	int			mThumbHeight;
 	
 	double		mFocalLength;
+
+	sp<PictureThread>				mPictureThread;
+	bool							mPictureThreadExit;
+
+	// bounded queue of picture jobs
+	PictureJob *					mPictureJobs;
+	int								mPictureJobHead;
+	int								mPictureJobCount;
+
+	// capture buffers referenced by queued or running jobs
+	int								mPictureFramesHeld;
+
+	Mutex							mPictureLock;
+	Condition						mPictureJobCond;	// job queued, or exit
+	Condition						mPictureDoneCond;	// job done, or buffer released
+
+	// JpegEnc output, reused for every picture and grown with the picture size
+	void *							mJpegOutBuf;
+	int								mJpegOutBufSize;
+
+	// preview callback frames rotate through one heap
+	camera_memory_t *				mPreviewHeap;
+	int								mPreviewHeapSize;	// one buffer
+	int								mPreviewHeapIndex;
+
+	// video frames stay with the encoder until releaseRecordingFrame, in
+	// metadata mode a slot holds a V4L2BUF_t and its V4L2 buffer stays
+	// referenced until then
+	camera_memory_t *				mVideoHeap;
+	int								mVideoHeapSize;		// one buffer
+	bool							mVideoSlotBusy[CB_VIDEO_BUFFERS];
+	int								mVideoSlotFrame[CB_VIDEO_BUFFERS];	// V4L2 index, -1 for copies
+	int								mVideoFramesHeld;	// slots with a V4L2 buffer
+
+	// mGetMemoryCB calls on the frame path
+	uint32_t						mAllocCount;
+	uint32_t						mAllocCountLastSecond;
+	uint32_t						mAllocCountWindow;
+	nsecs_t							mAllocWindowStart;
+
+	Mutex							mHeapLock;
 };
 
 }; /* namespace android */
@@ -26,6 +26,7 @@
 #define LOG_TAG "CameraHardware"
 #include "CameraDebug.h"
 
+#include <unistd.h>
 #include <ui/Rect.h>
 #include <drv_display_sun4i.h>
 #include <videodev2.h>
@@ -36,6 +37,16 @@
 /* Defines whether we should trace parameter changes. */
 #define DEBUG_PARAM 1
 
+/* Most pictures a single takePicture call may take in a burst.
+ * The stock CameraClient::handleCompressedPicture disables
+ * CAMERA_MSG_COMPRESSED_IMAGE on the first image, and the notifier then ends
+ * the burst after one shot. A real burst needs the framework to keep the
+ * message enabled until "burst-count" images have arrived. */
+#define MAX_BURST_COUNT	10
+
+/* Longest takePicture waits for a moving lens, ms. */
+#define FOCUS_WAIT_PICTURE_MS	1000
+
 namespace android {
 
 #if DEBUG_PARAM
@@ -60,12 +71,24 @@ static void PrintParamDiff(const CameraParameters& current, const char* new_par)
  */
 static char* AddValue(const char* param, const char* val);
 
+/* Checks that a value is one of a comma separated list of values.
+ * Param:
+ *  list - Values, as in a KEY_SUPPORTED_xxx parameter.
+ *  val - Value to look for.
+ * Return:
+ *  true if 'val' is in the list.
+ */
+static bool IsValueInList(const char* list, const char* val);
+
 CameraHardware::CameraHardware(int cameraId, struct hw_module_t* module)
         : mPreviewWindow(),
           mCallbackNotifier(),
+          mFocusController(&mCallbackNotifier),
           mCameraID(cameraId),
           mCameraConfig(NULL),
-          bPixFmtNV12(false)
+          bPixFmtNV12(false),
+          mAppliedValid(false),
+          mParametersFlatValid(false)
 {
     /*
      * Initialize camera_device descriptor for this object.
@@ -310,7 +333,23 @@ void CameraHardware::initDefaultParameters()
 	p.set(CameraParameters::KEY_HORIZONTAL_VIEW_ANGLE, "51.2");
     p.set(CameraParameters::KEY_VERTICAL_VIEW_ANGLE, "39.4");
 
+	// burst capture, pictures per takePicture
+	p.set(CameraHardware::BURST_COUNT_KEY, 1);
+	p.set(CameraHardware::MAX_BURST_COUNT_KEY, MAX_BURST_COUNT);
+
+	// zero shutter lag
+	if (mCameraConfig->getZslBufferCount() > 0)
+	{
+		parameterString = CameraHardware::ZSL_OFF;
+		parameterString.append(",");
+		parameterString.append(CameraHardware::ZSL_ON);
+		p.set(CameraHardware::ZSL_VALUES_KEY, parameterString.string());
+		p.set(CameraHardware::ZSL_KEY, CameraHardware::ZSL_OFF);
+	}
+
 	mParameters = p;
+	parametersChanged();
+	mFocusController.setFocusMode(mParameters.get(CameraParameters::KEY_FOCUS_MODE));
 
 	ALOGV("CameraHardware::initDefaultParameters ok");
 }
@@ -528,6 +567,7 @@ void CameraHardware::stopRecording()
 	ALOGV("last preview size: %dx%d", mLastPreviewWidth, mLastPreviewHeight);
 	mParameters.setPreviewSize(mLastPreviewWidth, mLastPreviewHeight);
 	mParameters.setVideoSize(mLastPreviewWidth, mLastPreviewHeight);
+	parametersChanged();
 	
 	if (mLastPreviewWidth != new_video_width
 		|| mLastPreviewHeight != new_video_height)
@@ -547,22 +587,29 @@ int CameraHardware::isRecordingEnabled()
 void CameraHardware::releaseRecordingFrame(const void* opaque)
 {
 	F_LOG;
-    mCallbackNotifier.releaseRecordingFrame(opaque);
+	// metadata frames give the encoder's V4L2 buffer back to the driver,
+	// copies only free their slot
+	int index = mCallbackNotifier.releaseRecordingFrame(opaque);
+	if (index >= 0)
+	{
+		V4L2CameraDevice * camera_dev = getCameraDevice();
+		camera_dev->getFrameTrace().mark(index, FRAME_STAGE_ENCODE_END);
+		camera_dev->releasePreviewFrame(index);
+	}
 }
 
 status_t CameraHardware::setAutoFocus()
 {
     ALOGV("%s", __FUNCTION__);
 
-    return mCallbackNotifier.autoFocus();
+    return mFocusController.autoFocus();
 }
 
 status_t CameraHardware::cancelAutoFocus()
 {
     ALOGV("%s", __FUNCTION__);
 
-    /* TODO: Future enhancements. */
-    return NO_ERROR;
+    return mFocusController.cancelAutoFocus();
 }
 
 status_t CameraHardware::takePicture()
@@ -573,9 +620,10 @@ status_t CameraHardware::takePicture()
     int pic_width, pic_height, frame_width, frame_height;
     uint32_t org_fmt;
 
-	// prepare take picture, copy buffer for preview
-	getCameraDevice()->prepareTakePhoto(true);
-	getCameraDevice()->waitPrepareTakePhoto();
+	getCameraDevice()->markShutter();
+
+	// a converged lens is taken as it is, a moving one is given some time
+	mFocusController.waitForFocus(FOCUS_WAIT_PICTURE_MS);
 
     /* Collect frame info for the picture. */
     mParameters.getPictureSize(&pic_width, &pic_height);
@@ -614,6 +662,31 @@ status_t CameraHardware::takePicture()
         jpeg_rotate = 0;  /* Fall back to default. */
     }
 
+	/* Get burst count, bursts are taken at picture size from a restarted stream. */
+	int burst_count = mParameters.getInt(CameraHardware::BURST_COUNT_KEY);
+	if (burst_count <= 1) {
+		burst_count = 1;
+	}
+
+	// zero shutter lag: encode a buffered frame, the stream keeps running
+	if (burst_count == 1 && getCameraDevice()->isZslMode() && mPreviewWindow.isPreviewEnabled())
+	{
+		mCallbackNotifier.setJpegQuality(jpeg_quality);
+		mCallbackNotifier.setJpegRotate(jpeg_rotate);
+		mCallbackNotifier.setTakingPicture(true);
+		res = getCameraDevice()->takeZslPicture();
+		if (res == NO_ERROR)
+		{
+			return NO_ERROR;
+		}
+		ALOGW("%s: zsl picture failed, restart device for the picture", __FUNCTION__);
+		mCallbackNotifier.setTakingPicture(false);
+	}
+
+	// prepare take picture, copy buffer for preview
+	getCameraDevice()->prepareTakePhoto(true);
+	getCameraDevice()->waitPrepareTakePhoto();
+
     /*
      * Make sure preview is not running, and device is stopped before taking
      * picture.
@@ -640,6 +713,7 @@ status_t CameraHardware::takePicture()
 	// close layer before taking picture, 
 	// mPreviewWindow.showLayer(false);
 	
+	getCameraDevice()->setBurstCount(burst_count);
 	camera_dev->setTakingPicture(true);
     /* Start camera device for the picture frame. */
     ALOGD("Starting camera for picture: %.4s(%s)[%dx%d]",
@@ -652,10 +726,10 @@ status_t CameraHardware::takePicture()
         return res;
     }
 	
-    /* Deliver one frame only. */
+    /* Deliver one frame, or burst_count consecutive frames. */
     mCallbackNotifier.setJpegQuality(jpeg_quality);
 	mCallbackNotifier.setJpegRotate(jpeg_rotate);
-    mCallbackNotifier.setTakingPicture(true);
+    mCallbackNotifier.setTakingPicture(true, burst_count);
     // res = camera_dev->startDeliveringFrames(true);	
 	res = camera_dev->startDeliveringFrames(false);		// star modify
     if (res != NO_ERROR) {
@@ -682,8 +756,14 @@ status_t CameraHardware::setParameters(const char* p)
 	
     PrintParamDiff(mParameters, p);
 
-    CameraParameters params;
+	// apps send the whole set many times a second, mostly unchanged
 	String8 str8_param(p);
+	if (mAppliedValid && str8_param == mAppliedFlat)
+	{
+		return NO_ERROR;
+	}
+
+    CameraParameters params;
     params.unflatten(str8_param);
 
 	V4L2CameraDevice* pV4L2Device = getCameraDevice();
@@ -693,6 +773,9 @@ status_t CameraHardware::setParameters(const char* p)
 		return UNKNOWN_ERROR;
 	}
 
+	// only keys changed since the last call reach the driver below
+	mParametersFlatValid = false;
+
 	// preview format
 	const char * new_preview_format = params.getPreviewFormat();
 	ALOGD("new_preview_format : %s", new_preview_format);
@@ -729,6 +812,7 @@ status_t CameraHardware::setParameters(const char* p)
 	}
 
 	// preview size
+	bool preview_size_changed = paramChanged(params, CameraParameters::KEY_PREVIEW_SIZE);
     int new_preview_width  = 0;
     int new_preview_height = 0;
     params.getPreviewSize(&new_preview_width, &new_preview_height);
@@ -736,18 +820,21 @@ status_t CameraHardware::setParameters(const char* p)
          __FUNCTION__, new_preview_width, new_preview_height);
 	if (0 < new_preview_width && 0 < new_preview_height)
 	{
-		mLastPreviewWidth = mCurPreviewWidth;
-		mLastPreviewHeight = mCurPreviewHeight;
-		
-		// try size
-		ret = pV4L2Device->tryFmtSize(&new_preview_width, &new_preview_height);
-		if(ret < 0)
+		if (preview_size_changed)
 		{
-			return ret;
+			mLastPreviewWidth = mCurPreviewWidth;
+			mLastPreviewHeight = mCurPreviewHeight;
+			
+			// try size
+			ret = pV4L2Device->tryFmtSize(&new_preview_width, &new_preview_height);
+			if(ret < 0)
+			{
+				return ret;
+			}
+			
+			mParameters.setPreviewSize(new_preview_width, new_preview_height);
+			mParameters.setVideoSize(new_preview_width, new_preview_height);
 		}
-		
-		mParameters.setPreviewSize(new_preview_width, new_preview_height);
-		mParameters.setVideoSize(new_preview_width, new_preview_height);
 	}
 	else
 	{
@@ -762,7 +849,19 @@ status_t CameraHardware::setParameters(const char* p)
 	if (0 < new_preview_frame_rate && 0 < new_min_frame_rate 
 		&& new_min_frame_rate <= new_max_frame_rate)
 	{
-		mParameters.setPreviewFrameRate(pV4L2Device->getFrameRate());
+		// the device rate only changes with the preview size
+		if (preview_size_changed
+			|| paramChanged(params, CameraParameters::KEY_PREVIEW_FRAME_RATE))
+		{
+			// the device runs at its own rate, video frames are decimated
+			// down to a lower requested rate while recording
+			int frame_rate = pV4L2Device->getFrameRate();
+			if (new_preview_frame_rate < frame_rate)
+			{
+				frame_rate = new_preview_frame_rate;
+			}
+			mParameters.setPreviewFrameRate(frame_rate);
+		}
 	}
 	else
 	{
@@ -797,7 +896,8 @@ status_t CameraHardware::setParameters(const char* p)
 	}
 
 	// image effect
-	if (mCameraConfig->supportColorEffect())
+	if (mCameraConfig->supportColorEffect()
+		&& paramChanged(params, CameraParameters::KEY_EFFECT))
 	{
 		const char *new_image_effect_str = params.get(CameraParameters::KEY_EFFECT);
 	    if (new_image_effect_str != NULL) {
@@ -832,7 +932,8 @@ status_t CameraHardware::setParameters(const char* p)
 	}
 
 	// white balance
-	if (mCameraConfig->supportWhiteBalance())
+	if (mCameraConfig->supportWhiteBalance()
+		&& paramChanged(params, CameraParameters::KEY_WHITE_BALANCE))
 	{
 		const char *new_white_str = params.get(CameraParameters::KEY_WHITE_BALANCE);
 	    ALOGV("%s : new_white_str %s", __FUNCTION__, new_white_str);
@@ -877,7 +978,8 @@ status_t CameraHardware::setParameters(const char* p)
 	}
 	
 	// exposure compensation
-	if (mCameraConfig->supportExposureCompensation())
+	if (mCameraConfig->supportExposureCompensation()
+		&& paramChanged(params, CameraParameters::KEY_EXPOSURE_COMPENSATION))
 	{
 		int new_exposure_compensation = params.getInt(CameraParameters::KEY_EXPOSURE_COMPENSATION);
 		int max_exposure_compensation = params.getInt(CameraParameters::KEY_MAX_EXPOSURE_COMPENSATION);
@@ -911,11 +1013,17 @@ status_t CameraHardware::setParameters(const char* p)
 
 	// focus
 	const char *new_focus_mode_str = params.get(CameraParameters::KEY_FOCUS_MODE);
-	if (strcmp(new_focus_mode_str, CameraParameters::FOCUS_MODE_AUTO))
+	if (new_focus_mode_str == NULL
+		|| !IsValueInList(mParameters.get(CameraParameters::KEY_SUPPORTED_FOCUS_MODES), new_focus_mode_str))
 	{
 		ALOGE("invalid focus mode: %s", new_focus_mode_str);
 		return -EINVAL;
 	}
+	if (paramChanged(params, CameraParameters::KEY_FOCUS_MODE))
+	{
+		mFocusController.setFocusMode(new_focus_mode_str);
+		mParameters.set(CameraParameters::KEY_FOCUS_MODE, new_focus_mode_str);
+	}
 
 	// gps latitude
     const char *new_gps_latitude_str = params.get(CameraParameters::KEY_GPS_LATITUDE);
@@ -972,25 +1080,74 @@ status_t CameraHardware::setParameters(const char* p)
 		mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, new_jpeg_thumbnail_width);
 		mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, new_jpeg_thumbnail_height);
 	}
+
+	// burst count
+	int new_burst_count = params.getInt(CameraHardware::BURST_COUNT_KEY);
+	if (new_burst_count > MAX_BURST_COUNT)
+	{
+		ALOGE("invalid burst count: %d", new_burst_count);
+		return -EINVAL;
+	}
+	mParameters.set(CameraHardware::BURST_COUNT_KEY, (new_burst_count > 1) ? new_burst_count : 1);
+
+	// zero shutter lag, takes effect on the next preview start
+	const char *new_zsl_str = params.get(CameraHardware::ZSL_KEY);
+	if (new_zsl_str != NULL && mParameters.get(CameraHardware::ZSL_VALUES_KEY) != NULL)
+	{
+		if (!strcmp(new_zsl_str, CameraHardware::ZSL_ON)
+			|| !strcmp(new_zsl_str, CameraHardware::ZSL_OFF))
+		{
+			mParameters.set(CameraHardware::ZSL_KEY, new_zsl_str);
+		}
+		else
+		{
+			ALOGE("invalid zsl mode: %s", new_zsl_str);
+			return -EINVAL;
+		}
+	}
+
+	mAppliedFlat = str8_param;
+	mAppliedParameters = params;
+	mAppliedValid = true;
 	
     return NO_ERROR;
 }
 
+bool CameraHardware::paramChanged(const CameraParameters & params, const char * key)
+{
+	if (!mAppliedValid)
+	{
+		return true;
+	}
+
+	const char * old_value = mAppliedParameters.get(key);
+	const char * new_value = params.get(key);
+	if (old_value == NULL || new_value == NULL)
+	{
+		return old_value != new_value;
+	}
+
+	return strcmp(old_value, new_value) != 0;
+}
+
 /* A dumb variable indicating "no params" / error on the exit from
  * CameraHardware::getParameters(). */
 static char lNoParam = '\0';
 char* CameraHardware::getParameters()
 {
 	F_LOG;
-    String8 params(mParameters.flatten());
-    char* ret_str =
-        reinterpret_cast<char*>(malloc(sizeof(char) * (params.length()+1)));
-    memset(ret_str, 0, params.length()+1);
+	// flattened again only after the parameters changed
+	if (!mParametersFlatValid)
+	{
+		mParametersFlat = mParameters.flatten();
+		mParametersFlatValid = true;
+	}
+
+    char* ret_str = const_cast<char*>(mParametersFlat.string());
     if (ret_str != NULL) {
-        strncpy(ret_str, params.string(), params.length()+1);
         return ret_str;
     } else {
-        ALOGE("%s: Unable to allocate string for %s", __FUNCTION__, params.string());
+        ALOGE("%s: No flattened parameters", __FUNCTION__);
         /* Apparently, we can't return NULL fron this routine. */
         return &lNoParam;
     }
@@ -999,10 +1156,8 @@ char* CameraHardware::getParameters()
 void CameraHardware::putParameters(char* params)
 {
 	F_LOG;
-    /* This method simply frees parameters allocated in getParameters(). */
-    if (params != NULL && params != &lNoParam) {
-        free(params);
-    }
+    /* The string returned by getParameters() is cached, there is nothing to
+     * free here. */
 }
 
 status_t CameraHardware::sendCommand(int32_t cmd, int32_t arg1, int32_t arg2)
@@ -1035,8 +1190,22 @@ status_t CameraHardware::dumpCamera(int fd)
 {
     ALOGV("%s", __FUNCTION__);
 
-    /* TODO: Future enhancements. */
-    return -EINVAL;
+	String8 result;
+	result.appendFormat("Camera %d dump:\n", mCameraID);
+
+	V4L2CameraDevice* pV4L2Device = getCameraDevice();
+	if (pV4L2Device != NULL)
+	{
+		pV4L2Device->dumpQueueStats(result);
+		pV4L2Device->dumpPictureStats(result);
+		pV4L2Device->getFrameTrace().dump(result);
+	}
+	mFocusController.dump(result);
+	mCallbackNotifier.dump(result);
+
+	write(fd, result.string(), result.size());
+
+    return NO_ERROR;
 }
 
 /****************************************************************************
@@ -1047,7 +1216,7 @@ status_t CameraHardware::doStartPreview()
 {
     ALOGV("%s", __FUNCTION__);
 	
-    V4L2Camera* camera_dev = getCameraDevice();
+    V4L2CameraDevice* camera_dev = getCameraDevice();
     if (camera_dev->isStarted()) {
         camera_dev->stopDeliveringFrames();
         camera_dev->stopDevice();
@@ -1122,6 +1291,38 @@ status_t CameraHardware::doStartPreview()
         mPreviewWindow.stopPreview();
         return EINVAL;
     }
+
+	// ZSL streams at picture size so that any frame can be encoded, the
+	// HW encoder only takes NV12
+	int zsl_buffers = 0;
+	const char* zsl = mParameters.get(CameraHardware::ZSL_KEY);
+	if (zsl != NULL && strcmp(zsl, CameraHardware::ZSL_ON) == 0)
+	{
+		if (org_fmt == V4L2_PIX_FMT_NV12)
+		{
+			mParameters.getPictureSize(&width, &height);
+			camera_dev->tryFmtSize(&width, &height);
+			zsl_buffers = mCameraConfig->getZslBufferCount();
+		}
+		else
+		{
+			ALOGW("%s: zsl needs NV12 frames, disabled", __FUNCTION__);
+		}
+	}
+	camera_dev->setZslBufferCount(zsl_buffers);
+
+	// preview callbacks come at the preview size and format, whatever the
+	// capture runs at
+	int cb_width, cb_height;
+	uint32_t cb_fmt = 0;
+	const char* cb_pix_fmt = mParameters.getPreviewFormat();
+	mParameters.getPreviewSize(&cb_width, &cb_height);
+	if (cb_pix_fmt != NULL && strcmp(cb_pix_fmt, CameraParameters::PIXEL_FORMAT_YUV420SP) == 0) {
+		cb_fmt = V4L2_PIX_FMT_NV21;
+	} else if (cb_pix_fmt != NULL && strcmp(cb_pix_fmt, CameraParameters::PIXEL_FORMAT_YUV420P) == 0) {
+		cb_fmt = V4L2_PIX_FMT_YVU420;
+	}
+	camera_dev->setPreviewCallbackFormat(cb_width, cb_height, cb_fmt);
 	
     ALOGD("Starting camera: %dx%d -> %.4s(%s)",
          width, height, reinterpret_cast<const char*>(&org_fmt), pix_fmt);
@@ -1131,12 +1332,15 @@ status_t CameraHardware::doStartPreview()
         return res;
     }
 
+	mFocusController.start(camera_dev);
+
 	// save current preview size
 	mCurPreviewWidth = width;
 	mCurPreviewHeight = height;
 
     res = camera_dev->startDeliveringFrames(false);
     if (res != NO_ERROR) {
+        mFocusController.stop();
         camera_dev->stopDevice();
         mPreviewWindow.stopPreview();
     }
@@ -1150,6 +1354,8 @@ status_t CameraHardware::doStopPreview()
 
 	// set layer off can avoid Flicker
 	// mPreviewWindow.showLayer(false);
+
+	mFocusController.stop();
 	
     status_t res = NO_ERROR;
     if (mPreviewWindow.isPreviewEnabled()) {
@@ -1181,6 +1387,7 @@ status_t CameraHardware::cleanupCamera()
 
 	// reset preview format to yuv420sp
 	mParameters.set(CameraParameters::KEY_PREVIEW_FORMAT, CameraParameters::PIXEL_FORMAT_YUV420SP);
+	parametersChanged();
 	mCallbackNotifier.storeMetaDataInBuffers(false);
 	
     /* If preview is running - stop it. */
@@ -1567,6 +1774,10 @@ camera_device_ops_t CameraHardware::mDeviceOps = {
 const char CameraHardware::FACING_KEY[]         = "prop-facing";
 const char CameraHardware::ORIENTATION_KEY[]    = "prop-orientation";
 const char CameraHardware::RECORDING_HINT_KEY[] = "recording-hint";
+const char CameraHardware::ZSL_KEY[]            = "zsl";
+const char CameraHardware::ZSL_VALUES_KEY[]     = "zsl-values";
+const char CameraHardware::BURST_COUNT_KEY[]    = "burst-count";
+const char CameraHardware::MAX_BURST_COUNT_KEY[] = "max-burst-count";
 
 /****************************************************************************
  * Common string values
@@ -1574,6 +1785,8 @@ const char CameraHardware::RECORDING_HINT_KEY[] = "recording-hint";
 
 const char CameraHardware::FACING_BACK[]      = "back";
 const char CameraHardware::FACING_FRONT[]     = "front";
+const char CameraHardware::ZSL_ON[]           = "on";
+const char CameraHardware::ZSL_OFF[]          = "off";
 
 /****************************************************************************
  * Helper routines
@@ -1594,6 +1807,20 @@ static char* AddValue(const char* param, const char* val)
     return ret;
 }
 
+static bool IsValueInList(const char* list, const char* val)
+{
+    const size_t len = strlen(val);
+    while (list != NULL && *list != '\0') {
+        const char* end = strchr(list, ',');
+        const size_t item = (end != NULL) ? (size_t)(end - list) : strlen(list);
+        if (item == len && strncmp(list, val, len) == 0) {
+            return true;
+        }
+        list = (end != NULL) ? end + 1 : NULL;
+    }
+    return false;
+}
+
 /****************************************************************************
  * Parameter debugging helpers
  ***************************************************************************/
@@ -32,6 +32,7 @@
 #include "V4L2CameraDevice.h"
 #include "PreviewWindow.h"
 #include "CallbackNotifier.h"
+#include "FocusController.h"
 
 namespace android {
 
@@ -258,8 +259,9 @@ protected:
     /* Actual handler for camera_device_ops_t::get_parameters callback.
      * NOTE: When this method is called the object is locked.
      * Return:
-     *  Flattened parameters string. The caller will free the buffer allocated
-     *  for the string by calling camera_device_ops_t::put_parameters callback.
+     *  Flattened parameters string, cached until the parameters change. The
+     *  caller releases it by calling camera_device_ops_t::put_parameters
+     *  callback, before the next set_parameters call.
      */
     virtual char* getParameters();
 
@@ -401,6 +403,9 @@ protected:
     /* Callback notifier. */
     CallbackNotifier                mCallbackNotifier;
 
+    /* Auto focus, after mCallbackNotifier that it notifies. */
+    FocusController                 mFocusController;
+
     /* Zero-based ID assigned to this camera. */
     int                             mCameraID;
 
@@ -416,6 +421,10 @@ public:
     static const char FACING_KEY[];
     static const char ORIENTATION_KEY[];
     static const char RECORDING_HINT_KEY[];
+    static const char ZSL_KEY[];
+    static const char ZSL_VALUES_KEY[];
+    static const char BURST_COUNT_KEY[];
+    static const char MAX_BURST_COUNT_KEY[];
 
      /****************************************************************************
      * Common string values
@@ -425,6 +434,10 @@ public:
     static const char FACING_BACK[];
     static const char FACING_FRONT[];
 
+    /* Possible values for ZSL_KEY */
+    static const char ZSL_ON[];
+    static const char ZSL_OFF[];
+
 	// -------------------------------------------------------------------------
 	// extended interfaces here <***** star *****>
 	// -------------------------------------------------------------------------
@@ -434,6 +447,18 @@ public:
 
 	void onTakingPicture(const void* frame, V4L2Camera* camera_dev, bool bUseMataData);
 
+	// waits until the picture encoder is done with the capture buffers
+	inline void waitPictureFrames()
+	{
+		mCallbackNotifier.waitPictureFrames();
+	}
+
+	// the stream is off, video frames the encoder still holds are void
+	inline void resetVideoFrames()
+	{
+		mCallbackNotifier.resetVideoSlots();
+	}
+
 protected:
 	CCameraConfig * mCameraConfig;
 
@@ -444,6 +469,26 @@ protected:
 	int mLastPreviewHeight;
 
 	bool bPixFmtNV12;	// true for NV12, false for NV21
+
+	// mParameters changed outside setParameters, the next setParameters
+	// applies every key again
+	inline void parametersChanged()
+	{
+		mAppliedValid = false;
+		mParametersFlatValid = false;
+	}
+
+	// true if 'key' differs from the last parameters given to setParameters
+	bool paramChanged(const CameraParameters & params, const char * key);
+
+	// last parameters applied by setParameters, as given by the app
+	String8 mAppliedFlat;
+	CameraParameters mAppliedParameters;
+	bool mAppliedValid;
+
+	// mParameters flattened for getParameters
+	String8 mParametersFlat;
+	bool mParametersFlatValid;
 };
 
 }; /* namespace android */
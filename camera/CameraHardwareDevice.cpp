@@ -74,6 +74,10 @@ status_t CameraHardwareDevice::Initialize()
 	mV4L2CameraDevice->setV4L2DeviceName(pDevice);
 	mV4L2CameraDevice->setV4L2DeviceID(deviceId);
 	mV4L2CameraDevice->setCameraFacing(cameraFacing);
+	if (mCameraConfig->getBufferCount() > 0)
+	{
+		mV4L2CameraDevice->setBufferCount(mCameraConfig->getBufferCount());
+	}
 
     res = CameraHardware::Initialize();
     if (res != NO_ERROR) {
@@ -93,9 +97,4 @@ V4L2CameraDevice* CameraHardwareDevice::getCameraDevice()
     return mV4L2CameraDevice;
 }
 
-void CameraHardwareDevice::releaseRecordingFrame(const void* opaque)
-{
-	mV4L2CameraDevice->releasePreviewFrame(*(int*)opaque);
-}
-
 };  /* namespace android */
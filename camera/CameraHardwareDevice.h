@@ -57,8 +57,6 @@ protected:
      */
     V4L2CameraDevice* getCameraDevice();
 
-	virtual void releaseRecordingFrame(const void* opaque);
-
     /****************************************************************************
      * Data memebers.
      ***************************************************************************/
@@ -0,0 +1,21 @@
+#define LOG_TAG "CaptureBackend"
+#include "CameraDebug.h"
+
+#include <string.h>
+
+#include "CaptureBackend.h"
+#include "FileCaptureBackend.h"
+
+namespace android {
+
+CaptureBackend * CaptureBackend::create(const char * name)
+{
+	if (strncmp(name, CAPTURE_FILE_PREFIX, strlen(CAPTURE_FILE_PREFIX)) == 0)
+	{
+		return new FileCaptureBackend();
+	}
+
+	return new V4L2CaptureBackend();
+}
+
+}; /* namespace android */
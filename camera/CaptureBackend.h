@@ -0,0 +1,99 @@
+#ifndef __CAPTURE_BACKEND_H__
+#define __CAPTURE_BACKEND_H__
+
+/*
+ * Frame source of V4L2CameraDevice. The device only speaks the V4L2 streaming
+ * ioctls, a backend either forwards them to a video node, or emulates them
+ * (see FileCaptureBackend), so that the whole HAL runs without a sensor.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+// device names with this prefix replay frames from a file,
+// "file:<path>[@fps]", e.g. "file:/data/camera/front.nv21@30"
+#define CAPTURE_FILE_PREFIX		"file:"
+
+namespace android {
+
+class CaptureBackend
+{
+public:
+	virtual ~CaptureBackend() {}
+
+	// returns a descriptor that selects readable when a frame can be
+	// dequeued, or -1 on error
+	virtual int open(const char * name, int flags) = 0;
+	virtual void close() = 0;
+
+	// V4L2 ioctls, -1 with errno set on error
+	virtual int ioctl(unsigned long request, void * arg) = 0;
+
+	// maps the buffer QUERYBUF described at 'offset'
+	virtual void * mmap(size_t length, off_t offset) = 0;
+	virtual int munmap(void * addr, size_t length) = 0;
+
+	// false when the QUERYBUF offsets are not physical addresses the HW
+	// preview layer, G2D and the encoders can read
+	virtual bool hasPhysicalBuffers()
+	{
+		return true;
+	}
+
+	// backend for the device node name, a V4L2 node unless it is a file
+	static CaptureBackend * create(const char * name);
+};
+
+// the camera sensor behind a V4L2 video node
+class V4L2CaptureBackend : public CaptureBackend
+{
+public:
+	V4L2CaptureBackend()
+		: mFd(-1)
+	{
+	}
+
+	~V4L2CaptureBackend()
+	{
+		close();
+	}
+
+	int open(const char * name, int flags)
+	{
+		mFd = ::open(name, flags, 0);
+		return mFd;
+	}
+
+	void close()
+	{
+		if (mFd >= 0)
+		{
+			::close(mFd);
+			mFd = -1;
+		}
+	}
+
+	int ioctl(unsigned long request, void * arg)
+	{
+		return ::ioctl(mFd, request, arg);
+	}
+
+	void * mmap(size_t length, off_t offset)
+	{
+		return ::mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, offset);
+	}
+
+	int munmap(void * addr, size_t length)
+	{
+		return ::munmap(addr, length);
+	}
+
+private:
+	int mFd;
+};
+
+}; /* namespace android */
+
+#endif  /* __CAPTURE_BACKEND_H__ */
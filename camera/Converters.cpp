@@ -21,11 +21,21 @@
 #define LOG_TAG "Camera_Converter"
 #include "CameraDebug.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 #include "Converters.h"
 
 namespace android {
 
-static void _YUV420SToRGB565(const uint8_t* Y,
+/****************************************************************************
+ * Scalar reference converters.
+ ***************************************************************************/
+
+static void _YUV420SToRGB565_C(const uint8_t* Y,
                              const uint8_t* U,
                              const uint8_t* V,
                              int dUV,
@@ -55,7 +65,7 @@ static void _YUV420SToRGB565(const uint8_t* Y,
     }
 }
 
-static void _YUV420SToRGB32(const uint8_t* Y,
+static void _YUV420SToRGB32_C(const uint8_t* Y,
                             const uint8_t* U,
                             const uint8_t* V,
                             int dUV,
@@ -85,6 +95,302 @@ static void _YUV420SToRGB32(const uint8_t* Y,
     }
 }
 
+/* Scalar version of _YUVRowToRGB32_neon. */
+static void _YUVRowToRGB32_C(const uint8_t* Y,
+                             const uint8_t* U,
+                             const uint8_t* V,
+                             int dUV,
+                             uint32_t* rgb,
+                             int width,
+                             bool mirror)
+{
+    const int step = mirror ? -1 : 1;
+    if (mirror) {
+        rgb += width - 1;
+    }
+    for (int x = 0; x < width; x += 2, U += dUV, V += dUV) {
+        const uint8_t nU = *U;
+        const uint8_t nV = *V;
+        *rgb = YUVToRGB32(*Y, nU, nV);
+        Y++; rgb += step;
+        *rgb = YUVToRGB32(*Y, nU, nV);
+        Y++; rgb += step;
+    }
+}
+
+#if defined(__ARM_NEON__) && (__BYTE_ORDER == __LITTLE_ENDIAN)
+#define CONVERTERS_HAVE_NEON 1
+
+/****************************************************************************
+ * NEON converters.
+ * Each iteration handles 16 pixels (one q register of Y) and 8 chroma pairs.
+ * The arithmetic is done in 32 bits exactly as in the YUV2xO macros, so the
+ * output is bit exact with the scalar reference above. Row tails that are
+ * not a multiple of 16 pixels go through the scalar pixel macros.
+ ***************************************************************************/
+
+/* Computes R, G and B for 8 pixels.
+ * Param:
+ *  y - 8 luma samples.
+ *  u, v - 8 chroma samples, already replicated for each pixel of a pair.
+ */
+static __inline__ void _YUVToRGB8_neon(uint8x8_t y, uint8x8_t u, uint8x8_t v,
+                                       uint8x8_t* r, uint8x8_t* g, uint8x8_t* b)
+{
+    const int16x8_t C = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y)), vdupq_n_s16(16));
+    const int16x8_t D = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u)), vdupq_n_s16(128));
+    const int16x8_t E = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), vdupq_n_s16(128));
+    const int32x4_t round = vdupq_n_s32(128);
+
+    /* 298 * C + 128 */
+    const int32x4_t yl = vmlal_n_s16(round, vget_low_s16(C), 298);
+    const int32x4_t yh = vmlal_n_s16(round, vget_high_s16(C), 298);
+
+    /* R = 298 * C + 409 * E + 128 */
+    int32x4_t rl = vmlal_n_s16(yl, vget_low_s16(E), 409);
+    int32x4_t rh = vmlal_n_s16(yh, vget_high_s16(E), 409);
+
+    /* G = 298 * C - 100 * D - 208 * E + 128 */
+    int32x4_t gl = vmlsl_n_s16(yl, vget_low_s16(D), 100);
+    int32x4_t gh = vmlsl_n_s16(yh, vget_high_s16(D), 100);
+    gl = vmlsl_n_s16(gl, vget_low_s16(E), 208);
+    gh = vmlsl_n_s16(gh, vget_high_s16(E), 208);
+
+    /* B = 298 * C + 516 * D + 128 */
+    int32x4_t bl = vmlal_n_s16(yl, vget_low_s16(D), 516);
+    int32x4_t bh = vmlal_n_s16(yh, vget_high_s16(D), 516);
+
+    /* >> 8 with saturation to [0, 65535], then to [0, 255]: same as clamp(). */
+    *r = vqmovn_u16(vcombine_u16(vqshrun_n_s32(rl, 8), vqshrun_n_s32(rh, 8)));
+    *g = vqmovn_u16(vcombine_u16(vqshrun_n_s32(gl, 8), vqshrun_n_s32(gh, 8)));
+    *b = vqmovn_u16(vcombine_u16(vqshrun_n_s32(bl, 8), vqshrun_n_s32(bh, 8)));
+}
+
+/* Loads 8 U and 8 V samples for 16 pixels.
+ * Param:
+ *  U, V - Chroma pointers.
+ *  dUV - Distance between two U (or V) samples: 1 for planar, 2 for
+ *      interleaved chroma.
+ */
+static __inline__ void _LoadUV8_neon(const uint8_t* U, const uint8_t* V, int dUV,
+                                     uint8x8_t* u, uint8x8_t* v)
+{
+    if (dUV == 1) {
+        *u = vld1_u8(U);
+        *v = vld1_u8(V);
+    } else if (U < V) {
+        const uint8x8x2_t uv = vld2_u8(U);
+        *u = uv.val[0];
+        *v = uv.val[1];
+    } else {
+        const uint8x8x2_t vu = vld2_u8(V);
+        *u = vu.val[1];
+        *v = vu.val[0];
+    }
+}
+
+static void _YUV420SToRGB565_neon(const uint8_t* Y,
+                                  const uint8_t* U,
+                                  const uint8_t* V,
+                                  int dUV,
+                                  uint16_t* rgb,
+                                  int width,
+                                  int height)
+{
+    const int uv_stride = (width / 2) * dUV;
+    const int width16 = width & ~15;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* pU = U + (y >> 1) * uv_stride;
+        const uint8_t* pV = V + (y >> 1) * uv_stride;
+        int x = 0;
+
+        for (; x < width16; x += 16, Y += 16, rgb += 16,
+                            pU += 8 * dUV, pV += 8 * dUV) {
+            uint8x8_t u, v;
+            _LoadUV8_neon(pU, pV, dUV, &u, &v);
+            const uint8x8x2_t uu = vzip_u8(u, u);
+            const uint8x8x2_t vv = vzip_u8(v, v);
+            const uint8x16_t yy = vld1q_u8(Y);
+
+            for (int half = 0; half < 2; half++) {
+                uint8x8_t r, g, b;
+                _YUVToRGB8_neon(half ? vget_high_u8(yy) : vget_low_u8(yy),
+                                uu.val[half], vv.val[half], &r, &g, &b);
+                /* See RGB565() for the little endian layout. */
+                uint16x8_t pix = vmovl_u8(vshr_n_u8(r, 3));
+                pix = vorrq_u16(pix, vshlq_n_u16(vmovl_u8(vshr_n_u8(g, 2)), 5));
+                pix = vorrq_u16(pix, vshlq_n_u16(vmovl_u8(vshr_n_u8(b, 3)), 11));
+                vst1q_u16(rgb + half * 8, pix);
+            }
+        }
+        for (; x < width; x += 2, pU += dUV, pV += dUV) {
+            const uint8_t nU = *pU;
+            const uint8_t nV = *pV;
+            *rgb = YUVToRGB565(*Y, nU, nV);
+            Y++; rgb++;
+            *rgb = YUVToRGB565(*Y, nU, nV);
+            Y++; rgb++;
+        }
+    }
+}
+
+/* Converts one row of pixels to RGB32.
+ * Param:
+ *  Y, U, V, dUV - Row of luma, and the matching row of chroma.
+ *  rgb - Destination row.
+ *  width - Number of pixels in the row.
+ *  mirror - If true, the row is written right to left.
+ */
+static void _YUVRowToRGB32_neon(const uint8_t* Y,
+                                const uint8_t* U,
+                                const uint8_t* V,
+                                int dUV,
+                                uint32_t* rgb,
+                                int width,
+                                bool mirror)
+{
+    const int width16 = width & ~15;
+    int x = 0;
+
+    for (; x < width16; x += 16, Y += 16, U += 8 * dUV, V += 8 * dUV) {
+        uint8x8_t u, v;
+        _LoadUV8_neon(U, V, dUV, &u, &v);
+        const uint8x8x2_t uu = vzip_u8(u, u);
+        const uint8x8x2_t vv = vzip_u8(v, v);
+        const uint8x16_t yy = vld1q_u8(Y);
+
+        for (int half = 0; half < 2; half++) {
+            uint8x8x4_t pix;
+            _YUVToRGB8_neon(half ? vget_high_u8(yy) : vget_low_u8(yy),
+                            uu.val[half], vv.val[half],
+                            &pix.val[0], &pix.val[1], &pix.val[2]);
+            pix.val[3] = vdup_n_u8(0xff);
+            /* r, g, b, a byte order matches RGB32_t on little endian. */
+            if (mirror) {
+                pix.val[0] = vrev64_u8(pix.val[0]);
+                pix.val[1] = vrev64_u8(pix.val[1]);
+                pix.val[2] = vrev64_u8(pix.val[2]);
+                vst4_u8(reinterpret_cast<uint8_t*>(rgb + width - x - half * 8 - 8), pix);
+            } else {
+                vst4_u8(reinterpret_cast<uint8_t*>(rgb + x + half * 8), pix);
+            }
+        }
+    }
+    for (; x < width; x += 2, U += dUV, V += dUV) {
+        const uint8_t nU = *U;
+        const uint8_t nV = *V;
+        if (mirror) {
+            rgb[width - 1 - x] = YUVToRGB32(Y[0], nU, nV);
+            rgb[width - 2 - x] = YUVToRGB32(Y[1], nU, nV);
+        } else {
+            rgb[x] = YUVToRGB32(Y[0], nU, nV);
+            rgb[x + 1] = YUVToRGB32(Y[1], nU, nV);
+        }
+        Y += 2;
+    }
+}
+
+static void _YUV420SToRGB32_neon(const uint8_t* Y,
+                                 const uint8_t* U,
+                                 const uint8_t* V,
+                                 int dUV,
+                                 uint32_t* rgb,
+                                 int width,
+                                 int height)
+{
+    const int uv_stride = (width / 2) * dUV;
+
+    for (int y = 0; y < height; y++, Y += width, rgb += width) {
+        _YUVRowToRGB32_neon(Y, U + (y >> 1) * uv_stride, V + (y >> 1) * uv_stride,
+                            dUV, rgb, width, false);
+    }
+}
+
+/* Checks /proc/cpuinfo for the "neon" feature flag. */
+static bool _CpuHasNeon()
+{
+    bool ret = false;
+    char line[512];
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if (fp == NULL) {
+        return false;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "Features", 8) == 0) {
+            ret = (strstr(line, " neon") != NULL);
+            break;
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+#endif  /* __ARM_NEON__ */
+
+/****************************************************************************
+ * Runtime dispatch.
+ ***************************************************************************/
+
+typedef void (*YUV420SToRGB565Func)(const uint8_t*, const uint8_t*, const uint8_t*,
+                                    int, uint16_t*, int, int);
+typedef void (*YUV420SToRGB32Func)(const uint8_t*, const uint8_t*, const uint8_t*,
+                                   int, uint32_t*, int, int);
+typedef void (*YUVRowToRGB32Func)(const uint8_t*, const uint8_t*, const uint8_t*,
+                                  int, uint32_t*, int, bool);
+
+static YUV420SToRGB565Func  lYUV420SToRGB565 = NULL;
+static YUV420SToRGB32Func   lYUV420SToRGB32 = NULL;
+static YUVRowToRGB32Func    lYUVRowToRGB32 = NULL;
+
+/* Picks converter implementations on the first call. The race between two
+ * first callers is benign: both store the same pointers. */
+static void _SelectConverters()
+{
+    YUV420SToRGB565Func to565 = _YUV420SToRGB565_C;
+    YUV420SToRGB32Func to32 = _YUV420SToRGB32_C;
+    YUVRowToRGB32Func row32 = _YUVRowToRGB32_C;
+#ifdef CONVERTERS_HAVE_NEON
+    if (_CpuHasNeon()) {
+        to565 = _YUV420SToRGB565_neon;
+        to32 = _YUV420SToRGB32_neon;
+        row32 = _YUVRowToRGB32_neon;
+    }
+#endif
+    ALOGD("%s: using %s YUV -> RGB converters", __FUNCTION__,
+         (to32 == _YUV420SToRGB32_C) ? "C" : "NEON");
+    lYUVRowToRGB32 = row32;
+    lYUV420SToRGB565 = to565;
+    lYUV420SToRGB32 = to32;
+}
+
+static void _YUV420SToRGB565(const uint8_t* Y,
+                             const uint8_t* U,
+                             const uint8_t* V,
+                             int dUV,
+                             uint16_t* rgb,
+                             int width,
+                             int height)
+{
+    if (lYUV420SToRGB565 == NULL) {
+        _SelectConverters();
+    }
+    lYUV420SToRGB565(Y, U, V, dUV, rgb, width, height);
+}
+
+static void _YUV420SToRGB32(const uint8_t* Y,
+                            const uint8_t* U,
+                            const uint8_t* V,
+                            int dUV,
+                            uint32_t* rgb,
+                            int width,
+                            int height)
+{
+    if (lYUV420SToRGB32 == NULL) {
+        _SelectConverters();
+    }
+    lYUV420SToRGB32(Y, U, V, dUV, rgb, width, height);
+}
+
 void YV12ToRGB565(const void* yv12, void* rgb, int width, int height)
 {
     const int pix_total = width * height;
@@ -170,4 +476,84 @@ void NV21ToRGB32(const void* nv21, void* rgb, int width, int height)
                  reinterpret_cast<uint32_t*>(rgb), width, height);
 }
 
+int YUV420ToRGB32Transform(const void* src,
+                           uint32_t pix_fmt,
+                           int width,
+                           int height,
+                           void* dst,
+                           int dst_stride,
+                           int transform)
+{
+    const int pix_total = width * height;
+    const uint8_t* Y = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* U;
+    const uint8_t* V;
+    int dUV;
+
+    switch (pix_fmt) {
+        case V4L2_PIX_FMT_YVU420:
+            V = Y + pix_total;
+            U = V + pix_total / 4;
+            dUV = 1;
+            break;
+        case V4L2_PIX_FMT_YUV420:
+            U = Y + pix_total;
+            V = U + pix_total / 4;
+            dUV = 1;
+            break;
+        case V4L2_PIX_FMT_NV12:
+            U = Y + pix_total;
+            V = U + 1;
+            dUV = 2;
+            break;
+        case V4L2_PIX_FMT_NV21:
+            V = Y + pix_total;
+            U = V + 1;
+            dUV = 2;
+            break;
+        default:
+            ALOGE("%s: Unknown pixel format %.4s",
+                 __FUNCTION__, reinterpret_cast<const char*>(&pix_fmt));
+            return -1;
+    }
+
+    if (lYUVRowToRGB32 == NULL) {
+        _SelectConverters();
+    }
+
+    const int uv_stride = (width / 2) * dUV;
+    const bool flip_h = (transform & CONVERT_FLIP_H) != 0;
+    const bool flip_v = (transform & CONVERT_FLIP_V) != 0;
+    uint32_t* rgb = reinterpret_cast<uint32_t*>(dst);
+
+    if ((transform & CONVERT_ROT_90) == 0) {
+        /* Rows stay rows: convert each one straight into its final place. */
+        for (int y = 0; y < height; y++, Y += width) {
+            uint32_t* row = rgb + (flip_v ? height - 1 - y : y) * dst_stride;
+            lYUVRowToRGB32(Y, U + (y >> 1) * uv_stride, V + (y >> 1) * uv_stride,
+                           dUV, row, width, flip_h);
+        }
+        return 0;
+    }
+
+    /* Rows become columns. The destination is 'height' pixels wide, and the
+     * flips are applied before the 90 degrees clockwise rotation, as for
+     * HAL_TRANSFORM_XXX. */
+    for (int y = 0; y < height; y++, Y += width) {
+        const uint8_t* pU = U + (y >> 1) * uv_stride;
+        const uint8_t* pV = V + (y >> 1) * uv_stride;
+        const int dx = height - 1 - (flip_v ? height - 1 - y : y);
+        uint32_t* col = rgb + dx;
+        for (int x = 0; x < width; x += 2, pU += dUV, pV += dUV) {
+            const uint8_t nU = *pU;
+            const uint8_t nV = *pV;
+            const int dy0 = flip_h ? width - 1 - x : x;
+            const int dy1 = flip_h ? dy0 - 1 : dy0 + 1;
+            col[dy0 * dst_stride] = YUVToRGB32(Y[x], nU, nV);
+            col[dy1 * dst_stride] = YUVToRGB32(Y[x + 1], nU, nV);
+        }
+    }
+    return 0;
+}
+
 }; /* namespace android */
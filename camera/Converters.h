@@ -220,6 +220,7 @@ YUVToRGB32(int y, int u, int v)
     /* Calculate C, D, and E values for the optimized macro. */
     y -= 16; u -= 128; v -= 128;
     RGB32_t rgb;
+    rgb.a = 0xff;
     rgb.r = YUV2RO(y,u,v) & 0xff;
     rgb.g = YUV2GO(y,u,v) & 0xff;
     rgb.b = YUV2BO(y,u,v) & 0xff;
@@ -309,6 +310,40 @@ void NV21ToRGB565(const void* nv21, void* rgb, int width, int height);
  */
 void NV21ToRGB32(const void* nv21, void* rgb, int width, int height);
 
+/* Transformations applied by YUV420ToRGB32Transform. The values match the
+ * HAL_TRANSFORM_XXX ones, so a window transform can be passed as is. Flips are
+ * applied first, then the 90 degrees clockwise rotation.
+ */
+enum {
+    CONVERT_FLIP_H  = 0x01,
+    CONVERT_FLIP_V  = 0x02,
+    CONVERT_ROT_90  = 0x04,
+    CONVERT_ROT_180 = 0x03,
+    CONVERT_ROT_270 = 0x07,
+};
+
+/* Converts an YUV 4:2:0 framebuffer to RGB32 framebuffer in a single pass,
+ * applying the transformation and the destination stride on the way, so the
+ * result can be written straight into a locked preview window buffer.
+ * Param:
+ *  src - YUV 4:2:0 framebuffer.
+ *  pix_fmt - One of V4L2_PIX_FMT_YVU420, YUV420, NV12, or NV21.
+ *  width, height - Source frame dimensions. If CONVERT_ROT_90 is set, the
+ *      destination is 'height' pixels wide, and 'width' pixels high.
+ *  dst - RGB32 framebuffer.
+ *  dst_stride - Destination stride, in pixels.
+ *  transform - Combination of CONVERT_XXX flags.
+ * Return:
+ *  0 on success, or -1 if the pixel format is not supported.
+ */
+int YUV420ToRGB32Transform(const void* src,
+                           uint32_t pix_fmt,
+                           int width,
+                           int height,
+                           void* dst,
+                           int dst_stride,
+                           int transform);
+
 }; /* namespace android */
 
 #endif  /* HW_EMULATOR_CAMERA_CONVERTERS_H */
@@ -0,0 +1,453 @@
+#define LOG_TAG "FileCaptureBackend"
+#include "CameraDebug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "FileCaptureBackend.h"
+
+#define DEFAULT_REPLAY_FPS		30
+
+// buffers are on the heap, QUERYBUF reports them at fake physical addresses
+// from here, one page aligned slot per buffer, mmap maps them back
+#define REPLAY_PHY_BASE			0x10000000
+#define REPLAY_PHY_ALIGN		4096
+
+namespace android {
+
+static int64_t monotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+FileCaptureBackend::FileCaptureBackend()
+	: mFileFd(-1),
+	  mFileOffset(0),
+	  mFps(DEFAULT_REPLAY_FPS),
+	  mWidth(0),
+	  mHeight(0),
+	  mPixFmt(V4L2_PIX_FMT_NV12),
+	  mFrameSize(0),
+	  mBufferCount(0),
+	  mReadyHead(0),
+	  mReadyCount(0),
+	  mSequence(0),
+	  mNextFrameTime(0),
+	  mStreaming(false),
+	  mReplayThread(NULL)
+{
+	mPipe[0] = mPipe[1] = -1;
+	memset(mBuffers, 0, sizeof(mBuffers));
+	memset(mBufferPhy, 0, sizeof(mBufferPhy));
+	memset(mQueued, 0, sizeof(mQueued));
+}
+
+FileCaptureBackend::~FileCaptureBackend()
+{
+	close();
+}
+
+// name is "file:<path>[@fps]"
+int FileCaptureBackend::open(const char * name, int flags)
+{
+	char path[128];
+	const char * p = name + strlen(CAPTURE_FILE_PREFIX);
+
+	strncpy(path, p, sizeof(path) - 1);
+	path[sizeof(path) - 1] = 0;
+
+	char * fps = strrchr(path, '@');
+	if (fps != NULL)
+	{
+		*fps++ = 0;
+		mFps = atoi(fps);
+		if (mFps <= 0)
+		{
+			mFps = DEFAULT_REPLAY_FPS;
+		}
+	}
+
+	mFileFd = ::open(path, O_RDONLY);
+	if (mFileFd < 0)
+	{
+		ALOGE("open %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+
+	if (pipe(mPipe) < 0)
+	{
+		ALOGE("pipe failed: %s", strerror(errno));
+		::close(mFileFd);
+		mFileFd = -1;
+		return -1;
+	}
+	fcntl(mPipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(mPipe[1], F_SETFL, O_NONBLOCK);
+
+	ALOGD("replaying %s at %d fps", path, mFps);
+
+	return mPipe[0];
+}
+
+void FileCaptureBackend::close()
+{
+	streamOff();
+	freeBuffers();
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (mPipe[i] >= 0)
+		{
+			::close(mPipe[i]);
+			mPipe[i] = -1;
+		}
+	}
+
+	if (mFileFd >= 0)
+	{
+		::close(mFileFd);
+		mFileFd = -1;
+	}
+}
+
+int FileCaptureBackend::ioctl(unsigned long request, void * arg)
+{
+	switch (request)
+	{
+	case VIDIOC_S_INPUT:
+	case VIDIOC_S_CTRL:
+	case VIDIOC_S_PARM:
+		return 0;
+
+	case VIDIOC_QUERYCAP:
+	{
+		struct v4l2_capability * cap = (struct v4l2_capability *)arg;
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "file");
+		strcpy((char *)cap->card, "file");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+
+	case VIDIOC_TRY_FMT:
+	case VIDIOC_S_FMT:
+	{
+		struct v4l2_format * fmt = (struct v4l2_format *)arg;
+		if (fmt->fmt.pix.width == 0 || fmt->fmt.pix.height == 0)
+		{
+			break;
+		}
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 3 / 2;
+		if (request == VIDIOC_S_FMT)
+		{
+			Mutex::Autolock locker(&mLock);
+			if (mStreaming)
+			{
+				errno = EBUSY;
+				return -1;
+			}
+			mWidth = fmt->fmt.pix.width;
+			mHeight = fmt->fmt.pix.height;
+			mPixFmt = fmt->fmt.pix.pixelformat;
+		}
+		return 0;
+	}
+
+	case VIDIOC_REQBUFS:
+	{
+		struct v4l2_requestbuffers * rb = (struct v4l2_requestbuffers *)arg;
+		if (mStreaming)
+		{
+			errno = EBUSY;
+			return -1;
+		}
+		freeBuffers();
+		if (rb->count == 0)
+		{
+			return 0;
+		}
+		if (rb->count > MAX_NB_BUFFER)
+		{
+			rb->count = MAX_NB_BUFFER;
+		}
+		if (allocBuffers(rb->count) != 0)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		return 0;
+	}
+
+	case VIDIOC_QUERYBUF:
+	case VIDIOC_QBUF:
+	{
+		struct v4l2_buffer * buf = (struct v4l2_buffer *)arg;
+		if (buf->index >= (unsigned int)mBufferCount)
+		{
+			break;
+		}
+		buf->length = mFrameSize;
+		buf->m.offset = mBufferPhy[buf->index];
+		if (request == VIDIOC_QBUF)
+		{
+			Mutex::Autolock locker(&mLock);
+			mQueued[buf->index] = true;
+		}
+		return 0;
+	}
+
+	case VIDIOC_DQBUF:
+	{
+		struct v4l2_buffer * buf = (struct v4l2_buffer *)arg;
+		Mutex::Autolock locker(&mLock);
+		if (mReadyCount == 0)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+
+		int index = mReady[mReadyHead];
+		mReadyHead = (mReadyHead + 1) % MAX_NB_BUFFER;
+		mReadyCount--;
+
+		char c;
+		::read(mPipe[0], &c, 1);
+
+		buf->index		= index;
+		buf->bytesused	= mFrameSize;
+		buf->length		= mFrameSize;
+		buf->m.offset	= mBufferPhy[index];
+		buf->timestamp	= mTimestamp[index];
+		buf->sequence	= mSequenceOf[index];
+		buf->field		= V4L2_FIELD_NONE;
+		return 0;
+	}
+
+	case VIDIOC_STREAMON:
+		return streamOn();
+
+	case VIDIOC_STREAMOFF:
+		return streamOff();
+
+	case VIDIOC_G_PARM:
+	{
+		struct v4l2_streamparm * parms = (struct v4l2_streamparm *)arg;
+		memset(&parms->parm, 0, sizeof(parms->parm));
+		parms->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+		parms->parm.capture.timeperframe.numerator = 1;
+		parms->parm.capture.timeperframe.denominator = mFps;
+		return 0;
+	}
+
+	default:
+		break;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+void * FileCaptureBackend::mmap(size_t length, off_t offset)
+{
+	for (int i = 0; i < mBufferCount; i++)
+	{
+		if (mBufferPhy[i] == (unsigned int)offset && length <= (size_t)mFrameSize)
+		{
+			return mBuffers[i];
+		}
+	}
+
+	errno = EINVAL;
+	return MAP_FAILED;
+}
+
+int FileCaptureBackend::munmap(void * addr, size_t length)
+{
+	// buffers live until REQBUFS or close
+	return 0;
+}
+
+bool FileCaptureBackend::hasPhysicalBuffers()
+{
+	return false;
+}
+
+int FileCaptureBackend::allocBuffers(int count)
+{
+	mFrameSize = mWidth * mHeight * 3 / 2;
+	if (mFrameSize == 0)
+	{
+		return -1;
+	}
+
+	const unsigned int slot = (mFrameSize + REPLAY_PHY_ALIGN - 1) & ~(REPLAY_PHY_ALIGN - 1);
+	for (int i = 0; i < count; i++)
+	{
+		mBuffers[i] = malloc(mFrameSize);
+		if (mBuffers[i] == NULL)
+		{
+			ALOGE("alloc replay buffer %d failed", i);
+			freeBuffers();
+			return -1;
+		}
+		mBufferPhy[i] = REPLAY_PHY_BASE + i * slot;
+		mQueued[i] = false;
+		mBufferCount = i + 1;
+	}
+
+	return 0;
+}
+
+void FileCaptureBackend::freeBuffers()
+{
+	for (int i = 0; i < mBufferCount; i++)
+	{
+		free(mBuffers[i]);
+		mBuffers[i] = NULL;
+		mBufferPhy[i] = 0;
+		mQueued[i] = false;
+	}
+	mBufferCount = 0;
+}
+
+int FileCaptureBackend::streamOn()
+{
+	Mutex::Autolock locker(&mLock);
+	if (mStreaming)
+	{
+		return 0;
+	}
+	if (mBufferCount == 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	mReadyHead = 0;
+	mReadyCount = 0;
+	mSequence = 0;
+	mNextFrameTime = monotonicNs();
+	mStreaming = true;
+
+	mReplayThread = new ReplayThread(this);
+	mReplayThread->run("FileCaptureReplay", ANDROID_PRIORITY_URGENT_DISPLAY);
+
+	return 0;
+}
+
+int FileCaptureBackend::streamOff()
+{
+	{
+		Mutex::Autolock locker(&mLock);
+		mStreaming = false;
+	}
+
+	if (mReplayThread != NULL)
+	{
+		mReplayThread->requestExitAndWait();
+		mReplayThread.clear();
+	}
+
+	// as with a driver, STREAMOFF returns every buffer to the application
+	Mutex::Autolock locker(&mLock);
+	char c;
+	while (mReadyCount > 0)
+	{
+		::read(mPipe[0], &c, 1);
+		mReadyCount--;
+	}
+	mReadyHead = 0;
+	for (int i = 0; i < mBufferCount; i++)
+	{
+		mQueued[i] = false;
+	}
+
+	return 0;
+}
+
+bool FileCaptureBackend::replayFrame()
+{
+	const int64_t period = 1000000000LL / mFps;
+
+	struct timespec ts;
+	ts.tv_sec = mNextFrameTime / 1000000000LL;
+	ts.tv_nsec = mNextFrameTime % 1000000000LL;
+	// POSIX returns the error, older bionic returns -1 and sets errno
+	int ret;
+	do
+	{
+		ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	} while (ret == EINTR || (ret == -1 && errno == EINTR));
+
+	int index = -1;
+	{
+		Mutex::Autolock locker(&mLock);
+		if (!mStreaming)
+		{
+			return false;
+		}
+
+		// a consumer that fell behind by more than a frame is not caught up
+		// with a burst, the schedule restarts from now
+		mNextFrameTime += period;
+		int64_t now = monotonicNs();
+		if (now - mNextFrameTime > period)
+		{
+			mNextFrameTime = now;
+		}
+
+		for (int i = 0; i < mBufferCount; i++)
+		{
+			int n = (mSequence + i) % mBufferCount;
+			if (mQueued[n])
+			{
+				index = n;
+				break;
+			}
+		}
+
+		if (index < 0)
+		{
+			// no buffer queued, the frame is lost as on the sensor
+			mSequence++;
+			return true;
+		}
+		mQueued[index] = false;
+	}
+
+	// the buffer belongs to this thread until it is in the ready queue
+	char * dst = (char *)mBuffers[index];
+	ssize_t n = pread(mFileFd, dst, mFrameSize, mFileOffset);
+	if (n < mFrameSize && mFileOffset > 0)
+	{
+		mFileOffset = 0;
+		n = pread(mFileFd, dst, mFrameSize, 0);
+	}
+	if (n < 0)
+	{
+		n = 0;
+	}
+	if (n < mFrameSize)
+	{
+		memset(dst + n, 0, mFrameSize - n);
+	}
+	mFileOffset += mFrameSize;
+
+	Mutex::Autolock locker(&mLock);
+	gettimeofday(&mTimestamp[index], NULL);
+	mSequenceOf[index] = mSequence++;
+	mReady[(mReadyHead + mReadyCount) % MAX_NB_BUFFER] = index;
+	mReadyCount++;
+	::write(mPipe[1], "", 1);
+
+	return true;
+}
+
+}; /* namespace android */
@@ -0,0 +1,95 @@
+#ifndef __FILE_CAPTURE_BACKEND_H__
+#define __FILE_CAPTURE_BACKEND_H__
+
+/*
+ * Emulates a V4L2 capture node by replaying raw frames from a file.
+ *
+ * The file holds back to back frames of the format and size the HAL sets
+ * with VIDIOC_S_FMT (NV12, NV21 or YV12, 12 bits per pixel), it is replayed
+ * in a loop at a fixed frame rate. Buffers are on the heap, QUERYBUF reports
+ * a fake physical address that mmap maps back to the heap pointer, so the
+ * backend needs neither a sensor nor CedarX. The HW preview layer and G2D
+ * cannot read such buffers, the device previews them in SW.
+ */
+
+#include <utils/threads.h>
+#include "CaptureBackend.h"
+#include "V4L2Camera.h"
+
+namespace android {
+
+class FileCaptureBackend : public CaptureBackend
+{
+public:
+	FileCaptureBackend();
+	~FileCaptureBackend();
+
+	int open(const char * name, int flags);
+	void close();
+	int ioctl(unsigned long request, void * arg);
+	void * mmap(size_t length, off_t offset);
+	int munmap(void * addr, size_t length);
+	bool hasPhysicalBuffers();
+
+private:
+	// fills the next queued buffer at the file frame rate
+	class ReplayThread : public Thread
+	{
+	public:
+		ReplayThread(FileCaptureBackend * backend)
+			: Thread(false),
+			  mBackend(backend)
+		{
+		}
+
+	private:
+		bool threadLoop()
+		{
+			return mBackend->replayFrame();
+		}
+
+		FileCaptureBackend * mBackend;
+	};
+
+	bool replayFrame();
+	int allocBuffers(int count);
+	void freeBuffers();
+	int streamOn();
+	int streamOff();
+
+	int								mFileFd;
+	off_t							mFileOffset;
+	int								mFps;
+
+	// the read end selects readable while frames wait to be dequeued
+	int								mPipe[2];
+
+	int								mWidth;
+	int								mHeight;
+	uint32_t						mPixFmt;
+	int								mFrameSize;
+
+	int								mBufferCount;
+	void *							mBuffers[MAX_NB_BUFFER];
+	unsigned int					mBufferPhy[MAX_NB_BUFFER];
+	bool							mQueued[MAX_NB_BUFFER];
+	struct timeval					mTimestamp[MAX_NB_BUFFER];
+	uint32_t						mSequenceOf[MAX_NB_BUFFER];
+
+	// filled buffers, in capture order
+	int								mReady[MAX_NB_BUFFER];
+	int								mReadyHead;
+	int								mReadyCount;
+
+	// frames counted, dropped ones included as a driver would
+	uint32_t						mSequence;
+	int64_t							mNextFrameTime;		// monotonic, ns
+
+	bool							mStreaming;
+	sp<ReplayThread>				mReplayThread;
+	Mutex							mLock;
+};
+
+}; /* namespace android */
+
+#endif  /* __FILE_CAPTURE_BACKEND_H__ */
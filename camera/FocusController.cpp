@@ -0,0 +1,440 @@
+#define LOG_TAG "FocusController"
+#include "CameraDebug.h"
+
+#include <camera/CameraParameters.h>
+#include <utils/Timers.h>
+
+#include "FocusController.h"
+#include "V4L2CameraDevice.h"
+#include "CallbackNotifier.h"
+
+namespace android {
+
+static const char * kStateNames[] =
+{
+	"idle",
+	"scanning",
+	"passive scan",
+	"focused",
+	"failed",
+};
+
+static const char * kModeNames[] =
+{
+	"fixed",
+	"auto",
+	"continuous-video",
+	"continuous-picture",
+};
+
+FocusController::FocusController(CallbackNotifier * notifier)
+	: mNotifier(notifier),
+	  mDevice(NULL),
+	  mMode(AF_MODE_AUTO),
+	  mState(AF_STATE_IDLE),
+	  mHasAf(false),
+	  mStreaming(false),
+	  mLocked(false),
+	  mFocusPending(false),
+	  mGeneration(0),
+	  mPollMs(FOCUS_POLL_MIN_MS),
+	  mLastStatus(-1),
+	  mScanStart(0),
+	  mScans(0),
+	  mScansFailed(0),
+	  mMoves(0),
+	  mPolls(0),
+	  mLastScanTime(0),
+	  mExit(false),
+	  mThread(NULL)
+{
+}
+
+FocusController::~FocusController()
+{
+	stop();
+}
+
+void FocusController::resetState_l()
+{
+	mState = AF_STATE_IDLE;
+	mLocked = false;
+	mFocusPending = false;
+	mPollMs = FOCUS_POLL_MIN_MS;
+	mLastStatus = -1;
+	mGeneration++;
+	mPollCond.signal();
+	mDoneCond.broadcast();
+}
+
+void FocusController::setFocusMode(const char * mode)
+{
+	int new_mode = AF_MODE_FIXED;
+	if (strcmp(mode, CameraParameters::FOCUS_MODE_AUTO) == 0
+		|| strcmp(mode, CameraParameters::FOCUS_MODE_MACRO) == 0)
+	{
+		new_mode = AF_MODE_AUTO;
+	}
+	else if (strcmp(mode, CameraParameters::FOCUS_MODE_CONTINUOUS_VIDEO) == 0)
+	{
+		new_mode = AF_MODE_CONTINUOUS_VIDEO;
+	}
+	else if (strcmp(mode, CameraParameters::FOCUS_MODE_CONTINUOUS_PICTURE) == 0)
+	{
+		new_mode = AF_MODE_CONTINUOUS_PICTURE;
+	}
+
+	Mutex::Autolock locker(&mLock);
+	if (new_mode == mMode)
+	{
+		return ;
+	}
+
+	ALOGV("focus mode %s -> %s", kModeNames[mMode], kModeNames[new_mode]);
+
+	// a pending autoFocus() is cancelled by the mode change, as by the app
+	if (mStreaming && mHasAf && mState == AF_STATE_SCANNING)
+	{
+		mDevice->stopAutoFocus();
+	}
+	mMode = new_mode;
+	if (mStreaming && mHasAf)
+	{
+		mDevice->setContinuousAutoFocus(isContinuous());
+	}
+	resetState_l();
+}
+
+void FocusController::start(V4L2CameraDevice * dev)
+{
+	Mutex::Autolock locker(&mLock);
+	if (mStreaming)
+	{
+		return ;
+	}
+
+	mDevice = dev;
+	mHasAf = (dev->getAutoFocusStatus() >= 0);
+	mStreaming = true;
+	mExit = false;
+	resetState_l();
+
+	if (!mHasAf)
+	{
+		ALOGV("no focus status control, fixed focus");
+		return ;
+	}
+
+	if (mMode != AF_MODE_FIXED)
+	{
+		dev->setContinuousAutoFocus(isContinuous());
+	}
+
+	mThread = new FocusThread(this);
+	status_t res = mThread->run("CameraFocusThread", ANDROID_PRIORITY_FOREGROUND);
+	if (res != NO_ERROR)
+	{
+		ALOGE("%s: Unable to start focus thread: %d", __FUNCTION__, res);
+		mThread.clear();
+		mHasAf = false;
+	}
+}
+
+void FocusController::stop()
+{
+	{
+		Mutex::Autolock locker(&mLock);
+		if (!mStreaming)
+		{
+			return ;
+		}
+
+		// the stream stops focus as cancelAutoFocus() does, without a result
+		if (mHasAf && mState == AF_STATE_SCANNING)
+		{
+			mDevice->stopAutoFocus();
+		}
+		mStreaming = false;
+		mExit = true;
+		resetState_l();
+	}
+
+	if (mThread != NULL)
+	{
+		mThread->requestExitAndWait();
+		mThread.clear();
+	}
+
+	Mutex::Autolock locker(&mLock);
+	mDevice = NULL;
+}
+
+status_t FocusController::autoFocus()
+{
+	int focus = -1;
+	{
+		Mutex::Autolock locker(&mLock);
+
+		if (!mStreaming)
+		{
+			ALOGW("%s: preview is not running", __FUNCTION__);
+			focus = 0;
+		}
+		else if (!mHasAf || mMode == AF_MODE_FIXED)
+		{
+			mState = AF_STATE_FOCUSED;
+			focus = 1;
+		}
+		else if (isContinuous())
+		{
+			// the lens holds still from now until cancelAutoFocus(), the
+			// result comes when a passive scan, if any, is done
+			if (mState == AF_STATE_PASSIVE_SCAN)
+			{
+				mFocusPending = true;
+			}
+			else
+			{
+				lockContinuous_l(&focus);
+			}
+		}
+		else
+		{
+			if (mState == AF_STATE_SCANNING)
+			{
+				mDevice->stopAutoFocus();
+			}
+
+			if (mDevice->startAutoFocus() < 0)
+			{
+				ALOGW("%s: start auto focus failed", __FUNCTION__);
+				mState = AF_STATE_FAILED;
+				mScansFailed++;
+				focus = 0;
+			}
+			else
+			{
+				mState = AF_STATE_SCANNING;
+				mScanStart = systemTime(SYSTEM_TIME_MONOTONIC);
+				mScans++;
+				mPollMs = FOCUS_POLL_MIN_MS;
+				mLastStatus = -1;
+			}
+		}
+
+		mGeneration++;
+		mPollCond.signal();
+	}
+
+	if (focus >= 0)
+	{
+		mNotifier->notifyFocus(focus != 0);
+	}
+
+	return NO_ERROR;
+}
+
+status_t FocusController::cancelAutoFocus()
+{
+	Mutex::Autolock locker(&mLock);
+
+	if (mStreaming && mHasAf)
+	{
+		if (mState == AF_STATE_SCANNING)
+		{
+			mDevice->stopAutoFocus();
+		}
+		if (mLocked)
+		{
+			mDevice->setContinuousAutoFocus(true);
+		}
+	}
+	resetState_l();
+
+	return NO_ERROR;
+}
+
+bool FocusController::waitForFocus(int timeout_ms)
+{
+	Mutex::Autolock locker(&mLock);
+
+	const nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + milliseconds_to_nanoseconds(timeout_ms);
+	while (mStreaming && (mState == AF_STATE_SCANNING || mState == AF_STATE_PASSIVE_SCAN))
+	{
+		nsecs_t left = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+		if (left <= 0)
+		{
+			ALOGW("%s: focus still %s after %d ms", __FUNCTION__, kStateNames[mState], timeout_ms);
+			return false;
+		}
+		mDoneCond.waitRelative(mLock, left);
+	}
+
+	return true;
+}
+
+bool FocusController::focusLoop()
+{
+	V4L2CameraDevice * dev;
+	uint32_t generation;
+	{
+		Mutex::Autolock locker(&mLock);
+		while (!mExit && !isPolling())
+		{
+			mPollCond.wait(mLock);
+		}
+		if (mExit)
+		{
+			return false;
+		}
+
+		// a request wakes the thread early, the state it polls is gone
+		generation = mGeneration;
+		mPollCond.waitRelative(mLock, milliseconds_to_nanoseconds(mPollMs));
+		if (mExit)
+		{
+			return false;
+		}
+		if (generation != mGeneration || !isPolling())
+		{
+			return true;
+		}
+		dev = mDevice;
+	}
+
+	// stop() waits for this thread before the device goes
+	int status = dev->getAutoFocusStatus();
+
+	int focus = -1;
+	int move = -1;
+	{
+		Mutex::Autolock locker(&mLock);
+		if (mExit)
+		{
+			return false;
+		}
+		if (generation != mGeneration)
+		{
+			return true;
+		}
+		mPolls++;
+		onStatus_l(status, &focus, &move);
+	}
+
+	if (move >= 0)
+	{
+		mNotifier->notifyFocusMove(move != 0);
+	}
+	if (focus >= 0)
+	{
+		mNotifier->notifyFocus(focus != 0);
+	}
+
+	return true;
+}
+
+void FocusController::onStatus_l(int status, int * focus, int * move)
+{
+	if (status < 0)
+	{
+		// the control went away, nothing moves
+		status = V4L2_AUTO_FOCUS_STATUS_REACHED;
+	}
+
+	const bool moving = (status & V4L2_AUTO_FOCUS_STATUS_BUSY) != 0;
+	const bool reached = (status & V4L2_AUTO_FOCUS_STATUS_REACHED) != 0;
+
+	// back off while nothing changes
+	const int max_ms = moving ? FOCUS_POLL_SCAN_MAX_MS : FOCUS_POLL_IDLE_MAX_MS;
+	if (status == mLastStatus)
+	{
+		mPollMs = (mPollMs * 2 < max_ms) ? mPollMs * 2 : max_ms;
+	}
+	else
+	{
+		mPollMs = FOCUS_POLL_MIN_MS;
+	}
+	mLastStatus = status;
+
+	if (mState == AF_STATE_SCANNING)
+	{
+		if (!moving && status != V4L2_AUTO_FOCUS_STATUS_IDLE)
+		{
+			finishScan_l(reached, focus);
+		}
+		else if (systemTime(SYSTEM_TIME_MONOTONIC) - mScanStart
+			> milliseconds_to_nanoseconds(FOCUS_SCAN_TIMEOUT_MS))
+		{
+			ALOGW("auto focus timed out, status %d", status);
+			mDevice->stopAutoFocus();
+			finishScan_l(false, focus);
+		}
+		return ;
+	}
+
+	// continuous modes
+	if (moving)
+	{
+		if (mState != AF_STATE_PASSIVE_SCAN)
+		{
+			mState = AF_STATE_PASSIVE_SCAN;
+			mScanStart = systemTime(SYSTEM_TIME_MONOTONIC);
+			mMoves++;
+			*move = 1;
+		}
+		return ;
+	}
+
+	if (mState == AF_STATE_PASSIVE_SCAN)
+	{
+		mLastScanTime = systemTime(SYSTEM_TIME_MONOTONIC) - mScanStart;
+		*move = 0;
+		mDoneCond.broadcast();
+	}
+	if (status != V4L2_AUTO_FOCUS_STATUS_IDLE)
+	{
+		mState = reached ? AF_STATE_FOCUSED : AF_STATE_FAILED;
+	}
+	else if (mState == AF_STATE_PASSIVE_SCAN)
+	{
+		mState = AF_STATE_IDLE;
+	}
+
+	if (mFocusPending)
+	{
+		lockContinuous_l(focus);
+	}
+}
+
+void FocusController::finishScan_l(bool success, int * focus)
+{
+	mState = success ? AF_STATE_FOCUSED : AF_STATE_FAILED;
+	mLastScanTime = systemTime(SYSTEM_TIME_MONOTONIC) - mScanStart;
+	if (!success)
+	{
+		mScansFailed++;
+	}
+	*focus = success ? 1 : 0;
+	mDoneCond.broadcast();
+}
+
+void FocusController::lockContinuous_l(int * focus)
+{
+	mDevice->setContinuousAutoFocus(false);
+	mLocked = true;
+	mFocusPending = false;
+	*focus = (mState == AF_STATE_FAILED) ? 0 : 1;
+}
+
+void FocusController::dump(String8 & result)
+{
+	Mutex::Autolock locker(&mLock);
+
+	result.appendFormat("  focus: %s, %s%s%s, poll %d ms\n",
+		kModeNames[mMode], mHasAf ? kStateNames[mState] : "no AF",
+		mLocked ? ", locked" : "", mFocusPending ? ", result pending" : "", mPollMs);
+	result.appendFormat("    scans %u (%u failed), passive scans %u, polls %u, last scan %.1f ms\n",
+		mScans, mScansFailed, mMoves, mPolls, mLastScanTime / 1000000.0f);
+}
+
+}; /* namespace android */
@@ -0,0 +1,146 @@
+#ifndef __FOCUS_CONTROLLER_H__
+#define __FOCUS_CONTROLLER_H__
+
+/*
+ * Auto focus, run by its own thread.
+ *
+ * The sensor driver moves the lens by itself, the HAL starts or stops a scan
+ * and reads its status with the V4L2 auto focus controls. While a scan runs,
+ * or at any time in the continuous modes, the thread polls the status: first
+ * after FOCUS_POLL_MIN_MS, then twice as late each time the status has not
+ * changed, so that a converging lens is seen quickly and a long sweep costs
+ * few ioctls. autoFocus() and cancelAutoFocus() only post a request, the
+ * thread sends CAMERA_MSG_FOCUS and CAMERA_MSG_FOCUS_MOVE.
+ *
+ * A sensor without the status control is fixed focus, its scans succeed at
+ * once.
+ */
+
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+// status poll interval, ms
+#define FOCUS_POLL_MIN_MS			10
+#define FOCUS_POLL_SCAN_MAX_MS		80		// lens moving
+#define FOCUS_POLL_IDLE_MAX_MS		200		// continuous modes, lens still
+
+// a scan not done by then failed
+#define FOCUS_SCAN_TIMEOUT_MS		3000
+
+namespace android {
+
+class V4L2CameraDevice;
+class CallbackNotifier;
+
+enum
+{
+	AF_MODE_FIXED = 0,				// fixed, infinity, edof: nothing to scan
+	AF_MODE_AUTO,					// auto, macro: a scan per autoFocus()
+	AF_MODE_CONTINUOUS_VIDEO,
+	AF_MODE_CONTINUOUS_PICTURE,
+};
+
+enum
+{
+	AF_STATE_IDLE = 0,				// no scan since the mode or stream changed
+	AF_STATE_SCANNING,				// autoFocus() scan running
+	AF_STATE_PASSIVE_SCAN,			// continuous mode, the lens is moving
+	AF_STATE_FOCUSED,
+	AF_STATE_FAILED,
+};
+
+class FocusController
+{
+public:
+	FocusController(CallbackNotifier * notifier);
+	~FocusController();
+
+	// KEY_FOCUS_MODE value
+	void setFocusMode(const char * mode);
+
+	// frames stream from 'dev' in between, so does the thread
+	void start(V4L2CameraDevice * dev);
+	void stop();
+
+	// camera_device_ops_t calls, return at once
+	status_t autoFocus();
+	status_t cancelAutoFocus();
+
+	// waits while the lens moves, false if it did not stop in time
+	bool waitForFocus(int timeout_ms);
+
+	// appends focus state and scan statistics for dumpCamera
+	void dump(String8 & result);
+
+private:
+	class FocusThread : public Thread
+	{
+	public:
+		FocusThread(FocusController * controller)
+			: Thread(false),
+			  mController(controller)
+		{
+		}
+
+	private:
+		bool threadLoop()
+		{
+			return mController->focusLoop();
+		}
+
+		FocusController * mController;
+	};
+
+	bool focusLoop();
+
+	inline bool isContinuous() const
+	{
+		return mMode == AF_MODE_CONTINUOUS_VIDEO || mMode == AF_MODE_CONTINUOUS_PICTURE;
+	}
+
+	// the thread has a status to poll
+	inline bool isPolling() const
+	{
+		return mStreaming && mHasAf
+			&& (mState == AF_STATE_SCANNING || (isContinuous() && !mLocked));
+	}
+
+	// the following are called with mLock held, results to send are
+	// returned in 'focus' and 'move', -1 for none
+	void onStatus_l(int status, int * focus, int * move);
+	void finishScan_l(bool success, int * focus);
+	void lockContinuous_l(int * focus);
+	void resetState_l();
+
+	CallbackNotifier *				mNotifier;
+	V4L2CameraDevice *				mDevice;		// while streaming
+
+	int								mMode;
+	int								mState;
+	bool							mHasAf;
+	bool							mStreaming;
+	bool							mLocked;		// continuous focus held for autoFocus()
+	bool							mFocusPending;	// autoFocus() result waits for the lens
+
+	// bumped by each request, a poll that raced with one is dropped
+	uint32_t						mGeneration;
+	int								mPollMs;
+	int								mLastStatus;
+	int64_t							mScanStart;		// monotonic, ns
+
+	uint32_t						mScans;
+	uint32_t						mScansFailed;
+	uint32_t						mMoves;
+	uint32_t						mPolls;
+	int64_t							mLastScanTime;	// ns
+
+	bool							mExit;
+	sp<FocusThread>					mThread;
+	Mutex							mLock;
+	Condition						mPollCond;		// request, or exit
+	Condition						mDoneCond;		// the lens stopped
+};
+
+}; /* namespace android */
+
+#endif  /* __FOCUS_CONTROLLER_H__ */
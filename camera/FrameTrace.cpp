@@ -0,0 +1,209 @@
+#define LOG_TAG "FrameTrace"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include "CameraDebug.h"
+
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
+#include <utils/Trace.h>
+
+#include "V4L2Camera.h"
+
+namespace android {
+
+static const char * kStageNames[FRAME_STAGE_NUM] =
+{
+	"dequeue",
+	"preview",
+	"callback",
+	"encode start",
+	"encode end",
+	"release",
+};
+
+// atrace counter per stage, the value is the id of the last frame there
+static const char * kStageCounters[FRAME_STAGE_NUM] =
+{
+	"camera frame dequeue",
+	"camera frame preview",
+	"camera frame callback",
+	"camera frame encode start",
+	"camera frame encode end",
+	"camera frame release",
+};
+
+static const int64_t kBucketBounds[FRAME_TRACE_BUCKETS - 1] =
+{
+	1000, 2000, 4000, 8000, 16000, 33000, 66000, 133000
+};
+
+FrameTrace::FrameTrace()
+	: mEnabled(false),
+	  mAtrace(false),
+	  mNextId(0),
+	  mHistoryHead(0),
+	  mFrames(0)
+{
+	memset(mInFlight, 0, sizeof(mInFlight));
+	memset(mStages, 0, sizeof(mStages));
+	memset(mHistory, 0, sizeof(mHistory));
+}
+
+void FrameTrace::configure()
+{
+	char value[PROPERTY_VALUE_MAX];
+	property_get("debug.camera.trace", value, "0");
+	setLevel(atoi(value));
+}
+
+void FrameTrace::setLevel(int level)
+{
+	reset();
+	mAtrace = (level > 1);
+	mEnabled = (level > 0);
+
+	if (mEnabled)
+	{
+		ALOGD("frame trace on%s", mAtrace ? ", atrace counters" : "");
+	}
+}
+
+void FrameTrace::reset()
+{
+	for (int i = 0; i < MAX_NB_BUFFER; i++)
+	{
+		mInFlight[i].time[FRAME_STAGE_DEQUEUE] = 0;
+	}
+}
+
+void FrameTrace::markStage(int index, int stage)
+{
+	if (index < 0 || index >= MAX_NB_BUFFER)
+	{
+		return ;
+	}
+
+	frameRecord_t * rec = &mInFlight[index];
+	int64_t now = systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
+
+	if (stage == FRAME_STAGE_DEQUEUE)
+	{
+		memset(rec->time, 0, sizeof(rec->time));
+		rec->id = android_atomic_inc(&mNextId);
+		rec->index = index;
+	}
+	else if (rec->time[FRAME_STAGE_DEQUEUE] == 0)
+	{
+		// dequeued before the trace was enabled
+		return ;
+	}
+
+	// a frame goes through a stage once, the first stamp counts
+	if (rec->time[stage] == 0)
+	{
+		rec->time[stage] = now;
+	}
+
+	if (mAtrace)
+	{
+		ATRACE_INT(kStageCounters[stage], rec->id);
+	}
+
+	if (stage == FRAME_STAGE_RELEASE)
+	{
+		finishFrame(rec);
+		rec->time[FRAME_STAGE_DEQUEUE] = 0;
+	}
+}
+
+void FrameTrace::finishFrame(frameRecord_t * rec)
+{
+	Mutex::Autolock locker(&mLock);
+
+	const int64_t start = rec->time[FRAME_STAGE_DEQUEUE];
+	for (int s = FRAME_STAGE_DEQUEUE + 1; s < FRAME_STAGE_NUM; s++)
+	{
+		if (rec->time[s] == 0)
+		{
+			continue;
+		}
+
+		int64_t latency = rec->time[s] - start;
+		stageStats_t * stats = &mStages[s];
+		stats->count++;
+		stats->sum += latency;
+		if (latency > stats->max)
+		{
+			stats->max = latency;
+		}
+
+		int b = 0;
+		while (b < FRAME_TRACE_BUCKETS - 1 && latency >= kBucketBounds[b])
+		{
+			b++;
+		}
+		stats->buckets[b]++;
+	}
+
+	mHistory[mHistoryHead] = *rec;
+	mHistoryHead = (mHistoryHead + 1) % FRAME_TRACE_HISTORY;
+	mFrames++;
+}
+
+void FrameTrace::dump(String8 & result)
+{
+	Mutex::Autolock locker(&mLock);
+
+	if (!mEnabled && mFrames == 0)
+	{
+		result.append("  frame trace: off (setprop debug.camera.trace 1, or 2 for atrace)\n");
+		return ;
+	}
+
+	result.appendFormat("  frame trace: %s%s, %u frames released, latency from dequeue:\n",
+		mEnabled ? "on" : "off", mAtrace ? " (atrace)" : "", mFrames);
+	result.append("    stage          count   avg ms   max ms"
+		"    <1    <2    <4    <8   <16   <33   <66  <133  more\n");
+	for (int s = FRAME_STAGE_DEQUEUE + 1; s < FRAME_STAGE_NUM; s++)
+	{
+		const stageStats_t * stats = &mStages[s];
+		result.appendFormat("    %-12s %7u %8.2f %8.2f",
+			kStageNames[s], stats->count,
+			stats->count ? stats->sum / 1000.0f / stats->count : 0.0f,
+			stats->max / 1000.0f);
+		for (int b = 0; b < FRAME_TRACE_BUCKETS; b++)
+		{
+			result.appendFormat(" %5u", stats->buckets[b]);
+		}
+		result.append("\n");
+	}
+
+	int count = (mFrames < FRAME_TRACE_HISTORY) ? mFrames : FRAME_TRACE_HISTORY;
+	if (count == 0)
+	{
+		return ;
+	}
+
+	result.append("    last frames, ms from dequeue (- not reached):\n");
+	for (int i = 0; i < count; i++)
+	{
+		int id = (mHistoryHead - count + i + FRAME_TRACE_HISTORY) % FRAME_TRACE_HISTORY;
+		const frameRecord_t * rec = &mHistory[id];
+		result.appendFormat("      #%u buf %d:", rec->id, rec->index);
+		for (int s = FRAME_STAGE_DEQUEUE + 1; s < FRAME_STAGE_NUM; s++)
+		{
+			if (rec->time[s] == 0)
+			{
+				result.appendFormat(" %s -", kStageNames[s]);
+			}
+			else
+			{
+				result.appendFormat(" %s %.2f", kStageNames[s],
+					(rec->time[s] - rec->time[FRAME_STAGE_DEQUEUE]) / 1000.0f);
+			}
+		}
+		result.append("\n");
+	}
+}
+
+}; /* namespace android */
@@ -0,0 +1,112 @@
+#ifndef __FRAME_TRACE_H__
+#define __FRAME_TRACE_H__
+
+/*
+ * Per-stage latency of captured frames.
+ *
+ * V4L2BUF_t comes from CedarX and cannot grow, so the trace record of a frame
+ * lives here, keyed by its V4L2 buffer index: a buffer holds one frame from
+ * VIDIOC_DQBUF until its last reference is dropped and it is queued again.
+ * Each record gets a sequence id at dequeue and monotonic times at the stages
+ * the frame reaches, it is folded into per-stage histograms on release.
+ *
+ * Enabled with the debug.camera.trace property when the device starts:
+ * 1 keeps the statistics, 2 also emits atrace counters. Disabled, each stage
+ * costs the test of mEnabled in mark().
+ */
+
+// included by V4L2Camera.h, after MAX_NB_BUFFER
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+// last frames kept whole for dumpCamera
+#define FRAME_TRACE_HISTORY		16
+
+// histogram bucket upper bounds, us, the last bucket is open
+#define FRAME_TRACE_BUCKETS		9
+
+namespace android {
+
+enum
+{
+	FRAME_STAGE_DEQUEUE = 0,		// VIDIOC_DQBUF returned it
+	FRAME_STAGE_PREVIEW,			// posted to the window or the HW layer
+	FRAME_STAGE_CALLBACK,			// preview / video callbacks returned
+	FRAME_STAGE_ENCODE_START,		// handed to the video or JPEG encoder
+	FRAME_STAGE_ENCODE_END,			// encoder done with it
+	FRAME_STAGE_RELEASE,			// last reference dropped, queued again
+	FRAME_STAGE_NUM
+};
+
+class FrameTrace
+{
+public:
+	FrameTrace();
+
+	// reads debug.camera.trace, called when the device starts
+	void configure();
+
+	// 0 off, 1 statistics, 2 also atrace counters, as the property
+	void setLevel(int level);
+
+	inline bool isEnabled() const
+	{
+		return mEnabled;
+	}
+
+	// stamps a stage of the frame in buffer 'index'
+	inline void mark(int index, int stage)
+	{
+		if (mEnabled)
+		{
+			markStage(index, stage);
+		}
+	}
+
+	// forgets frames in flight, the stream is off
+	void reset();
+
+	// appends histograms and the last frames for dumpCamera
+	void dump(String8 & result);
+
+private:
+	typedef struct frameRecord_t
+	{
+		uint32_t	id;
+		int			index;
+		int64_t		time[FRAME_STAGE_NUM];		// monotonic, us, 0 if not reached
+	}
+
+	frameRecord_t;
+
+	typedef struct stageStats_t
+	{
+		uint32_t	count;
+		int64_t		sum;		// us, from dequeue
+		int64_t		max;
+		uint32_t	buckets[FRAME_TRACE_BUCKETS];
+	}
+
+	stageStats_t;
+
+	void markStage(int index, int stage);
+	void finishFrame(frameRecord_t * rec);
+
+	bool							mEnabled;
+	bool							mAtrace;
+
+	// written by whoever owns the buffer, the reference count hands it over
+	frameRecord_t					mInFlight[MAX_NB_BUFFER];
+	volatile int32_t				mNextId;
+
+	// protected by mLock
+	stageStats_t					mStages[FRAME_STAGE_NUM];
+	frameRecord_t					mHistory[FRAME_TRACE_HISTORY];
+	int								mHistoryHead;		// next slot
+	uint32_t						mFrames;
+	Mutex							mLock;
+};
+
+}; /* namespace android */
+
+#endif  /* __FRAME_TRACE_H__ */
@@ -39,11 +39,15 @@ namespace android {
 HALCameraFactory::HALCameraFactory()
         : mHardwareCameras(NULL),
           mCameraHardwareNum(0),
-          mConstructedOK(false)
+          mConstructedOK(false),
+          mCameraConfig(NULL),
+          mCameraFacing(NULL),
+          mProbeState(NULL)
 {
 	        
 
-	// camera config information
+	// camera config information, the table parsed here is shared with
+	// the config of each camera
 	mCameraConfig = new CCameraConfig(0);
 	if(mCameraConfig == 0)
 	{
@@ -51,16 +55,15 @@ HALCameraFactory::HALCameraFactory()
 		return ;
 	}
 
-	mCameraConfig->initParameters();
-	mCameraConfig->dumpParameters();
-
 	mCameraHardwareNum = mCameraConfig->numberOfCamera();
 	
     /* Make sure that array is allocated (in case there were no 'qemu'
      * cameras created. */
     if (mHardwareCameras == NULL) {
         mHardwareCameras = new CameraHardware*[mCameraHardwareNum];
-        if (mHardwareCameras == NULL) {
+        mCameraFacing = new int[mCameraHardwareNum];
+        mProbeState = new int[mCameraHardwareNum];
+        if (mHardwareCameras == NULL || mCameraFacing == NULL || mProbeState == NULL) {
             ALOGE("%s: Unable to allocate V4L2Camera array for %d entries",
                  __FUNCTION__, mCameraHardwareNum);
             return;
@@ -68,28 +71,15 @@ HALCameraFactory::HALCameraFactory()
         memset(mHardwareCameras, 0, mCameraHardwareNum * sizeof(CameraHardware*));
     }
 
-    /* Create, and initialize the fake camera */
+	// only metadata here, the cameras are created on their first open
 	for (int id = 0; id < mCameraHardwareNum; id++)
 	{
-		mHardwareCameras[id] = new CameraHardwareDevice(id, &HAL_MODULE_INFO_SYM.common);
-		if (mHardwareCameras[id] != NULL) 
-		{
-	        if (mHardwareCameras[id]->Initialize() != NO_ERROR) 
-			{
-	            delete mHardwareCameras[id];
-	            mHardwareCameras--;
-				return;
-		    } 
-		}
-		else 
-		{
-	        mHardwareCameras--;
-	        ALOGE("%s: Unable to instantiate fake camera class", __FUNCTION__);
-			return;
-	    }
+		CCameraConfig config(id);
+		mCameraFacing[id] = config.cameraFacing();
+		mProbeState[id] = PROBE_NONE;
 	}
 
-	ALOGV("%d cameras are being created.", mCameraHardwareNum);
+	ALOGV("%d cameras are available.", mCameraHardwareNum);
 
     mConstructedOK = true;
 }
@@ -105,6 +95,74 @@ HALCameraFactory::~HALCameraFactory()
         }
         delete[] mHardwareCameras;
     }
+
+	delete[] mCameraFacing;
+	delete[] mProbeState;
+	delete mCameraConfig;
+}
+
+void HALCameraFactory::probeCamera(int camera_id)
+{
+	ALOGV("%s: id = %d", __FUNCTION__, camera_id);
+
+	CameraHardware * camera = new CameraHardwareDevice(camera_id, &HAL_MODULE_INFO_SYM.common);
+	if (camera == NULL)
+	{
+		ALOGE("%s: Unable to instantiate camera %d", __FUNCTION__, camera_id);
+	}
+	else if (camera->Initialize() != NO_ERROR)
+	{
+		ALOGE("%s: Unable to initialize camera %d", __FUNCTION__, camera_id);
+		delete camera;
+		camera = NULL;
+	}
+
+	Mutex::Autolock locker(&mProbeLock);
+	mHardwareCameras[camera_id] = camera;
+	mProbeState[camera_id] = (camera != NULL) ? PROBE_DONE : PROBE_FAILED;
+	mProbeCond.broadcast();
+}
+
+CameraHardware * HALCameraFactory::getCamera(int camera_id)
+{
+	Mutex::Autolock locker(&mProbeLock);
+
+	if (mProbeState[camera_id] == PROBE_NONE)
+	{
+		if (mCameraHardwareNum > 1)
+		{
+			// the other sensor is likely to be opened next, when switching
+			// cameras, so probe every sensor not probed yet on its own thread
+			for (int id = 0; id < mCameraHardwareNum; id++)
+			{
+				if (mProbeState[id] != PROBE_NONE)
+				{
+					continue;
+				}
+
+				sp<ProbeThread> thread = new ProbeThread(this, id);
+				if (thread->run("CameraProbeThread", ANDROID_PRIORITY_FOREGROUND) == NO_ERROR)
+				{
+					mProbeState[id] = PROBE_RUNNING;
+				}
+			}
+		}
+
+		if (mProbeState[camera_id] == PROBE_NONE)
+		{
+			mProbeState[camera_id] = PROBE_RUNNING;
+			mProbeLock.unlock();
+			probeCamera(camera_id);
+			mProbeLock.lock();
+		}
+	}
+
+	while (mProbeState[camera_id] == PROBE_RUNNING)
+	{
+		mProbeCond.wait(mProbeLock);
+	}
+
+	return mHardwareCameras[camera_id];
 }
 
 /****************************************************************************
@@ -132,7 +190,13 @@ int HALCameraFactory::cameraDeviceOpen(int camera_id, hw_device_t** device)
         return -EINVAL;
     }
 
-    return mHardwareCameras[camera_id]->connectCamera(device);
+    CameraHardware * camera = getCamera(camera_id);
+    if (camera == NULL) {
+        ALOGE("%s: Camera %d failed to initialize", __FUNCTION__, camera_id);
+        return -ENODEV;
+    }
+
+    return camera->connectCamera(device);
 }
 
 int HALCameraFactory::getCameraInfo(int camera_id, struct camera_info* info)
@@ -150,7 +214,19 @@ int HALCameraFactory::getCameraInfo(int camera_id, struct camera_info* info)
         return -EINVAL;
     }
 
-    return mHardwareCameras[camera_id]->getCameraInfo(info);
+	// answered from the config until the camera is opened once
+	{
+		Mutex::Autolock locker(&mProbeLock);
+		if (mProbeState[camera_id] == PROBE_DONE)
+		{
+			return mHardwareCameras[camera_id]->getCameraInfo(info);
+		}
+	}
+
+	info->facing = (mCameraFacing[camera_id] == CAMERA_FACING_BACK) ? CAMERA_FACING_BACK : CAMERA_FACING_FRONT;
+	info->orientation = 0;
+
+	return NO_ERROR;
 }
 
 /****************************************************************************
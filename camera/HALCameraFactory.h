@@ -48,9 +48,10 @@ namespace android {
 class HALCameraFactory {
 public:
     /* Constructs HALCameraFactory instance.
-     * In this constructor the factory will create and initialize a list of
-     * V4L2Cameras. All errors that occur on this constructor are reported
-     * via mConstructedOK data member of this class.
+     * In this constructor the factory only reads the number of cameras and
+     * their facing from the camera config. Each camera is created and
+     * initialized on its first open. All errors that occur on this constructor
+     * are reported via mConstructedOK data member of this class.
      */
     HALCameraFactory();
 
@@ -113,6 +114,46 @@ public:
         return mConstructedOK;
     }
 
+	// -------------------------------------------------------------------------
+	// extended interfaces here <***** star *****>
+	// -------------------------------------------------------------------------
+
+private:
+
+	enum {
+		PROBE_NONE = 0,
+		PROBE_RUNNING,
+		PROBE_DONE,
+		PROBE_FAILED
+	};
+
+	// creates and initializes one camera, on a probe thread when there
+	// are several sensors so that they come up together
+	class ProbeThread : public Thread
+	{
+	public:
+		ProbeThread(HALCameraFactory * factory, int id)
+			: Thread(false),
+			  mFactory(factory),
+			  mId(id)
+		{
+		}
+
+	private:
+		bool threadLoop()
+		{
+			mFactory->probeCamera(mId);
+			return false;
+		}
+
+		HALCameraFactory *	mFactory;
+		int					mId;
+	};
+
+	// returns the initialized camera, probing it first if needed
+	CameraHardware * getCamera(int camera_id);
+	void probeCamera(int camera_id);
+
     /****************************************************************************
      * Data members.
      ***************************************************************************/
@@ -132,6 +173,14 @@ private:
 
 	// Camera Config information
 	CCameraConfig *		mCameraConfig;
+
+	// facing of each camera, read from the config for getCameraInfo
+	int *				mCameraFacing;
+
+	// PROBE_* state of each camera
+	int *				mProbeState;
+	Mutex				mProbeLock;
+	Condition			mProbeCond;
 	
 public:
     /* Contains device open entry point, as required by HAL API. */
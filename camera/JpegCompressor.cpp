@@ -21,11 +21,111 @@
 
 #define LOG_TAG "Camera_JPEG"
 #include "CameraDebug.h"
+#include <setjmp.h>
+#include <stdlib.h>
 #include <utils/Errors.h>
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 #include "JpegCompressor.h"
 
+extern "C" {
+#include "jpeglib.h"
+#include "jerror.h"
+}
+
+/* Height of an MCU row for 4:2:0 sampling. */
+#define JPEG_MCU_SIZE       16
+
+/* Bytes handed to the output stream at a time. */
+#define JPEG_OUT_BUF_SIZE   4096
+
 namespace android {
 
+/* Splits a row of interleaved NV21 chroma into its U and V planes.
+ * Param:
+ *  vu - VU pairs of the row.
+ *  u, v - Planes, 'count' samples each.
+ */
+static void DeinterleaveVU_C(const uint8_t* vu, uint8_t* u, uint8_t* v, int count)
+{
+    for (int i = 0; i < count; i++) {
+        v[i] = vu[i * 2];
+        u[i] = vu[i * 2 + 1];
+    }
+}
+
+#if defined(__ARM_NEON__)
+/* 16 pairs per iteration, the tail goes through the C loop. */
+static void DeinterleaveVU_neon(const uint8_t* vu, uint8_t* u, uint8_t* v, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const uint8x16x2_t pairs = vld2q_u8(vu + i * 2);
+        vst1q_u8(v + i, pairs.val[0]);
+        vst1q_u8(u + i, pairs.val[1]);
+    }
+    DeinterleaveVU_C(vu + i * 2, u + i, v + i, count - i);
+}
+#endif
+
+typedef void (*DeinterleaveVUFunc)(const uint8_t*, uint8_t*, uint8_t*, int);
+
+/* The board is built for armv7-a-neon, so NEON is not probed at runtime. */
+#if defined(__ARM_NEON__)
+static DeinterleaveVUFunc lDeinterleaveVU = DeinterleaveVU_neon;
+#else
+static DeinterleaveVUFunc lDeinterleaveVU = DeinterleaveVU_C;
+#endif
+
+/* libjpeg destination that hands the output to a Skia stream. */
+struct JpegStreamDest {
+    struct jpeg_destination_mgr pub;
+    SkWStream*                  stream;
+    JOCTET                      buffer[JPEG_OUT_BUF_SIZE];
+};
+
+static void StreamInitDestination(j_compress_ptr cinfo)
+{
+    JpegStreamDest* dest = reinterpret_cast<JpegStreamDest*>(cinfo->dest);
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JPEG_OUT_BUF_SIZE;
+}
+
+static boolean StreamEmptyOutputBuffer(j_compress_ptr cinfo)
+{
+    JpegStreamDest* dest = reinterpret_cast<JpegStreamDest*>(cinfo->dest);
+    /* The whole buffer is full when libjpeg calls this. */
+    if (!dest->stream->write(dest->buffer, JPEG_OUT_BUF_SIZE)) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JPEG_OUT_BUF_SIZE;
+    return TRUE;
+}
+
+static void StreamTermDestination(j_compress_ptr cinfo)
+{
+    JpegStreamDest* dest = reinterpret_cast<JpegStreamDest*>(cinfo->dest);
+    const size_t size = JPEG_OUT_BUF_SIZE - dest->pub.free_in_buffer;
+    if (size > 0 && !dest->stream->write(dest->buffer, size)) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+}
+
+/* libjpeg error handler that returns to the encoder instead of exiting. */
+struct JpegRawError {
+    struct jpeg_error_mgr   pub;
+    jmp_buf                 jmp;
+};
+
+static void RawErrorExit(j_common_ptr cinfo)
+{
+    JpegRawError* err = reinterpret_cast<JpegRawError*>(cinfo->err);
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->jmp, 1);
+}
+
 NV21JpegCompressor::NV21JpegCompressor()
     : Yuv420SpToJpegEncoder(mStrides)
 {
@@ -45,6 +145,15 @@ status_t NV21JpegCompressor::compressRawImage(const void* image,
                                               int quality)
 {
     ALOGV("%s: %p[%dx%d]", __FUNCTION__, image, width, height);
+
+    if ((width % JPEG_MCU_SIZE) == 0) {
+        if (compressRaw(image, width, height, quality) == NO_ERROR) {
+            return NO_ERROR;
+        }
+        ALOGW("%s: raw JPEG compression failed, retrying with the YUV encoder", __FUNCTION__);
+        mStream.reset();
+    }
+
     void* pY = const_cast<void*>(image);
     int offsets[2];
     offsets[0] = 0;
@@ -61,4 +170,106 @@ status_t NV21JpegCompressor::compressRawImage(const void* image,
     }
 }
 
+/****************************************************************************
+ * Private API
+ ***************************************************************************/
+
+status_t NV21JpegCompressor::compressRaw(const void* image,
+                                         int width,
+                                         int height,
+                                         int quality)
+{
+    struct jpeg_compress_struct cinfo;
+    JpegRawError jerr;
+    JpegStreamDest dest;
+
+    const uint8_t* y = reinterpret_cast<const uint8_t*>(image);
+    const uint8_t* vu = y + width * height;
+    const int chroma_height = (height + 1) / 2;
+
+    /* One MCU row of deinterleaved chroma. */
+    uint8_t* u = reinterpret_cast<uint8_t*>(malloc(width * JPEG_MCU_SIZE / 4));
+    uint8_t* v = reinterpret_cast<uint8_t*>(malloc(width * JPEG_MCU_SIZE / 4));
+    if (u == NULL || v == NULL) {
+        free(u);
+        free(v);
+        return ENOMEM;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = RawErrorExit;
+    if (setjmp(jerr.jmp)) {
+        jpeg_destroy_compress(&cinfo);
+        free(u);
+        free(v);
+        return EINVAL;
+    }
+    jpeg_create_compress(&cinfo);
+
+    dest.pub.init_destination = StreamInitDestination;
+    dest.pub.empty_output_buffer = StreamEmptyOutputBuffer;
+    dest.pub.term_destination = StreamTermDestination;
+    dest.stream = &mStream;
+    cinfo.dest = &dest.pub;
+
+    /* The settings of Yuv420SpToJpegEncoder, so both paths give the same
+     * tables. */
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    cinfo.raw_data_in = TRUE;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW y_rows[JPEG_MCU_SIZE];
+    JSAMPROW u_rows[JPEG_MCU_SIZE / 2];
+    JSAMPROW v_rows[JPEG_MCU_SIZE / 2];
+    JSAMPARRAY planes[3] = { y_rows, u_rows, v_rows };
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        /* Rows past the bottom of the image repeat the last one, the way
+         * libjpeg pads the bottom edge itself. */
+        for (int i = 0; i < JPEG_MCU_SIZE; i++) {
+            int row = cinfo.next_scanline + i;
+            if (row >= height) {
+                row = height - 1;
+            }
+            y_rows[i] = const_cast<uint8_t*>(y) + row * width;
+        }
+        for (int i = 0; i < JPEG_MCU_SIZE / 2; i++) {
+            int row = cinfo.next_scanline / 2 + i;
+            if (row >= chroma_height) {
+                row = chroma_height - 1;
+            }
+            uint8_t* pu = u + i * width / 2;
+            uint8_t* pv = v + i * width / 2;
+            lDeinterleaveVU(vu + row * width, pu, pv, width / 2);
+            u_rows[i] = pu;
+            v_rows[i] = pv;
+        }
+        jpeg_write_raw_data(&cinfo, planes, JPEG_MCU_SIZE);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(u);
+    free(v);
+
+    ALOGV("%s: Compressed JPEG: %d[%dx%d] -> %d bytes",
+         __FUNCTION__, (width * height * 12) / 8, width, height, mStream.getOffset());
+
+    return NO_ERROR;
+}
+
 }; /* namespace android */
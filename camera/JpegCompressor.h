@@ -81,6 +81,26 @@ public:
         mStream.copyTo(buff);
     }
 
+    /****************************************************************************
+     * Private API
+     ***************************************************************************/
+
+protected:
+    /* Compresses raw NV21 image into a JPEG in a single pass, feeding libjpeg
+     * the Y rows in place and the chroma split with NEON, instead of going
+     * through the per sample deinterleave of Yuv420SpToJpegEncoder.
+     * Param:
+     *  image - Raw NV21 image, width must be a multiple of 16.
+     *  width, height - Image dimensions.
+     *  quality - JPEG quality.
+     * Return:
+     *  NO_ERROR on success, or an appropriate error status.
+     */
+    status_t compressRaw(const void* image,
+                         int width,
+                         int height,
+                         int quality);
+
     /****************************************************************************
      * Class data
      ***************************************************************************/
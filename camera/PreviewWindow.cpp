@@ -27,6 +27,7 @@
 #include <type_camera.h>
 #include <hardware/hwcomposer.h>
 #include "V4L2Camera.h"
+#include "Converters.h"
 #include "PreviewWindow.h"
 
 namespace android {
@@ -39,9 +40,12 @@ PreviewWindow::PreviewWindow()
       mOverlayFirstFrame(true),
       mShouldAdjustDimensions(true),
       mLayerFormat(-1),
-      mScreenID(0)
+      mScreenID(0),
+      mPreviewTransform(0),
+      mOverlayCOffset(0)
 {
 	F_LOG;
+	memset(&mOverlayPara, 0, sizeof(mOverlayPara));
 }
 
 PreviewWindow::~PreviewWindow()
@@ -63,6 +67,7 @@ status_t PreviewWindow::setPreviewWindow(struct preview_stream_ops* window,
 
     /* Reset preview info. */
     mPreviewFrameWidth = mPreviewFrameHeight = 0;
+	mShouldAdjustDimensions = true;
 
     if (window != NULL) {
         /* The CPU will write each frame to the preview window buffer.
@@ -88,6 +93,9 @@ status_t PreviewWindow::startPreview()
     Mutex::Autolock locker(&mObjectLock);
     mPreviewEnabled = true;
 	mOverlayFirstFrame = true;
+
+	// the device may run at another size since the last preview
+	mShouldAdjustDimensions = true;
 	
     return NO_ERROR;
 }
@@ -133,9 +141,11 @@ bool PreviewWindow::onNextFrameAvailableHW(const void* frame,
         return true;
     }
 	
-    /* Make sure that preview window dimensions are OK with the camera device */
-    if (adjustPreviewDimensions(camera_dev) || mShouldAdjustDimensions) 
+    /* Negotiate the window geometry and layer state after a configuration
+     * change, steady state frames only update the frame address. */
+    if (mShouldAdjustDimensions) 
 	{
+		adjustPreviewDimensions(camera_dev);
         ALOGD("%s: Adjusting preview windows %p geometry to %dx%d",
              __FUNCTION__, mPreviewWindow, mPreviewFrameWidth,
              mPreviewFrameHeight);
@@ -153,35 +163,36 @@ bool PreviewWindow::onNextFrameAvailableHW(const void* frame,
         }
 
 		mPreviewWindow->perform(mPreviewWindow, NATIVE_WINDOW_SETPARAMETER, HWC_LAYER_SETFORMAT, mLayerFormat);
-		mShouldAdjustDimensions = false;
-    }
 
-	libhwclayerpara_t overlay_para;
+		memset(&mOverlayPara, 0, sizeof(mOverlayPara));
+		mOverlayPara.bProgressiveSrc = 1;
+		mOverlayPara.bTopFieldFirst = 1;
+		mOverlayPara.pVideoInfo.frame_rate = 25000;
+		mOverlayCOffset = mPreviewFrameWidth * mPreviewFrameHeight;
 
-	overlay_para.bProgressiveSrc = 1;
-	overlay_para.bTopFieldFirst = 1;
-	overlay_para.pVideoInfo.frame_rate = 25000;
+		// the layer is set up again from the next frame
+		mOverlayFirstFrame = true;
+		mShouldAdjustDimensions = false;
+    }
 
-	overlay_para.top_y 		= (unsigned int)pv4l2_buf->addrPhyY;
-	overlay_para.top_c 		= (unsigned int)pv4l2_buf->addrPhyY + mPreviewFrameWidth * mPreviewFrameHeight;
-	overlay_para.bottom_y 	= 0;
-	overlay_para.bottom_c 	= 0;
-	overlay_para.number 	= 0;
+	mOverlayPara.top_y 		= (unsigned int)pv4l2_buf->addrPhyY;
+	mOverlayPara.top_c 		= (unsigned int)pv4l2_buf->addrPhyY + mOverlayCOffset;
 
 	if (mOverlayFirstFrame)
 	{
 		ALOGD("first frame true");
-		overlay_para.first_frame_flg = 1;
+		mOverlayPara.first_frame_flg = 1;
 		mOverlayFirstFrame = false;
 	}
 	else
 	{
-		overlay_para.first_frame_flg = 0;
+		mOverlayPara.first_frame_flg = 0;
 	}
 	
-	// ALOGV("addrY: %x, addrC: %x, WXH: %dx%d", overlay_para.top_y, overlay_para.top_c, mPreviewFrameWidth, mPreviewFrameHeight);
+	// ALOGV("addrY: %x, addrC: %x, WXH: %dx%d", mOverlayPara.top_y, mOverlayPara.top_c, mPreviewFrameWidth, mPreviewFrameHeight);
 
-	res = mPreviewWindow->perform(mPreviewWindow, NATIVE_WINDOW_SETPARAMETER, HWC_LAYER_SETFRAMEPARA, (uint32_t)&overlay_para);
+	// steady state, the hwcomposer only sets the new frame address
+	res = mPreviewWindow->perform(mPreviewWindow, NATIVE_WINDOW_SETPARAMETER, HWC_LAYER_SETFRAMEPARA, (uint32_t)&mOverlayPara);
 	if (res != OK)
 	{
 		ALOGE("NATIVE_WINDOW_SETPARAMETER failed");
@@ -210,17 +221,22 @@ bool PreviewWindow::onNextFrameAvailableSW(const void* frame,
         return true;
     }
 
-    /* Make sure that preview window dimensions are OK with the camera device */
-    if (adjustPreviewDimensions(camera_dev) || mShouldAdjustDimensions) {
+    /* With a 90 / 270 degrees rotation the window is as wide as the frame
+     * is high. */
+    const bool swap_dims = (mPreviewTransform & CONVERT_ROT_90) != 0;
+
+    /* Set the window geometry after a configuration change only. */
+    if (mShouldAdjustDimensions) {
+        adjustPreviewDimensions(camera_dev);
         /* Need to set / adjust buffer geometry for the preview window.
          * Note that in the emulator preview window uses only RGB for pixel
          * formats. */
-        ALOGD("%s: Adjusting preview windows %p geometry to %dx%d",
+        ALOGD("%s: Adjusting preview windows %p geometry to %dx%d, transform %d",
              __FUNCTION__, mPreviewWindow, mPreviewFrameWidth,
-             mPreviewFrameHeight);
+             mPreviewFrameHeight, mPreviewTransform);
         res = mPreviewWindow->set_buffers_geometry(mPreviewWindow,
-                                                   mPreviewFrameWidth,
-                                                   mPreviewFrameHeight,
+                                                   swap_dims ? mPreviewFrameHeight : mPreviewFrameWidth,
+                                                   swap_dims ? mPreviewFrameWidth : mPreviewFrameHeight,
                                                    HAL_PIXEL_FORMAT_RGBA_8888);
         if (res != NO_ERROR) {
             ALOGE("%s: Error in set_buffers_geometry %d -> %s",
@@ -257,7 +273,8 @@ bool PreviewWindow::onNextFrameAvailableSW(const void* frame,
     /* Now let the graphics framework to lock the buffer, and provide
      * us with the framebuffer data address. */
     void* img = NULL;
-    const Rect rect(mPreviewFrameWidth, mPreviewFrameHeight);
+    const Rect rect(swap_dims ? mPreviewFrameHeight : mPreviewFrameWidth,
+                    swap_dims ? mPreviewFrameWidth : mPreviewFrameHeight);
     GraphicBufferMapper& grbuffer_mapper(GraphicBufferMapper::get());
     res = grbuffer_mapper.lock(*buffer, GRALLOC_USAGE_SW_WRITE_OFTEN, rect, &img);
     if (res != NO_ERROR) {
@@ -268,8 +285,15 @@ bool PreviewWindow::onNextFrameAvailableSW(const void* frame,
     }
 
     /* Frames come in in YV12/NV12/NV21 format. Since preview window doesn't
-     * supports those formats, we need to obtain the frame in RGB565. */
-    res = camera_dev->getCurrentPreviewFrame(img);
+     * supports those formats, we convert the frame to RGB32 straight into the
+     * locked buffer, honoring its stride and the preview transform. */
+    if (frame != NULL) {
+        res = YUV420ToRGB32Transform(frame, camera_dev->getOriginalPixelFormat(),
+                                     mPreviewFrameWidth, mPreviewFrameHeight,
+                                     img, stride, mPreviewTransform);
+    } else {
+        res = camera_dev->getCurrentPreviewFrame(img);
+    }
     if (res == NO_ERROR) {
         /* Show it. */
         mPreviewWindow->enqueue_buffer(mPreviewWindow, buffer);
@@ -323,6 +347,18 @@ int PreviewWindow::setLayerFormat(int fmt)
 	return OK;
 }
 
+int PreviewWindow::setPreviewTransform(int transform)
+{
+	ALOGV("%s, %d", __FUNCTION__, transform);
+	Mutex::Autolock locker(&mObjectLock);
+	if (mPreviewTransform != transform)
+	{
+		mPreviewTransform = transform;
+		mShouldAdjustDimensions = true;
+	}
+	return OK;
+}
+
 int PreviewWindow::setScreenID(int id)
 {
 	ALOGV("%s, id: %d", __FUNCTION__, id);
@@ -22,6 +22,8 @@
  * of a preview window set via set_preview_window camera HAL API.
  */
 
+#include <hardware/hwcomposer.h>
+
 namespace android {
 
 class V4L2Camera;
@@ -121,11 +123,10 @@ protected:
      * frame dimensions used by the camera device.
      *
      * When preview is started, it's not known (hard to define) what are going
-     * to be the dimensions of the frames that are going to be displayed. Plus,
-     * it might be possible, that such dimensions can be changed on the fly. So,
-     * in order to be always in sync with frame dimensions, this method is
-     * called for each frame passed to onNextFrameAvailable method, in order to
-     * properly adjust frame dimensions, used by the preview window.
+     * to be the dimensions of the frames that are going to be displayed. So
+     * this method is called for the first frame passed to onNextFrameAvailable
+     * after a configuration change (preview window, preview start, layer format
+     * or transform), and the result is kept until the next change.
      * Note that this method must be called while object is locked.
      * Param:
      *  camera_dev - Camera device, prpviding frames displayed in the preview
@@ -166,12 +167,24 @@ public:
 	int setLayerFormat(int fmt);
 	int setScreenID(int id);
 
+	// transform (CONVERT_XXX) applied by the SW preview while converting
+	int setPreviewTransform(int transform);
+
 protected:
 	bool							mOverlayFirstFrame;
+
+	// the window geometry and layer state below are negotiated again on
+	// the next frame, set by configuration changes only
 	bool							mShouldAdjustDimensions;
+
+	// HW layer frame parameters, only the frame address changes per frame
+	libhwclayerpara_t				mOverlayPara;
+	unsigned int					mOverlayCOffset;
+
 	int								mLayerShowHW;
 	int								mLayerFormat;
 	int								mScreenID;
+	int								mPreviewTransform;
 };
 
 }; /* namespace android */
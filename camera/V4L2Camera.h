@@ -29,11 +29,14 @@
 #include <utils/threads.h>
 #include "CameraCommon.h"
 
-namespace android {
-
 #define DEVICE_BACK		"/dev/video0"
 #define DEVICE_FRONT	"/dev/video1"
-#define NB_BUFFER 4
+#define NB_BUFFER 4			// default V4L2 buffer queue depth
+#define MAX_NB_BUFFER 8
+
+#include "FrameTrace.h"
+
+namespace android {
 
 class CameraHardware;
 
@@ -162,6 +165,63 @@ public:
      */
     virtual status_t getCurrentPreviewFrame(void* buffer);
 
+    /* Takes a reference on a captured buffer.
+     * Consumers that keep a captured buffer past the onNextFrameAvailable
+     * call (e.g. the video encoder, or the display overlay) must take a
+     * reference before they hand the buffer over, and drop it with
+     * releasePreviewFrame once they are done. The buffer goes back to the
+     * driver when its last reference is dropped.
+     * Param:
+     *  index - Index of the captured buffer.
+     */
+    virtual void acquirePreviewFrame(int index)
+    {
+    }
+
+    /* Drops a reference taken on a captured buffer.
+     * Param:
+     *  index - Index of the captured buffer.
+     */
+    virtual void releasePreviewFrame(int index)
+    {
+    }
+
+    /* Gets the frame for the preview callback.
+     * Param:
+     *  frame - Captured frame, as passed to onNextFrameAvailable.
+     *  size - Byte size of the returned frame.
+     * Return:
+     *  The frame scaled to the preview size and converted to the preview
+     *  format, valid until the next call, or NULL to send 'frame' as is.
+     */
+    virtual const void* getPreviewCallbackFrame(const void* frame, int* size)
+    {
+        return NULL;
+    }
+
+    /* Gets the number of buffers in the capture queue.
+     * Return:
+     *  Number of V4L2 buffers, valid once the device has been started.
+     */
+    virtual int getBufferCount()
+    {
+        return NB_BUFFER;
+    }
+
+    /* Notifies the device that the compressed image of the last picture has
+     * been delivered, for shutter latency accounting.
+     */
+    virtual void onPictureDelivered()
+    {
+    }
+
+    /* Stops a burst after the current frame, called from the worker thread
+     * when the client no longer takes compressed images.
+     */
+    virtual void endBurst()
+    {
+    }
+
     /* Gets width of the frame obtained from the physical device.
      * Return:
      *  Width of the frame obtained from the physical device. Note that value
@@ -504,7 +564,15 @@ protected:
 	// add for CTS
 	int64_t						mStartDeliverTimeUs;
 
+	// per-stage latency of the frames in the V4L2 buffers
+	FrameTrace					mFrameTrace;
+
 public:
+
+	inline FrameTrace & getFrameTrace()
+	{
+		return mFrameTrace;
+	}
 	
 	inline void setTakingPicture(bool taking)
 	{
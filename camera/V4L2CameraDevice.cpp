@@ -23,8 +23,12 @@
 
 #include <fcntl.h> 
 #include <sys/mman.h> 
+#include <sys/time.h>
+#include <cutils/atomic.h>
 #include <videodev2.h>
 #include <linux/videodev.h> 
+#include <linux/types.h>
+#include <g2d_driver.h>
 
 #include "CameraHardwareDevice.h"
 #include "V4L2CameraDevice.h"
@@ -41,17 +45,44 @@ V4L2CameraDevice::V4L2CameraDevice(CameraHardwareDevice* camera_hal, int id)
     : V4L2Camera(camera_hal),
       mCameraID(id),
       mCamFd(0),
+      mBackend(NULL),
       mDeviceID(-1),
       mBufferCnt(NB_BUFFER),
+      mBufferCntConfig(NB_BUFFER),
+      mPreviewHeldIndex(-1),
       mCameraFacing(0),
       mPreviewUseHW(true),
+      mPreviewMirror(false),
+      mG2DFd(-1),
+      mMirrorBufferID(0),
+      mCallbackWidth(0),
+      mCallbackHeight(0),
+      mCallbackFormat(0),
+      mCallbackScale(false),
+      mCallbackBufLen(0),
+      mCallbackBufferID(0),
+      mCallbackFrames(0),
       mLastPreviewed(0),
       mPreviewAfter(0), 
       mPreviewBufferID(0),
-      mPrepareTakePhoto(false)
+      mPrepareTakePhoto(false),
+      mZslBufferCnt(0),
+      mZslHead(0),
+      mZslCount(0),
+      mZslPending(false),
+      mZslShutterTime(0),
+      mShutterTime(0),
+      mBurstCount(1),
+      mBurstLeft(0)
 {
 	F_LOG;
 	memset(mDeviceName, 0, sizeof(mDeviceName));
+	memset(&mPictureStats, 0, sizeof(mPictureStats));
+	memset(mMirrorBufVir, 0, sizeof(mMirrorBufVir));
+	memset(mMirrorBufPhy, 0, sizeof(mMirrorBufPhy));
+	memset(mCallbackBufVir, 0, sizeof(mCallbackBufVir));
+	memset(mCallbackBufPhy, 0, sizeof(mCallbackBufPhy));
+	resetFrameRefs();
 	
 	pthread_mutex_init(&mMutexTakePhoto, NULL);
 	pthread_cond_init(&mCondTakePhoto, NULL);
@@ -133,6 +164,24 @@ status_t V4L2CameraDevice::connectDevice()
 	//	memset((void*)mPreviewBuffer.buf_vir_addr[i], 0x10, MAX_PREVIEW_WIDTH * MAX_PREVIEW_HEIGHT /2);
 	}
 
+	// G2D scales preview callback frames, and mirrors the front camera
+	// preview for the HW layer
+	mG2DFd = open("/dev/g2d", O_RDWR, 0);
+	if (mG2DFd < 0)
+	{
+		ALOGW("open g2d driver failed, front camera uses SW preview");
+	}
+	else if (mCameraFacing == CAMERA_FACING_FRONT)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			int buffer_len = MAX_PREVIEW_WIDTH * MAX_PREVIEW_HEIGHT * 3 / 2;
+			mMirrorBufVir[i] = (int)cedara_phymalloc_map(buffer_len, 1024);
+			mMirrorBufPhy[i] = cedarv_address_vir2phy((void*)mMirrorBufVir[i]);
+			mMirrorBufPhy[i] |= 0x40000000;
+		}
+	}
+
     /* There is no device to connect to. */
     mState = ECDS_CONNECTED;
 
@@ -162,6 +211,29 @@ status_t V4L2CameraDevice::disconnectDevice()
 		mPreviewBuffer.buf_phy_addr[i] = 0;
 	}
 
+	for (int i = 0; i < 2; i++)
+	{
+		if (mMirrorBufVir[i] != 0)
+		{
+			cedara_phyfree_map((void*)mMirrorBufVir[i]);
+			mMirrorBufVir[i] = 0;
+			mMirrorBufPhy[i] = 0;
+		}
+		if (mCallbackBufVir[i] != 0)
+		{
+			cedara_phyfree_map((void*)mCallbackBufVir[i]);
+			mCallbackBufVir[i] = 0;
+			mCallbackBufPhy[i] = 0;
+		}
+	}
+	mCallbackBufLen = 0;
+
+	if (mG2DFd >= 0)
+	{
+		close(mG2DFd);
+		mG2DFd = -1;
+	}
+
 	int ret = cedarx_hardware_exit(2);// CEDARX_HARDWARE_MODE_VIDEO
 	if (ret < 0)
 	{
@@ -193,6 +265,12 @@ status_t V4L2CameraDevice::startDevice(int width,
 	
 	// set v4l2 device parameters
 	v4l2SetVideoParams(width, height, pix_fmt);
+
+	{
+		Mutex::Autolock stats_locker(&mStatsLock);
+		memset(&mQueueStats, 0, sizeof(mQueueStats));
+	}
+	mFrameTrace.configure();
 	
 	// v4l2 request buffers
 	v4l2ReqBufs();
@@ -213,8 +291,11 @@ status_t V4L2CameraDevice::startDevice(int width,
 	mPreviewUseHW = true;
 	mPreviewAfter = 1000000 / getFrameRate();
 
-	// front camera do not use hw preview, SW preview will mirror it
-	if (mCameraFacing == CAMERA_FACING_FRONT) //&& (!deviceCardMatches("gt2005")))
+	// front camera preview is mirrored, by G2D for the HW layer, the SW
+	// preview is mirrored by the window transform the framework sets.
+	// Buffers without a physical address are previewed in SW too
+	mPreviewMirror = (mCameraFacing == CAMERA_FACING_FRONT);
+	if ((mPreviewMirror && mG2DFd < 0) || !mBackend->hasPhysicalBuffers())
 	{
 		ALOGD("do not us hw preview");
 		mPreviewUseHW = false;
@@ -230,10 +311,140 @@ status_t V4L2CameraDevice::startDevice(int width,
 			mPreviewAfter = 1000000 / 7;
 		}
 	}
+
+	setupPreviewCallbackScale(pix_fmt);
 	
     return res;
 }
 
+// G2D scales NV12 / NV21 captures to the preview callback size and format,
+// other captures go to the callback as they are
+void V4L2CameraDevice::setupPreviewCallbackScale(uint32_t pix_fmt)
+{
+	mCallbackScale = false;
+
+	if (mG2DFd < 0 || mCallbackFormat == 0 || !mBackend->hasPhysicalBuffers()
+		|| (pix_fmt != V4L2_PIX_FMT_NV12 && pix_fmt != V4L2_PIX_FMT_NV21))
+	{
+		return ;
+	}
+	if (mCallbackWidth == mFrameWidth && mCallbackHeight == mFrameHeight
+		&& mCallbackFormat == pix_fmt)
+	{
+		return ;
+	}
+
+	// YV12 chroma strides are 16 aligned, G2D planes are packed
+	if (mCallbackFormat == V4L2_PIX_FMT_YVU420 && (mCallbackWidth % 32) != 0)
+	{
+		ALOGW("preview callback %dx%d YV12 is not scaled by G2D", mCallbackWidth, mCallbackHeight);
+		return ;
+	}
+
+	int buffer_len = mCallbackWidth * mCallbackHeight * 3 / 2;
+	if (buffer_len > mCallbackBufLen)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			if (mCallbackBufVir[i] != 0)
+			{
+				cedara_phyfree_map((void*)mCallbackBufVir[i]);
+			}
+			mCallbackBufVir[i] = (int)cedara_phymalloc_map(buffer_len, 1024);
+			if (mCallbackBufVir[i] == 0)
+			{
+				ALOGE("alloc preview callback buffer failed");
+				mCallbackBufPhy[i] = 0;
+				mCallbackBufLen = 0;
+				return ;
+			}
+			mCallbackBufPhy[i] = cedarv_address_vir2phy((void*)mCallbackBufVir[i]);
+			mCallbackBufPhy[i] |= 0x40000000;
+		}
+		mCallbackBufLen = buffer_len;
+	}
+
+	ALOGD("preview callback %dx%d -> %dx%d by G2D", 
+		mFrameWidth, mFrameHeight, mCallbackWidth, mCallbackHeight);
+	mCallbackScale = true;
+}
+
+int V4L2CameraDevice::setPreviewCallbackFormat(int width, int height, uint32_t pix_fmt)
+{
+	mCallbackWidth = width;
+	mCallbackHeight = height;
+	mCallbackFormat = pix_fmt;
+	return OK;
+}
+
+const void * V4L2CameraDevice::getPreviewCallbackFrame(const void * frame, int * size)
+{
+	if (!mCallbackScale)
+	{
+		return NULL;
+	}
+
+	int index = 0;
+	while (index < mBufferCnt && mMapMem.mem[index] != frame)
+	{
+		index++;
+	}
+	if (index == mBufferCnt)
+	{
+		return NULL;
+	}
+
+	mCallbackBufferID = (mCallbackBufferID == 0) ? 1 : 0;
+
+	const unsigned int src_y_size = mFrameWidth * mFrameHeight;
+	const unsigned int dst_y_size = mCallbackWidth * mCallbackHeight;
+	const unsigned int dst = mCallbackBufPhy[mCallbackBufferID];
+
+	g2d_stretchblt blit_para;
+	memset(&blit_para, 0, sizeof(blit_para));
+	blit_para.flag					= G2D_BLT_NONE;
+
+	blit_para.src_image.addr[0]		= mMapMem.phy[index];
+	blit_para.src_image.addr[1]		= mMapMem.phy[index] + src_y_size;
+	blit_para.src_image.w			= mFrameWidth;
+	blit_para.src_image.h			= mFrameHeight;
+	blit_para.src_image.format		= G2D_FMT_PYUV420UVC;
+	blit_para.src_image.pixel_seq	= (mPixelFormat == V4L2_PIX_FMT_NV21) ? G2D_SEQ_VUVU : G2D_SEQ_NORMAL;
+	blit_para.src_rect.w			= mFrameWidth;
+	blit_para.src_rect.h			= mFrameHeight;
+
+	blit_para.dst_image.addr[0]		= dst;
+	blit_para.dst_image.w			= mCallbackWidth;
+	blit_para.dst_image.h			= mCallbackHeight;
+	if (mCallbackFormat == V4L2_PIX_FMT_YVU420)
+	{
+		// YV12, V plane before U
+		blit_para.dst_image.addr[1]		= dst + dst_y_size + dst_y_size / 4;
+		blit_para.dst_image.addr[2]		= dst + dst_y_size;
+		blit_para.dst_image.format		= G2D_FMT_PYUV420;
+		blit_para.dst_image.pixel_seq	= G2D_SEQ_NORMAL;
+	}
+	else
+	{
+		blit_para.dst_image.addr[1]		= dst + dst_y_size;
+		blit_para.dst_image.format		= G2D_FMT_PYUV420UVC;
+		blit_para.dst_image.pixel_seq	= G2D_SEQ_VUVU;
+	}
+	blit_para.dst_rect.w			= mCallbackWidth;
+	blit_para.dst_rect.h			= mCallbackHeight;
+
+	if (ioctl(mG2DFd, G2D_CMD_STRETCHBLT, (unsigned long)&blit_para) < 0)
+	{
+		ALOGE("preview callback G2D_CMD_STRETCHBLT failed, callbacks get captured frames");
+		mCallbackScale = false;
+		return NULL;
+	}
+
+	mCallbackFrames++;
+	*size = dst_y_size * 3 / 2;
+	return (const void *)mCallbackBufVir[mCallbackBufferID];
+}
+
 status_t V4L2CameraDevice::stopDevice()
 {
 	ALOGD("stopDevice");
@@ -246,8 +457,14 @@ status_t V4L2CameraDevice::stopDevice()
 	
     V4L2Camera::commonStopDevice();
 
-	// v4l2 device stop stream
+	// the buffers must outlive the pictures being encoded from them
+	mCameraHAL->waitPictureFrames();
+
+	// v4l2 device stop stream, this takes all buffers back from the driver
 	v4l2StopStreaming();
+	zslFlush();
+	resetFrameRefs();
+	mCameraHAL->resetVideoFrames();
 
 	// v4l2 device unmap buffers
     v4l2UnmapBuf();
@@ -265,37 +482,71 @@ status_t V4L2CameraDevice::stopDevice()
 
 bool V4L2CameraDevice::inWorkerThread()
 {
-	/* Wait till FPS timeout expires, or thread exit message is received. */
+	/* Wait till a buffer is ready, or thread exit message is received. */
     WorkerThread::SelectRes res =
-        getWorkerThread()->Select(mCamFd, 2000);
+        getWorkerThread()->Select(mCamFd, 500000);
     if (res == WorkerThread::EXIT_THREAD) {
         ALOGV("%s: Worker thread has been terminated.", __FUNCTION__);
         return false;
     }
-	
-	// get one video frame
-	struct v4l2_buffer buf;
-	memset(&buf, 0, sizeof(v4l2_buffer));
-	int ret = getPreviewFrame(&buf);
-	if (ret != OK)
+	if (res == WorkerThread::ERROR)
 	{
 		usleep(10000);
-		return ret;
+		return true;
+	}
+	
+	// drain every buffer the driver has ready, so that a stall in preview
+	// or JPEG work does not leave frames piling up in the driver
+	struct v4l2_buffer bufs[MAX_NB_BUFFER];
+	int ready = 0;
+	while (ready < mBufferCnt)
+	{
+		memset(&bufs[ready], 0, sizeof(v4l2_buffer));
+		if (getPreviewFrame(&bufs[ready]) != OK)
+		{
+			break;
+		}
+		ready++;
+	}
+
+	if (ready == 0)
+	{
+		return true;
+	}
+
+	updateQueueStats(bufs, ready);
+
+	// only the newest frame is previewed, older ones still go to callbacks
+	for (int i = 0; i < ready; i++)
+	{
+		dealWithVideoFrame(&bufs[i], i == ready - 1);
 	}
 	
+    return true;
+}
+
+void V4L2CameraDevice::dealWithVideoFrame(struct v4l2_buffer * buf, bool preview)
+{
 	/* Timestamp the current frame, and notify the camera HAL about new frame. */
 	// mCurFrameTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
-	mCurFrameTimestamp = (int64_t)((int64_t)buf.timestamp.tv_usec + (((int64_t)buf.timestamp.tv_sec) * 1000000));
+	mCurFrameTimestamp = (int64_t)((int64_t)buf->timestamp.tv_usec + (((int64_t)buf->timestamp.tv_sec) * 1000000));
 
 	// V4L2BUF_t for preview and HW encoder
 	V4L2BUF_t v4l2_buf;
-	v4l2_buf.addrPhyY	= buf.m.offset;
-	v4l2_buf.index		= buf.index;
+	v4l2_buf.addrPhyY	= buf->m.offset;
+	v4l2_buf.index		= buf->index;
 	v4l2_buf.timeStamp	= mCurFrameTimestamp;
 
-	// ALOGV("DQBUF: addrPhyY: %x, id: %d, time: %lld", v4l2_buf.addrPhyY, buf.index, mCurFrameTimestamp);
+	// ALOGV("DQBUF: addrPhyY: %x, id: %d, time: %lld", v4l2_buf.addrPhyY, buf->index, mCurFrameTimestamp);
 
 #define __HW_PICTURE__ 1
+	if (mTakingPicture && !preview && mBurstLeft <= 1)
+	{
+		// the picture is taken from the newest frame
+		releasePreviewFrame(v4l2_buf.index);
+		return ;
+	}
+
 	if (mTakingPicture)
 	{
 		ALOGD("%s, taking picture", __FUNCTION__);
@@ -312,20 +563,30 @@ bool V4L2CameraDevice::inWorkerThread()
 		int64_t nowTime = systemTime() / 1000;
 		ALOGD("%s picture size: %dx%d takes %lld (ms)", (__HW_PICTURE__ == 1) ? "hw" : "sw", 
 			mFrameWidth, mFrameHeight, (nowTime - lastTime) / 1000);
+		pictureQueued(false, 0);
+
+		// the encoder holds its own reference, let the driver refill the
+		// buffer for the next shot of a burst
+		releasePreviewFrame(v4l2_buf.index);
+
+		if (--mBurstLeft > 0)
+		{
+			return ;
+		}
 
 		mTakingPicture = false;
 		mPrepareTakePhoto = false;
-		return true;
+		return ;
 	}
 
 	if (mInPictureThread)
 	{
 		releasePreviewFrame(v4l2_buf.index);
-		return true;
+		return ;
 	}
 
 	// copy for preview
-	if (mPrepareTakePhoto)
+	if (preview && mPrepareTakePhoto)
 	{
 		mPreviewBufferID = (mPreviewBufferID == 0) ? 1 : 0;
 		memcpy((void*)mPreviewBuffer.buf_vir_addr[mPreviewBufferID], (void*)mMapMem.mem[v4l2_buf.index], mMapMem.length);
@@ -336,89 +597,451 @@ bool V4L2CameraDevice::inWorkerThread()
 		pthread_mutex_unlock(&mMutexTakePhoto);
 	}
 
+	if (mZslBufferCnt > 0)
+	{
+		zslPushFrame(&v4l2_buf);
+	}
+
 	if (mCameraHAL->isUseMetaDataBufferMode())
 	{
-		dealWithVideoFrameHW(&v4l2_buf);
+		dealWithVideoFrameHW(&v4l2_buf, preview);
 	}
 	else
 	{
-		dealWithVideoFrameSW(&v4l2_buf);
+		dealWithVideoFrameSW(&v4l2_buf, preview);
+	}
+
+	if (mZslBufferCnt > 0)
+	{
+		zslTakePicture();
+	}
+}
+
+void V4L2CameraDevice::zslPushFrame(V4L2BUF_t * pBuf)
+{
+	// never starve the driver when it granted fewer buffers than asked for
+	int depth = mZslBufferCnt;
+	if (depth > mBufferCnt - 2)
+	{
+		depth = mBufferCnt - 2;
+	}
+	if (depth <= 0)
+	{
+		return ;
+	}
+
+	while (mZslCount >= depth)
+	{
+		// the oldest frame goes back to the driver
+		releasePreviewFrame(mZslRing[mZslHead].index);
+		mZslHead = (mZslHead + 1) % MAX_NB_BUFFER;
+		mZslCount--;
+	}
+
+	acquirePreviewFrame(pBuf->index);
+	mZslRing[(mZslHead + mZslCount) % MAX_NB_BUFFER] = *pBuf;
+	mZslCount++;
+}
+
+void V4L2CameraDevice::zslFlush()
+{
+	// called with the stream off, the driver has taken all buffers back
+	mZslHead = 0;
+	mZslCount = 0;
+
+	Mutex::Autolock locker(&mZslLock);
+	if (mZslPending)
+	{
+		ALOGW("%s: device stopped with a ZSL picture pending", __FUNCTION__);
+		mZslPending = false;
 	}
-	
-    return true;
 }
 
-void V4L2CameraDevice::dealWithVideoFrameHW(V4L2BUF_t * pBuf)
+void V4L2CameraDevice::zslTakePicture()
+{
+	int64_t shutter;
+	{
+		Mutex::Autolock locker(&mZslLock);
+		if (!mZslPending)
+		{
+			return ;
+		}
+		mZslPending = false;
+		shutter = mZslShutterTime;
+	}
+
+	if (mZslCount == 0)
+	{
+		ALOGE("%s: no frame buffered", __FUNCTION__);
+		return ;
+	}
+
+	// this runs on the first frame dequeued after the shutter, so the ring
+	// holds frames from both sides of it
+	int best = mZslHead;
+	int64_t bestOffset = mZslRing[best].timeStamp - shutter;
+	for (int i = 1; i < mZslCount; i++)
+	{
+		int id = (mZslHead + i) % MAX_NB_BUFFER;
+		int64_t offset = mZslRing[id].timeStamp - shutter;
+		if (llabs(offset) < llabs(bestOffset))
+		{
+			best = id;
+			bestOffset = offset;
+		}
+	}
+
+	ALOGD("%s: frame %d, %lld us from shutter", __FUNCTION__, mZslRing[best].index, bestOffset);
+
+	mCameraHAL->onTakingPicture(&mZslRing[best], this, true);
+
+	pictureQueued(true, bestOffset);
+}
+
+status_t V4L2CameraDevice::takeZslPicture()
+{
+	if (!isStarted() || mZslBufferCnt == 0 || mBufferCnt <= 2)
+	{
+		return INVALID_OPERATION;
+	}
+
+	// the CSI driver stamps buffers with do_gettimeofday
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	Mutex::Autolock locker(&mZslLock);
+	mZslShutterTime = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	mZslPending = true;
+
+	return NO_ERROR;
+}
+
+void V4L2CameraDevice::markShutter()
+{
+	Mutex::Autolock locker(&mStatsLock);
+	mShutterTime = systemTime() / 1000;
+}
+
+void V4L2CameraDevice::pictureQueued(bool zsl, int64_t offset)
+{
+	Mutex::Autolock locker(&mStatsLock);
+
+	mPictureStats.lastOffset = offset;
+	mPictureStats.lastZsl = zsl;
+}
+
+void V4L2CameraDevice::endBurst()
+{
+	// the frame being taken is the last one, the stream then runs on as
+	// after a single picture until the client restarts preview
+	mBurstLeft = 1;
+
+	Mutex::Autolock locker(&mStatsLock);
+	mPictureStats.burstsEnded++;
+}
+
+void V4L2CameraDevice::onPictureDelivered()
+{
+	Mutex::Autolock locker(&mStatsLock);
+
+	int64_t now = systemTime() / 1000;
+
+	// sustained rate over a burst, from the first image to the last one
+	if (mBurstCount > 1)
+	{
+		if (mPictureStats.burstShots == 0)
+		{
+			mPictureStats.burstFirstTime = now;
+		}
+		mPictureStats.burstShots++;
+		if (mPictureStats.burstShots == mBurstCount
+			&& now > mPictureStats.burstFirstTime)
+		{
+			float rate = (mBurstCount - 1) * 1000000.0f / (now - mPictureStats.burstFirstTime);
+			mPictureStats.lastBurstCount = mBurstCount;
+			mPictureStats.lastBurstRate = rate;
+			if (rate > mPictureStats.bestBurstRate)
+			{
+				mPictureStats.bestBurstRate = rate;
+			}
+			ALOGD("burst of %d pictures: %.2f shots/s", mBurstCount, rate);
+		}
+	}
+
+	if (mShutterTime == 0)
+	{
+		return ;
+	}
+
+	int64_t latency = now - mShutterTime;
+	mShutterTime = 0;
+
+	mPictureStats.pictures++;
+	if (mPictureStats.lastZsl)
+	{
+		mPictureStats.zslPictures++;
+	}
+	mPictureStats.lastLatency = latency;
+	mPictureStats.sumLatency += latency;
+	if (latency > mPictureStats.maxLatency)
+	{
+		mPictureStats.maxLatency = latency;
+	}
+
+	ALOGD("shutter to picture callback: %lld ms (%s)", latency / 1000, 
+		mPictureStats.lastZsl ? "zsl" : "restart");
+}
+
+void V4L2CameraDevice::updateQueueStats(struct v4l2_buffer * bufs, int ready)
+{
+	Mutex::Autolock locker(&mStatsLock);
+
+	mQueueStats.wakeups++;
+	mQueueStats.frames += ready;
+	mQueueStats.late += ready - 1;
+	mQueueStats.readySum += ready;
+	if ((uint32_t)ready > mQueueStats.readyMax)
+	{
+		mQueueStats.readyMax = ready;
+	}
+
+	// gaps in the driver sequence numbers are frames the driver dropped
+	// because no buffer was queued
+	for (int i = 0; i < ready; i++)
+	{
+		uint32_t seq = bufs[i].sequence;
+		if (mQueueStats.haveSequence && seq > mQueueStats.lastSequence + 1)
+		{
+			mQueueStats.dropped += seq - mQueueStats.lastSequence - 1;
+		}
+		mQueueStats.lastSequence = seq;
+		mQueueStats.haveSequence = true;
+	}
+}
+
+void V4L2CameraDevice::dumpQueueStats(String8 & result)
+{
+	Mutex::Autolock locker(&mStatsLock);
+
+	int held = 0;
+	for (int i = 0; i < mBufferCnt; i++)
+	{
+		if (android_atomic_acquire_load(&mFrameRefs[i]) > 0)
+		{
+			held++;
+		}
+	}
+
+	result.appendFormat("  capture queue: %d buffers (%d configured), %d held by HAL\n",
+		mBufferCnt, mBufferCntConfig, held);
+	result.appendFormat("  frames: %u, dropped in driver: %u, late (not previewed): %u\n",
+		mQueueStats.frames, mQueueStats.dropped, mQueueStats.late);
+	result.appendFormat("  ready per wakeup: avg %.2f, max %u over %u wakeups\n",
+		mQueueStats.wakeups ? (float)mQueueStats.readySum / mQueueStats.wakeups : 0.0f,
+		mQueueStats.readyMax, mQueueStats.wakeups);
+	result.appendFormat("  preview callback: %dx%d, %s, %u frames scaled\n",
+		mCallbackWidth, mCallbackHeight, mCallbackScale ? "G2D" : "capture frames", mCallbackFrames);
+}
+
+void V4L2CameraDevice::dumpPictureStats(String8 & result)
+{
+	Mutex::Autolock locker(&mStatsLock);
+
+	result.appendFormat("  zsl: %s, %d frames buffered of %d\n",
+		mZslBufferCnt > 0 ? "on" : "off", mZslCount, mZslBufferCnt);
+	if (mPictureStats.pictures == 0)
+	{
+		return ;
+	}
+	result.appendFormat("  pictures: %u (%u zsl), shutter to callback: last %lld ms (%s), avg %lld ms, max %lld ms\n",
+		mPictureStats.pictures, mPictureStats.zslPictures,
+		mPictureStats.lastLatency / 1000, mPictureStats.lastZsl ? "zsl" : "restart",
+		mPictureStats.sumLatency / mPictureStats.pictures / 1000,
+		mPictureStats.maxLatency / 1000);
+	if (mPictureStats.lastZsl)
+	{
+		result.appendFormat("  last zsl frame: %lld us from shutter\n", mPictureStats.lastOffset);
+	}
+	if (mPictureStats.lastBurstCount > 0)
+	{
+		result.appendFormat("  last burst: %d pictures, %.2f shots/s sustained (best %.2f)\n",
+			mPictureStats.lastBurstCount, mPictureStats.lastBurstRate, mPictureStats.bestBurstRate);
+	}
+	if (mPictureStats.burstsEnded > 0)
+	{
+		result.appendFormat("  bursts ended early by the client: %u\n", mPictureStats.burstsEnded);
+	}
+}
+
+void V4L2CameraDevice::dealWithVideoFrameHW(V4L2BUF_t * pBuf, bool preview)
 {
 	bool ret = false;
 
 	// preview this buffer
-	if (mPreviewUseHW)
+	if (!preview)
+	{
+		// superseded by a newer frame in the same wakeup
+	}
+	else if (mPreviewUseHW)
 	{
-		ret = mCameraHAL->onNextFramePreview(pBuf, mCurFrameTimestamp, this, true);
+		ret = previewFrameHW(pBuf);
 		if (!ret)
 		{
 			releasePreviewFrame(pBuf->index);
 			mPreviewUseHW = false;
 			return ;
 		}
+		mFrameTrace.mark(pBuf->index, FRAME_STAGE_PREVIEW);
 	}
 	else
 	{
 		if (isPreviewTime())
 		{
-			// copy buffer
-			memcpy(mCurrentFrame, mMapMem.mem[pBuf->index], mMapMem.length); 
-			mCameraHAL->onNextFramePreview(mCurrentFrame, mCurFrameTimestamp, this, false);
+			// SW preview reads the mapped buffer directly
+			mCameraHAL->onNextFramePreview(mMapMem.mem[pBuf->index], mCurFrameTimestamp, this, false);
+			mFrameTrace.mark(pBuf->index, FRAME_STAGE_PREVIEW);
 		}
 	}
 
-	// callback this buffer
+	// callback this buffer, the encoder takes its own reference
 	mCameraHAL->onNextFrameCB(pBuf, mCurFrameTimestamp, this, true);
+	mFrameTrace.mark(pBuf->index, FRAME_STAGE_CALLBACK);
 
-	// release this frame in preview, should be released by app when recording
+	// drop the worker thread reference
 	releasePreviewFrame(pBuf->index);
 }
 
-void V4L2CameraDevice::dealWithVideoFrameSW(V4L2BUF_t * pBuf)
+// shows the frame on the HW layer, through a mirrored copy for the front camera
+bool V4L2CameraDevice::previewFrameHW(V4L2BUF_t * pBuf)
+{
+	if (!mPreviewMirror)
+	{
+		if (!mCameraHAL->onNextFramePreview(pBuf, mCurFrameTimestamp, this, true))
+		{
+			return false;
+		}
+
+		// the layer scans this buffer until the next one is shown
+		acquirePreviewFrame(pBuf->index);
+		if (mPreviewHeldIndex >= 0)
+		{
+			releasePreviewFrame(mPreviewHeldIndex);
+		}
+		mPreviewHeldIndex = pBuf->index;
+		return true;
+	}
+
+	V4L2BUF_t mirror_buf;
+	if (mirrorPreviewFrame(pBuf, &mirror_buf) != OK
+		|| !mCameraHAL->onNextFramePreview(&mirror_buf, mCurFrameTimestamp, this, true))
+	{
+		return false;
+	}
+
+	// the layer scans the copy, no V4L2 buffer is held for it
+	if (mPreviewHeldIndex >= 0)
+	{
+		releasePreviewFrame(mPreviewHeldIndex);
+		mPreviewHeldIndex = -1;
+	}
+	return true;
+}
+
+// G2D copies the frame flipped horizontally into the mirror buffer the
+// layer is not scanning
+int V4L2CameraDevice::mirrorPreviewFrame(V4L2BUF_t * pBuf, V4L2BUF_t * pMirror)
+{
+	if (mG2DFd < 0 || mFrameWidth * mFrameHeight > MAX_PREVIEW_WIDTH * MAX_PREVIEW_HEIGHT)
+	{
+		return -1;
+	}
+
+	mMirrorBufferID = (mMirrorBufferID == 0) ? 1 : 0;
+
+	const unsigned int y_size = mFrameWidth * mFrameHeight;
+	const g2d_pixel_seq seq = (mPixelFormat == V4L2_PIX_FMT_NV21) ? G2D_SEQ_VUVU : G2D_SEQ_NORMAL;
+
+	g2d_blt blit_para;
+	memset(&blit_para, 0, sizeof(blit_para));
+	blit_para.flag					= G2D_BLT_FLIP_HORIZONTAL;
+
+	blit_para.src_image.addr[0]		= pBuf->addrPhyY;
+	blit_para.src_image.addr[1]		= pBuf->addrPhyY + y_size;
+	blit_para.src_image.w			= mFrameWidth;
+	blit_para.src_image.h			= mFrameHeight;
+	blit_para.src_image.format		= G2D_FMT_PYUV420UVC;
+	blit_para.src_image.pixel_seq	= seq;
+
+	blit_para.src_rect.x			= 0;
+	blit_para.src_rect.y			= 0;
+	blit_para.src_rect.w			= mFrameWidth;
+	blit_para.src_rect.h			= mFrameHeight;
+
+	blit_para.dst_image.addr[0]		= mMirrorBufPhy[mMirrorBufferID];
+	blit_para.dst_image.addr[1]		= mMirrorBufPhy[mMirrorBufferID] + y_size;
+	blit_para.dst_image.w			= mFrameWidth;
+	blit_para.dst_image.h			= mFrameHeight;
+	blit_para.dst_image.format		= G2D_FMT_PYUV420UVC;
+	blit_para.dst_image.pixel_seq	= seq;
+
+	blit_para.dst_x					= 0;
+	blit_para.dst_y					= 0;
+
+	if (ioctl(mG2DFd, G2D_CMD_BITBLT, (unsigned long)&blit_para) < 0)
+	{
+		ALOGE("g2d mirror failed, %s", strerror(errno));
+		return -1;
+	}
+
+	pMirror->addrPhyY	= mMirrorBufPhy[mMirrorBufferID];
+	pMirror->index		= pBuf->index;
+	pMirror->timeStamp	= pBuf->timeStamp;
+	return OK;
+}
+
+void V4L2CameraDevice::dealWithVideoFrameSW(V4L2BUF_t * pBuf, bool preview)
 {
 	bool ret = false;
-	
-	// copy buffer
-	memcpy(mCurrentFrame, mMapMem.mem[pBuf->index], mMapMem.length); 
+
+	// consumers read the mapped buffer directly, those who need to own the
+	// frame (app callbacks) copy it themselves
+	const void * frame = mMapMem.mem[pBuf->index];
 
 	// preview this buffer
-	if (mPreviewUseHW)
+	if (!preview)
+	{
+		// superseded by a newer frame in the same wakeup
+	}
+	else if (mPreviewUseHW)
 	{
-		ret = mCameraHAL->onNextFramePreview(pBuf, mCurFrameTimestamp, this, true);
+		ret = previewFrameHW(pBuf);
 		if (!ret)
 		{
 			releasePreviewFrame(pBuf->index);
 			mPreviewUseHW = false;
 			return ;
 		}
+		mFrameTrace.mark(pBuf->index, FRAME_STAGE_PREVIEW);
 	}
 	else
 	{
 		if (isPreviewTime())
 		{			
-			mCameraHAL->onNextFramePreview(mCurrentFrame, mCurFrameTimestamp, this, false);
+			mCameraHAL->onNextFramePreview(frame, mCurFrameTimestamp, this, false);
+			mFrameTrace.mark(pBuf->index, FRAME_STAGE_PREVIEW);
 		}
 	}
 
 	// callback this buffer
-	mCameraHAL->onNextFrameCB(mCurrentFrame, mCurFrameTimestamp, this, false);
+	mCameraHAL->onNextFrameCB(frame, mCurFrameTimestamp, this, false);
+	mFrameTrace.mark(pBuf->index, FRAME_STAGE_CALLBACK);
 
 	releasePreviewFrame(pBuf->index);
 }
 
 void V4L2CameraDevice::dealWithVideoFrameTest(V4L2BUF_t * pBuf)
 {
-	// copy buffer
-	memcpy(mCurrentFrame, mMapMem.mem[pBuf->index], mMapMem.length); 
-	// mCurrentFrame = (uint8_t*)mMapMem.mem[pBuf->index];
-	// ALOGV("mCurrentFrame: %x", mCurrentFrame);
-	mCameraHAL->onNextFrameAvailable(mCurrentFrame, mCurFrameTimestamp, this, false);
+	mCameraHAL->onNextFrameAvailable(mMapMem.mem[pBuf->index], mCurFrameTimestamp, this, false);
 
 	releasePreviewFrame(pBuf->index);
 }
@@ -429,11 +1052,14 @@ void V4L2CameraDevice::dealWithVideoFrameTest(V4L2BUF_t * pBuf)
 int V4L2CameraDevice::openCameraDev()
 {
 	// open V4L2 device
-	mCamFd = open(mDeviceName, O_RDWR | O_NONBLOCK, 0);
+	mBackend = CaptureBackend::create(mDeviceName);
+	mCamFd = mBackend->open(mDeviceName, O_RDWR | O_NONBLOCK);
 
 	if (mCamFd == -1) 
 	{ 
         ALOGE("ERROR opening V4L interface: %s", strerror(errno)); 
+		delete mBackend;
+		mBackend = NULL;
 		return -1; 
 	} 
 
@@ -441,7 +1067,7 @@ int V4L2CameraDevice::openCameraDev()
 	{
 		struct v4l2_input inp;
 		inp.index = 1;
-		if (-1 == ioctl (mCamFd, VIDIOC_S_INPUT, &inp))
+		if (-1 == mBackend->ioctl(VIDIOC_S_INPUT, &inp))
 		{
 			ALOGE("VIDIOC_S_INPUT error!\n");
 			return -1;
@@ -451,7 +1077,7 @@ int V4L2CameraDevice::openCameraDev()
 	// check v4l2 device capabilities
 	int ret = -1;
 	struct v4l2_capability cap; 
-	ret = ioctl (mCamFd, VIDIOC_QUERYCAP, &cap); 
+	ret = mBackend->ioctl(VIDIOC_QUERYCAP, &cap); 
 
     if (ret < 0) 
 	{ 
@@ -478,9 +1104,11 @@ void V4L2CameraDevice::closeCameraDev()
 {
 	F_LOG;
 	
-	if (mCamFd != 0)
+	if (mBackend != NULL)
 	{
-		close(mCamFd);
+		mBackend->close();
+		delete mBackend;
+		mBackend = NULL;
 		mCamFd = 0;
 	}
 }
@@ -500,7 +1128,7 @@ int V4L2CameraDevice::v4l2SetVideoParams(int width, int height, uint32_t pix_fmt
     format.fmt.pix.pixelformat = pix_fmt; 
 	format.fmt.pix.field = V4L2_FIELD_NONE;
 	
-	ret = ioctl(mCamFd, VIDIOC_S_FMT, &format); 
+	ret = mBackend->ioctl(VIDIOC_S_FMT, &format); 
 	if (ret < 0) 
 	{ 
 		ALOGE("VIDIOC_S_FMT Failed: %s", strerror(errno)); 
@@ -523,11 +1151,17 @@ int V4L2CameraDevice::v4l2ReqBufs()
 
 	if (mTakingPicture)
 	{
-		mBufferCnt = 2;
+		// a burst keeps the encoder queue and the driver busy at once
+		mBufferCnt = (mBurstCount > 1) ? mBufferCntConfig : 2;
 	}
 	else
 	{
-		mBufferCnt = NB_BUFFER;
+		// the ZSL ring keeps its frames out of the driver queue
+		mBufferCnt = mBufferCntConfig + mZslBufferCnt;
+		if (mBufferCnt > MAX_NB_BUFFER)
+		{
+			mBufferCnt = MAX_NB_BUFFER;
+		}
 	}
 
 	ALOGD("TO VIDIOC_REQBUFS count: %d", mBufferCnt);
@@ -537,19 +1171,25 @@ int V4L2CameraDevice::v4l2ReqBufs()
     rb.memory = V4L2_MEMORY_MMAP; 
     rb.count  = mBufferCnt; 
 	
-	ret = ioctl(mCamFd, VIDIOC_REQBUFS, &rb); 
+	ret = mBackend->ioctl(VIDIOC_REQBUFS, &rb); 
     if (ret < 0) 
 	{ 
         ALOGE("Init: VIDIOC_REQBUFS failed: %s", strerror(errno)); 
 		return ret;
     } 
 
-	if (mBufferCnt != rb.count)
+	if (mBufferCnt != (int)rb.count)
 	{
 		mBufferCnt = rb.count;
 		ALOGD("VIDIOC_REQBUFS count: %d", mBufferCnt);
 	}
 
+	if (mBufferCnt > MAX_NB_BUFFER)
+	{
+		ALOGW("driver allocated %d buffers, using %d", mBufferCnt, MAX_NB_BUFFER);
+		mBufferCnt = MAX_NB_BUFFER;
+	}
+
 	return OK;
 }
 
@@ -558,6 +1198,8 @@ int V4L2CameraDevice::v4l2QueryBuf()
 	F_LOG;
 	int ret = UNKNOWN_ERROR;
 	struct v4l2_buffer buf;
+
+	resetFrameRefs();
 	
 	for (int i = 0; i < mBufferCnt; i++) 
 	{  
@@ -566,18 +1208,15 @@ int V4L2CameraDevice::v4l2QueryBuf()
 		buf.memory = V4L2_MEMORY_MMAP; 
 		buf.index  = i; 
 		
-		ret = ioctl (mCamFd, VIDIOC_QUERYBUF, &buf); 
+		ret = mBackend->ioctl(VIDIOC_QUERYBUF, &buf); 
         if (ret < 0) 
 		{ 
             ALOGE("Unable to query buffer (%s)", strerror(errno)); 
             return ret; 
         } 
  
-        mMapMem.mem[i] = mmap (0, buf.length, 
-                            PROT_READ | PROT_WRITE, 
-                            MAP_SHARED, 
-                            mCamFd, 
-                            buf.m.offset); 
+        mMapMem.mem[i] = mBackend->mmap(buf.length, buf.m.offset); 
+		mMapMem.phy[i] = buf.m.offset;
 		mMapMem.length = buf.length;
 		ALOGV("index: %d, mem: %x, len: %x, offset: %x", i, (int)mMapMem.mem[i], buf.length, buf.m.offset);
  
@@ -588,7 +1227,7 @@ int V4L2CameraDevice::v4l2QueryBuf()
         } 
 
 		// start with all buffers in queue
-        ret = ioctl(mCamFd, VIDIOC_QBUF, &buf); 
+        ret = mBackend->ioctl(VIDIOC_QBUF, &buf); 
         if (ret < 0) 
 		{ 
             ALOGE("VIDIOC_QBUF Failed"); 
@@ -605,7 +1244,7 @@ int V4L2CameraDevice::v4l2StartStreaming()
 	int ret = UNKNOWN_ERROR; 
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE; 
 	
-  	ret = ioctl (mCamFd, VIDIOC_STREAMON, &type); 
+  	ret = mBackend->ioctl(VIDIOC_STREAMON, &type); 
 	if (ret < 0) 
 	{ 
 		ALOGE("StartStreaming: Unable to start capture: %s", strerror(errno)); 
@@ -621,7 +1260,7 @@ int V4L2CameraDevice::v4l2StopStreaming()
 	int ret = UNKNOWN_ERROR; 
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE; 
 	
-	ret = ioctl (mCamFd, VIDIOC_STREAMOFF, &type); 
+	ret = mBackend->ioctl(VIDIOC_STREAMOFF, &type); 
 	if (ret < 0) 
 	{ 
 		ALOGE("StopStreaming: Unable to stop capture: %s", strerror(errno)); 
@@ -639,7 +1278,7 @@ int V4L2CameraDevice::v4l2UnmapBuf()
 	
 	for (int i = 0; i < mBufferCnt; i++) 
 	{
-		ret = munmap(mMapMem.mem[i], mMapMem.length);
+		ret = mBackend->munmap(mMapMem.mem[i], mMapMem.length);
         if (ret < 0) 
 		{
             ALOGE("v4l2CloseBuf Unmap failed"); 
@@ -650,7 +1289,58 @@ int V4L2CameraDevice::v4l2UnmapBuf()
 	return OK;
 }
 
+void V4L2CameraDevice::resetFrameRefs()
+{
+	for (int i = 0; i < MAX_NB_BUFFER; i++)
+	{
+		android_atomic_release_store(0, &mFrameRefs[i]);
+	}
+	mPreviewHeldIndex = -1;
+	mFrameTrace.reset();
+}
+
+void V4L2CameraDevice::acquirePreviewFrame(int index)
+{
+	if (index < 0 || index >= mBufferCnt)
+	{
+		ALOGE("%s: invalid buffer index %d", __FUNCTION__, index);
+		return ;
+	}
+	android_atomic_inc(&mFrameRefs[index]);
+}
+
 void V4L2CameraDevice::releasePreviewFrame(int index)
+{
+	if (index < 0 || index >= mBufferCnt)
+	{
+		ALOGE("%s: invalid buffer index %d", __FUNCTION__, index);
+		return ;
+	}
+
+	// late releases after the stream has been stopped find the count at zero
+	int32_t refs = android_atomic_acquire_load(&mFrameRefs[index]);
+	while (refs > 0)
+	{
+		if (android_atomic_release_cas(refs, refs - 1, &mFrameRefs[index]) == 0)
+		{
+			if (refs == 1)
+			{
+				mFrameTrace.mark(index, FRAME_STAGE_RELEASE);
+				v4l2QBuf(index);
+			}
+			return ;
+		}
+		refs = android_atomic_acquire_load(&mFrameRefs[index]);
+	}
+	ALOGW("%s: buffer %d is not held", __FUNCTION__, index);
+}
+
+int V4L2CameraDevice::getBufferCount()
+{
+	return mBufferCnt;
+}
+
+int V4L2CameraDevice::v4l2QBuf(int index)
 {
 	int ret = UNKNOWN_ERROR;
 	struct v4l2_buffer buf;
@@ -661,13 +1351,13 @@ void V4L2CameraDevice::releasePreviewFrame(int index)
 	buf.index = index;
 	
 	// ALOGV("r ID: %d", buf.index);
-    ret = ioctl(mCamFd, VIDIOC_QBUF, &buf); 
+    ret = mBackend->ioctl(VIDIOC_QBUF, &buf); 
     if (ret != 0) 
 	{
-		// comment for temp, to do
-        // ALOGE("releasePreviewFrame: VIDIOC_QBUF Failed: index = %d, ret = %d, %s", 
-		//	buf.index, ret, strerror(errno)); 
+        ALOGE("v4l2QBuf: VIDIOC_QBUF Failed: index = %d, ret = %d, %s", 
+			buf.index, ret, strerror(errno)); 
     }
+	return ret;
 }
 
 int V4L2CameraDevice::getPreviewFrame(v4l2_buffer *buf)
@@ -677,13 +1367,17 @@ int V4L2CameraDevice::getPreviewFrame(v4l2_buffer *buf)
 	buf->type   = V4L2_BUF_TYPE_VIDEO_CAPTURE; 
     buf->memory = V4L2_MEMORY_MMAP; 
  
-    ret = ioctl(mCamFd, VIDIOC_DQBUF, buf); 
+    ret = mBackend->ioctl(VIDIOC_DQBUF, buf); 
     if (ret < 0) 
 	{ 
         // ALOGE("GetPreviewFrame: VIDIOC_DQBUF Failed"); 
         return __LINE__; 			// can not return false
     }
 
+	// the caller (worker thread) holds the first reference
+	android_atomic_release_store(1, &mFrameRefs[buf->index]);
+	mFrameTrace.mark(buf->index, FRAME_STAGE_DEQUEUE);
+
 	return OK;
 }
 
@@ -702,7 +1396,7 @@ int V4L2CameraDevice::tryFmtSize(int * width, int * height)
     fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_NV12; 
 	fmt.fmt.pix.field = V4L2_FIELD_NONE;
 
-	ret = ioctl(mCamFd, VIDIOC_TRY_FMT, &fmt); 
+	ret = mBackend->ioctl(VIDIOC_TRY_FMT, &fmt); 
 	if (ret < 0) 
 	{ 
 		ALOGE("VIDIOC_TRY_FMT Failed: %s", strerror(errno)); 
@@ -725,7 +1419,7 @@ int V4L2CameraDevice::setV4L2DeviceName(char * pname)
 		return UNKNOWN_ERROR;
 	}
 
-	strncpy(mDeviceName, pname, strlen(pname));
+	strncpy(mDeviceName, pname, sizeof(mDeviceName) - 1);
 	ALOGV("%s: %s", __FUNCTION__, mDeviceName);
 
 	return OK;
@@ -747,7 +1441,7 @@ int V4L2CameraDevice::getFrameRate()
 	struct v4l2_streamparm parms;
 	parms.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	ret = ioctl (mCamFd, VIDIOC_G_PARM, &parms);
+	ret = mBackend->ioctl(VIDIOC_G_PARM, &parms);
 	if (ret < 0) 
 	{
 		ALOGE("VIDIOC_G_PARM getFrameRate error\n");
@@ -762,6 +1456,53 @@ int V4L2CameraDevice::getFrameRate()
 	return denominator / numerator;
 }
 
+int V4L2CameraDevice::setBufferCount(int count)
+{
+	if (count < 2 || count > MAX_NB_BUFFER)
+	{
+		ALOGW("%s: invalid buffer count %d, using %d", __FUNCTION__, count, NB_BUFFER);
+		count = NB_BUFFER;
+	}
+	mBufferCntConfig = count;
+
+	return OK;
+}
+
+int V4L2CameraDevice::setBurstCount(int count)
+{
+	if (isStarted())
+	{
+		ALOGE("%s: device is started", __FUNCTION__);
+		return INVALID_OPERATION;
+	}
+
+	mBurstCount = (count > 1) ? count : 1;
+	mBurstLeft = mBurstCount;
+
+	Mutex::Autolock locker(&mStatsLock);
+	mPictureStats.burstShots = 0;
+
+	return OK;
+}
+
+int V4L2CameraDevice::setZslBufferCount(int count)
+{
+	if (isStarted())
+	{
+		ALOGE("%s: device is started", __FUNCTION__);
+		return INVALID_OPERATION;
+	}
+
+	// leave at least two buffers for the driver and the preview
+	if (count > MAX_NB_BUFFER - 2)
+	{
+		count = MAX_NB_BUFFER - 2;
+	}
+	mZslBufferCnt = (count > 0) ? count : 0;
+
+	return OK;
+}
+
 int V4L2CameraDevice::setCameraFacing(int facing)
 {
 	mCameraFacing = facing;
@@ -777,7 +1518,7 @@ int V4L2CameraDevice::setImageEffect(int effect)
 
 	ctrl.id = V4L2_CID_COLORFX;
 	ctrl.value = effect;
-	ret = ioctl(mCamFd, VIDIOC_S_CTRL, &ctrl);
+	ret = mBackend->ioctl(VIDIOC_S_CTRL, &ctrl);
 	if (ret < 0)
 		ALOGV("setImageEffect failed!");
 	else 
@@ -793,7 +1534,7 @@ int V4L2CameraDevice::setWhiteBalance(int wb)
 
 	ctrl.id = V4L2_CID_DO_WHITE_BALANCE;
 	ctrl.value = wb;
-	ret = ioctl(mCamFd, VIDIOC_S_CTRL, &ctrl);
+	ret = mBackend->ioctl(VIDIOC_S_CTRL, &ctrl);
 	if (ret < 0)
 		ALOGV("setWhiteBalance failed!");
 	else 
@@ -810,7 +1551,7 @@ int V4L2CameraDevice::setExposure(int exp)
 
 	ctrl.id = V4L2_CID_EXPOSURE;
 	ctrl.value = exp;
-	ret = ioctl(mCamFd, VIDIOC_S_CTRL, &ctrl);
+	ret = mBackend->ioctl(VIDIOC_S_CTRL, &ctrl);
 	if (ret < 0)
 		ALOGV("setExposure failed!");
 	else 
@@ -828,7 +1569,7 @@ int V4L2CameraDevice::setFlashMode(int mode)
 
 	ctrl.id = V4L2_CID_CAMERA_FLASH_MODE;
 	ctrl.value = mode;
-	ret = ioctl(mCamFd, VIDIOC_S_CTRL, &ctrl);
+	ret = mBackend->ioctl(VIDIOC_S_CTRL, &ctrl);
 	if (ret < 0)
 		ALOGV("setFlashMode failed!");
 	else 
@@ -837,6 +1578,59 @@ int V4L2CameraDevice::setFlashMode(int mode)
 	return ret;
 }
 
+int V4L2CameraDevice::startAutoFocus()
+{
+	struct v4l2_control ctrl;
+
+	ctrl.id = V4L2_CID_AUTO_FOCUS_START;
+	ctrl.value = 0;
+	int ret = mBackend->ioctl(VIDIOC_S_CTRL, &ctrl);
+	if (ret < 0)
+		ALOGV("startAutoFocus failed!");
+
+	return ret;
+}
+
+int V4L2CameraDevice::stopAutoFocus()
+{
+	struct v4l2_control ctrl;
+
+	ctrl.id = V4L2_CID_AUTO_FOCUS_STOP;
+	ctrl.value = 0;
+	int ret = mBackend->ioctl(VIDIOC_S_CTRL, &ctrl);
+	if (ret < 0)
+		ALOGV("stopAutoFocus failed!");
+
+	return ret;
+}
+
+int V4L2CameraDevice::getAutoFocusStatus()
+{
+	struct v4l2_control ctrl;
+
+	ctrl.id = V4L2_CID_AUTO_FOCUS_STATUS;
+	ctrl.value = 0;
+	if (mBackend->ioctl(VIDIOC_G_CTRL, &ctrl) < 0)
+	{
+		return -1;
+	}
+
+	return ctrl.value;
+}
+
+int V4L2CameraDevice::setContinuousAutoFocus(bool enable)
+{
+	struct v4l2_control ctrl;
+
+	ctrl.id = V4L2_CID_FOCUS_AUTO;
+	ctrl.value = enable ? 1 : 0;
+	int ret = mBackend->ioctl(VIDIOC_S_CTRL, &ctrl);
+	if (ret < 0)
+		ALOGV("setContinuousAutoFocus failed!");
+
+	return ret;
+}
+
 
 bool V4L2CameraDevice::isPreviewTime()
 {
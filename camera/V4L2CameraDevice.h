@@ -22,14 +22,27 @@
  * a fake camera device.
  */
 
+#include <utils/String8.h>
 #include "Converters.h"
 #include "V4L2Camera.h"
+#include "CaptureBackend.h"
 #include <type_camera.h>
 
 // preview size should not larger than 1280x720
 #define MAX_PREVIEW_WIDTH	1280
 #define MAX_PREVIEW_HEIGHT	720
 
+// auto focus controls of mainline V4L2, not in the kernel header yet
+#ifndef V4L2_CID_AUTO_FOCUS_START
+#define V4L2_CID_AUTO_FOCUS_START		(V4L2_CID_CAMERA_CLASS_BASE+28)
+#define V4L2_CID_AUTO_FOCUS_STOP		(V4L2_CID_CAMERA_CLASS_BASE+29)
+#define V4L2_CID_AUTO_FOCUS_STATUS		(V4L2_CID_CAMERA_CLASS_BASE+30)
+#define V4L2_AUTO_FOCUS_STATUS_IDLE		(0 << 0)
+#define V4L2_AUTO_FOCUS_STATUS_BUSY		(1 << 0)
+#define V4L2_AUTO_FOCUS_STATUS_REACHED	(1 << 1)
+#define V4L2_AUTO_FOCUS_STATUS_FAILED	(1 << 2)
+#endif
+
 namespace android {
 
 class CameraHardwareDevice;
@@ -102,13 +115,26 @@ public:
 	int tryFmtSize(int * width, int * height); // check if driver support this size
 	int getFrameRate(); // get v4l2 device current frame rate
 	int setCameraFacing(int facing);
+	int setBufferCount(int count); // V4L2 buffer queue depth, from camera.cfg
+	int setZslBufferCount(int count); // frames kept for zero shutter lag, 0 to disable
+	int setBurstCount(int count); // consecutive frames encoded by the next picture
 
 	int setImageEffect(int effect);
 	int setWhiteBalance(int wb);
 	int setExposure(int exp);
 	int setFlashMode(int mode);
+	int startAutoFocus(); // one scan, the lens stops when it is done
+	int stopAutoFocus();
+	int getAutoFocusStatus(); // V4L2_AUTO_FOCUS_STATUS_xxx, -1 without AF
+	int setContinuousAutoFocus(bool enable);
 	
-	void releasePreviewFrame(int index); // Q buffer for encoder
+	void acquirePreviewFrame(int index); // take a reference on a DQ'ed buffer
+	void releasePreviewFrame(int index); // drop a reference, Q buffer on the last one
+	int getBufferCount(); // buffers granted by the driver
+	int setPreviewCallbackFormat(int width, int height, uint32_t pix_fmt); // size and format apps get
+	const void * getPreviewCallbackFrame(const void * frame, int * size);
+	void onPictureDelivered(); // compressed image delivered, for shutter latency
+	void endBurst(); // last shot of the burst, worker thread only
 	
 	inline void prepareTakePhoto(bool prepare)
 	{
@@ -116,6 +142,23 @@ public:
 	}
 	
 	void waitPrepareTakePhoto();
+
+	inline bool isZslMode()
+	{
+		return mZslBufferCnt > 0;
+	}
+
+	// picks the buffered frame closest to now for the next picture
+	status_t takeZslPicture();
+
+	// shutter time for the picture latency statistics
+	void markShutter();
+
+	// appends capture queue statistics for dumpCamera
+	void dumpQueueStats(String8 & result);
+
+	// appends picture latency statistics for dumpCamera
+	void dumpPictureStats(String8 & result);
 	
 private:
 	int openCameraDev();
@@ -128,9 +171,21 @@ private:
 	int v4l2UnmapBuf();
 	
 	int getPreviewFrame(v4l2_buffer *buf);
+	int v4l2QBuf(int index);
+	void resetFrameRefs();
 	
-	void dealWithVideoFrameSW(V4L2BUF_t * pBuf);
-	void dealWithVideoFrameHW(V4L2BUF_t * pBuf);
+	void dealWithVideoFrame(struct v4l2_buffer * buf, bool preview);
+	void dealWithVideoFrameSW(V4L2BUF_t * pBuf, bool preview);
+	void dealWithVideoFrameHW(V4L2BUF_t * pBuf, bool preview);
+	bool previewFrameHW(V4L2BUF_t * pBuf);
+	int mirrorPreviewFrame(V4L2BUF_t * pBuf, V4L2BUF_t * pMirror);
+	void setupPreviewCallbackScale(uint32_t pix_fmt);
+	void updateQueueStats(struct v4l2_buffer * bufs, int ready);
+	void pictureQueued(bool zsl, int64_t offset);
+
+	void zslPushFrame(V4L2BUF_t * pBuf);
+	void zslFlush();
+	void zslTakePicture();
 	void dealWithVideoFrameTest(V4L2BUF_t * pBuf);
 	
 	/* Checks if it's the time to push new frame to the preview window.
@@ -149,14 +204,18 @@ private:
 	// v4l2 device handle
 	int mCamFd; 
 
-	// device node name
-	char mDeviceName[16];
+	// forwards the v4l2 ioctls to the video node, or replays a file
+	CaptureBackend * mBackend;
+
+	// device node name, or "file:<path>[@fps]"
+	char mDeviceName[64];
 
 	// device id on the CSI, used when two camera device shared with one CSI
 	int mDeviceID;
 
 	typedef struct v4l2_mem_map_t{
-		void *	mem[NB_BUFFER]; 
+		void *	mem[MAX_NB_BUFFER]; 
+		int		phy[MAX_NB_BUFFER];		// physical address, from VIDIOC_QUERYBUF
 		int 	length;
 	}
 
@@ -166,11 +225,42 @@ private:
 	// actually buffer counts
 	int mBufferCnt;
 
+	// buffer counts requested for preview, set from camera.cfg
+	int mBufferCntConfig;
+
+	// references held on each DQ'ed buffer, the buffer is Q'ed again
+	// when the count drops to zero
+	volatile int32_t mFrameRefs[MAX_NB_BUFFER];
+
+	// buffer currently shown by the HW preview layer, -1 for none
+	int mPreviewHeldIndex;
+
 	// camera facing back / front
 	int mCameraFacing;
 
 	// HW preview failed, should use SW preview
 	bool mPreviewUseHW;
+
+	// front camera HW preview, G2D mirrors each frame into a copy that
+	// the layer scans, the V4L2 buffer goes back to the driver at once
+	bool mPreviewMirror;
+	int mG2DFd;
+	int mMirrorBufVir[2];
+	int mMirrorBufPhy[2];
+	int mMirrorBufferID;
+
+	// preview callback frames, scaled and converted by G2D into a pair of
+	// pooled buffers when the app asks for another size or format than
+	// the capture
+	int mCallbackWidth;
+	int mCallbackHeight;
+	uint32_t mCallbackFormat;		// V4L2_PIX_FMT_NV21 or V4L2_PIX_FMT_YVU420, 0 for none
+	bool mCallbackScale;
+	int mCallbackBufVir[2];
+	int mCallbackBufPhy[2];
+	int mCallbackBufLen;
+	int mCallbackBufferID;
+	uint32_t mCallbackFrames;		// frames scaled by G2D
 	
 	/* Timestamp (abs. microseconds) when last frame has been pushed to the
 	* preview window. */
@@ -194,6 +284,59 @@ private:
 	bufferManagerQ_t				mPreviewBuffer;
 	pthread_mutex_t					mMutexTakePhoto;
 	pthread_cond_t					mCondTakePhoto;
+
+	// capture queue statistics
+	typedef struct queueStats_t
+	{
+		uint32_t	frames;			// buffers dequeued
+		uint32_t	dropped;		// frames lost in the driver (sequence gaps)
+		uint32_t	late;			// frames superseded before they could be previewed
+		uint32_t	wakeups;		// worker thread wakeups with at least one buffer
+		uint32_t	readySum;		// buffers ready, summed over wakeups
+		uint32_t	readyMax;		// most buffers ready in one wakeup
+		uint32_t	lastSequence;
+		bool		haveSequence;
+	}
+
+	queueStats_t;
+	queueStats_t					mQueueStats;
+	Mutex							mStatsLock;
+
+	// zero shutter lag: the newest frames stay dequeued, each ring entry
+	// holds a reference on its V4L2 buffer until a newer frame pushes it out
+	int								mZslBufferCnt;
+	V4L2BUF_t						mZslRing[MAX_NB_BUFFER];
+	int								mZslHead;		// oldest frame
+	int								mZslCount;
+	bool							mZslPending;
+	int64_t							mZslShutterTime;	// v4l2 timestamp clock, us
+	Mutex							mZslLock;
+
+	// shutter to compressed image callback
+	typedef struct pictureStats_t
+	{
+		uint32_t	pictures;
+		uint32_t	zslPictures;
+		int64_t		lastLatency;	// us
+		int64_t		maxLatency;
+		int64_t		sumLatency;
+		int64_t		lastOffset;		// ZSL frame time - shutter time, us
+		bool		lastZsl;
+		int			burstShots;		// images delivered in the current burst
+		int64_t		burstFirstTime;	// first image of the current burst, us
+		int			lastBurstCount;
+		float		lastBurstRate;	// shots per second
+		float		bestBurstRate;
+		uint32_t	burstsEnded;	// stopped early by the client
+	}
+
+	pictureStats_t;
+	pictureStats_t					mPictureStats;
+	int64_t							mShutterTime;	// monotonic, us
+
+	// burst capture, pictures requested and left to take
+	int								mBurstCount;
+	int								mBurstLeft;
 };
 
 }; /* namespace android */
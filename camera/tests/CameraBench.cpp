@@ -0,0 +1,426 @@
+/*
+ * Headless benchmark of the camera HAL.
+ *
+ * Loads the camera module as cameraservice does, and runs a preview, a
+ * recording and a picture sequence with no preview window. Point the camera's
+ * camera_device in camera.cfg at "file:<path>[@fps]" to run it on replayed
+ * frames (see FileCaptureBackend), or leave it on the sensor.
+ *
+ * For each sequence it prints latency percentiles of what a client sees:
+ * preview callback intervals, capture to video callback latency, and
+ * takePicture to shutter and to compressed image. Then process CPU time over
+ * the sequence, and the HAL dump, with the per-stage frame trace histograms
+ * (debug.camera.trace is set to 1).
+ *
+ * usage: camera_bench [-c id] [-p preview s] [-r record s] [-n pictures]
+ *                     [-s WxH]
+ */
+
+#define LOG_TAG "CameraBench"
+#include <cutils/log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <cutils/properties.h>
+#include <hardware/hardware.h>
+#include <hardware/camera.h>
+#include <camera/CameraParameters.h>
+#include <utils/threads.h>
+
+using namespace android;
+
+#define MAX_SAMPLES		4096
+
+/****************************************************************************
+ * Samples and percentiles.
+ ***************************************************************************/
+
+struct samples_t
+{
+	const char *	name;
+	int				count;
+	int64_t			value[MAX_SAMPLES];		// us
+};
+
+static void addSample(samples_t * s, int64_t us)
+{
+	if (s->count < MAX_SAMPLES)
+	{
+		s->value[s->count++] = us;
+	}
+}
+
+static int compareSample(const void * a, const void * b)
+{
+	int64_t d = *(const int64_t *)a - *(const int64_t *)b;
+	return (d > 0) - (d < 0);
+}
+
+// nearest rank
+static int64_t percentile(const samples_t * s, int p)
+{
+	int rank = (s->count * p + 99) / 100;
+	if (rank < 1)
+	{
+		rank = 1;
+	}
+	return s->value[rank - 1];
+}
+
+static void printSamples(samples_t * s)
+{
+	if (s->count == 0)
+	{
+		printf("  %-28s no samples\n", s->name);
+		return ;
+	}
+
+	qsort(s->value, s->count, sizeof(s->value[0]), compareSample);
+	printf("  %-28s n %5d  p50 %7lld  p90 %7lld  p99 %7lld  max %7lld us\n",
+		s->name, s->count,
+		percentile(s, 50), percentile(s, 90), percentile(s, 99),
+		s->value[s->count - 1]);
+}
+
+static int64_t monotonicUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t cpuUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// the HAL stamps frames with the capture gettimeofday(), in us
+static int64_t realtimeUs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/****************************************************************************
+ * Callbacks.
+ ***************************************************************************/
+
+// the callback heaps the HAL asks for, on the process heap
+typedef struct benchMemory_t
+{
+	camera_memory_t		mem;
+	size_t				bufSize;
+}
+
+benchMemory_t;
+
+static Mutex			gLock;
+static Condition		gPictureDone;
+static camera_device_t*	gDevice = NULL;
+
+static samples_t		gPreviewInterval	= { "preview callback interval" };
+static samples_t		gVideoLatency		= { "capture to video callback" };
+static samples_t		gShutterLatency		= { "takePicture to shutter" };
+static samples_t		gJpegLatency		= { "takePicture to jpeg" };
+
+static int64_t			gLastPreview = 0;
+static int64_t			gPictureStart = 0;
+static bool				gPictureTaken = false;
+static int				gPreviewFrames = 0;
+static int				gVideoFrames = 0;
+
+static void releaseMemory(camera_memory_t * mem)
+{
+	free(mem->data);
+	free(mem);
+}
+
+static camera_memory_t * getMemory(int fd, size_t buf_size, unsigned int num_bufs, void * user)
+{
+	benchMemory_t * m = (benchMemory_t *)malloc(sizeof(benchMemory_t));
+	if (m == NULL)
+	{
+		return NULL;
+	}
+
+	m->mem.data = malloc(buf_size * num_bufs);
+	if (m->mem.data == NULL)
+	{
+		free(m);
+		return NULL;
+	}
+	m->mem.size = buf_size * num_bufs;
+	m->mem.handle = NULL;
+	m->mem.release = releaseMemory;
+	m->bufSize = buf_size;
+
+	return &m->mem;
+}
+
+static void notifyCallback(int32_t msg_type, int32_t ext1, int32_t ext2, void * user)
+{
+	Mutex::Autolock locker(&gLock);
+	if (msg_type == CAMERA_MSG_SHUTTER && gPictureStart != 0)
+	{
+		addSample(&gShutterLatency, monotonicUs() - gPictureStart);
+	}
+	else if (msg_type == CAMERA_MSG_ERROR)
+	{
+		ALOGE("camera error %d", ext1);
+	}
+}
+
+static void dataCallback(int32_t msg_type, const camera_memory_t * data, unsigned int index,
+						 camera_frame_metadata_t * metadata, void * user)
+{
+	Mutex::Autolock locker(&gLock);
+	int64_t now = monotonicUs();
+
+	if (msg_type == CAMERA_MSG_PREVIEW_FRAME)
+	{
+		if (gLastPreview != 0)
+		{
+			addSample(&gPreviewInterval, now - gLastPreview);
+		}
+		gLastPreview = now;
+		gPreviewFrames++;
+	}
+	else if (msg_type == CAMERA_MSG_COMPRESSED_IMAGE && gPictureStart != 0)
+	{
+		addSample(&gJpegLatency, now - gPictureStart);
+		gPictureStart = 0;
+		gPictureTaken = true;
+		gPictureDone.signal();
+	}
+}
+
+static void dataTimestampCallback(int64_t timestamp, int32_t msg_type,
+								  const camera_memory_t * data, unsigned int index, void * user)
+{
+	if (msg_type != CAMERA_MSG_VIDEO_FRAME)
+	{
+		return ;
+	}
+
+	{
+		Mutex::Autolock locker(&gLock);
+		addSample(&gVideoLatency, realtimeUs() - timestamp);
+		gVideoFrames++;
+	}
+
+	// an encoder that takes no time
+	const benchMemory_t * m = (const benchMemory_t *)data;
+	gDevice->ops->release_recording_frame(gDevice,
+		(const uint8_t *)data->data + index * m->bufSize);
+}
+
+/****************************************************************************
+ * Sequences.
+ ***************************************************************************/
+
+static int64_t gSeqStart;
+static int64_t gSeqCpu;
+
+static void beginSequence(const char * name)
+{
+	printf("%s\n", name);
+	gSeqStart = monotonicUs();
+	gSeqCpu = cpuUs();
+}
+
+static void endSequence(int frames)
+{
+	int64_t wall = monotonicUs() - gSeqStart;
+	int64_t cpu = cpuUs() - gSeqCpu;
+
+	printf("  cpu %lld ms over %lld ms wall, %d%% of a core", cpu / 1000, wall / 1000,
+		wall > 0 ? (int)(cpu * 100 / wall) : 0);
+	if (frames > 0)
+	{
+		printf(", %lld us per frame", cpu / frames);
+	}
+	printf("\n");
+}
+
+static void dumpDevice()
+{
+	fflush(stdout);
+	gDevice->ops->dump(gDevice, STDOUT_FILENO);
+	printf("\n");
+}
+
+static bool runPreview(int duration)
+{
+	beginSequence("preview");
+
+	gDevice->ops->enable_msg_type(gDevice, CAMERA_MSG_PREVIEW_FRAME);
+	if (gDevice->ops->start_preview(gDevice) != 0)
+	{
+		fprintf(stderr, "start preview failed\n");
+		return false;
+	}
+	sleep(duration);
+	gDevice->ops->disable_msg_type(gDevice, CAMERA_MSG_PREVIEW_FRAME);
+
+	Mutex::Autolock locker(&gLock);
+	endSequence(gPreviewFrames);
+	printSamples(&gPreviewInterval);
+	return true;
+}
+
+static bool runRecording(int duration)
+{
+	beginSequence("recording");
+
+	gDevice->ops->enable_msg_type(gDevice, CAMERA_MSG_VIDEO_FRAME);
+	if (gDevice->ops->start_recording(gDevice) != 0)
+	{
+		fprintf(stderr, "start recording failed\n");
+		return false;
+	}
+	sleep(duration);
+	gDevice->ops->stop_recording(gDevice);
+	gDevice->ops->disable_msg_type(gDevice, CAMERA_MSG_VIDEO_FRAME);
+
+	Mutex::Autolock locker(&gLock);
+	endSequence(gVideoFrames);
+	printSamples(&gVideoLatency);
+	return true;
+}
+
+static bool runPictures(int count)
+{
+	beginSequence("pictures");
+
+	gDevice->ops->enable_msg_type(gDevice, CAMERA_MSG_SHUTTER | CAMERA_MSG_COMPRESSED_IMAGE);
+	for (int i = 0; i < count; i++)
+	{
+		// as an app does, preview runs again before each shot
+		if (!gDevice->ops->preview_enabled(gDevice)
+			&& gDevice->ops->start_preview(gDevice) != 0)
+		{
+			fprintf(stderr, "start preview failed\n");
+			return false;
+		}
+		usleep(300000);
+
+		{
+			Mutex::Autolock locker(&gLock);
+			gPictureTaken = false;
+			gPictureStart = monotonicUs();
+		}
+		if (gDevice->ops->take_picture(gDevice) != 0)
+		{
+			fprintf(stderr, "take picture %d failed\n", i);
+			return false;
+		}
+
+		Mutex::Autolock locker(&gLock);
+		while (!gPictureTaken)
+		{
+			if (gPictureDone.waitRelative(gLock, seconds(10)) != NO_ERROR)
+			{
+				fprintf(stderr, "picture %d timed out\n", i);
+				return false;
+			}
+		}
+	}
+
+	Mutex::Autolock locker(&gLock);
+	endSequence(count);
+	printSamples(&gShutterLatency);
+	printSamples(&gJpegLatency);
+	return true;
+}
+
+int main(int argc, char ** argv)
+{
+	int camera_id = 0;
+	int preview_seconds = 10;
+	int record_seconds = 10;
+	int pictures = 5;
+	int width = 0, height = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:p:r:n:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': camera_id = atoi(optarg); break;
+		case 'p': preview_seconds = atoi(optarg); break;
+		case 'r': record_seconds = atoi(optarg); break;
+		case 'n': pictures = atoi(optarg); break;
+		case 's': sscanf(optarg, "%dx%d", &width, &height); break;
+		default:
+			fprintf(stderr, "usage: %s [-c id] [-p preview s] [-r record s] [-n pictures] [-s WxH]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// the trace is read when the device starts
+	property_set("debug.camera.trace", "1");
+
+	const camera_module_t * module;
+	if (hw_get_module(CAMERA_HARDWARE_MODULE_ID, (const hw_module_t **)&module) != 0)
+	{
+		fprintf(stderr, "no camera module\n");
+		return 1;
+	}
+
+	char name[8];
+	snprintf(name, sizeof(name), "%d", camera_id);
+	hw_device_t * device;
+	if (module->common.methods->open(&module->common, name, &device) != 0)
+	{
+		fprintf(stderr, "open camera %d failed\n", camera_id);
+		return 1;
+	}
+	gDevice = (camera_device_t *)device;
+
+	if (width > 0 && height > 0)
+	{
+		char * flat = gDevice->ops->get_parameters(gDevice);
+		CameraParameters params;
+		params.unflatten(String8(flat));
+		gDevice->ops->put_parameters(gDevice, flat);
+
+		params.setPreviewSize(width, height);
+		params.set(CameraParameters::KEY_VIDEO_SIZE, params.get(CameraParameters::KEY_PREVIEW_SIZE));
+		if (gDevice->ops->set_parameters(gDevice, params.flatten().string()) != 0)
+		{
+			fprintf(stderr, "preview size %dx%d is not supported\n", width, height);
+		}
+	}
+
+	gDevice->ops->set_callbacks(gDevice, notifyCallback, dataCallback,
+		dataTimestampCallback, getMemory, NULL);
+	gDevice->ops->set_preview_window(gDevice, NULL);
+
+	bool ok = runPreview(preview_seconds);
+	if (ok)
+	{
+		ok = runRecording(record_seconds);
+	}
+	if (ok)
+	{
+		dumpDevice();
+		ok = runPictures(pictures);
+	}
+	if (ok)
+	{
+		dumpDevice();
+	}
+
+	gDevice->ops->stop_preview(gDevice);
+	gDevice->common.close(&gDevice->common);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,390 @@
+/*
+ * Cold open latency of camera.cfg, the table parser against the fgets / strtok
+ * one it replaced.
+ *
+ * Each sample runs in a fresh child process, so that the shared table is
+ * built again, and reads every key the HAL reads when it opens all cameras:
+ * the CCameraConfig constructor keys and initParameters. The old parser is
+ * kept here as it was, a file rescan per key. Both must read the same values.
+ *
+ * usage: camera_config_bench [samples]
+ */
+
+#define LOG_TAG "CameraConfigBench"
+#include <utils/Log.h>
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CCameraConfig.h"
+
+#define DEFAULT_SAMPLES		50
+#define MAX_SAMPLES			1000
+
+/****************************************************************************
+ * The fgets / strtok parser.
+ ***************************************************************************/
+
+static void legacyGetValue(char *line, char *value)
+{
+	char * ptemp = line;
+	while(*ptemp)
+	{
+		if (*ptemp++ == '=')
+		{
+			break;
+		}
+	}
+
+	char *pval = ptemp;
+	const char *seps = " \n\r\t";
+	int offset = 0;
+	pval = strtok(pval, seps);
+	while (pval != NULL)
+	{
+		strncpy(value + offset, pval, strlen(pval));
+		offset += strlen(pval);
+		pval = strtok(NULL, seps);
+	}
+	*(value + offset) = 0;
+}
+
+static bool legacyReadKey(FILE * file, int cameraId, const char *key, char *value)
+{
+	bool bRet = false;
+	bool bFlagBegin = false;
+	char strId[KEY_LENGTH];
+	char str[KEY_LENGTH];
+
+	fseek(file, 0L, SEEK_SET);
+
+	memset(str, 0, KEY_LENGTH);
+	while (fgets(str, KEY_LENGTH , file))
+	{
+		if (!strcmp(key, "number_of_camera"))
+		{
+			bFlagBegin = true;
+		}
+
+		if (!bFlagBegin)
+		{
+			if (!strncmp(str, "camera_id", strlen("camera_id")))
+			{
+				legacyGetValue(str, strId);
+				if (atoi(strId) == cameraId)
+				{
+					bFlagBegin = true;
+				}
+			}
+			continue;
+		}
+
+		if (!strncmp(key, str, strlen(key)))
+		{
+			legacyGetValue(str, value);
+
+			bRet = true;
+			break;
+		}
+		memset(str, 0, KEY_LENGTH);
+	}
+
+	return bRet;
+}
+
+/****************************************************************************
+ * The keys the HAL reads, in its order.
+ ***************************************************************************/
+
+// used key, then the support and default ones if it is "1"
+static const char * kUsedKeys[][3] =
+{
+	{ kUSED_PREVIEW_SIZE,	kSUPPORT_PREVIEW_SIZE,	kDEFAULT_PREVIEW_SIZE },
+	{ kUSED_PICTURE_SIZE,	kSUPPORT_PICTURE_SIZE,	kDEFAULT_PICTURE_SIZE },
+	{ kUSED_FLASH_MODE,		kSUPPORT_FLASH_MODE,	kDEFAULT_FLASH_MODE },
+	{ kUSED_COLOR_EFFECT,	kSUPPORT_COLOR_EFFECT,	kDEFAULT_COLOR_EFFECT },
+	{ kUSED_FRAME_RATE,		kSUPPORT_FRAME_RATE,	kDEFAULT_FRAME_RATE },
+	{ kUSED_FOCUS_MODE,		kSUPPORT_FOCUS_MODE,	kDEFAULT_FOCUS_MODE },
+	{ kUSED_SCENE_MODE,		kSUPPORT_SCENE_MODE,	kDEFAULT_SCENE_MODE },
+	{ kUSED_WHITE_BALANCE,	kSUPPORT_WHITE_BALANCE,	kDEFAULT_WHITE_BALANCE },
+};
+
+static const char * kExposureKeys[] =
+{
+	kMIN_EXPOSURE_COMPENSATION, kMAX_EXPOSURE_COMPENSATION,
+	kSTEP_EXPOSURE_COMPENSATION, kDEFAULT_EXPOSURE_COMPENSATION
+};
+
+static const char * kZoomKeys[] =
+{
+	kZOOM_SUPPORTED, kSMOOTH_ZOOM_SUPPORTED, kZOOM_RATIOS, kMAX_ZOOM, kDEFAULT_ZOOM
+};
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof(a[0]))
+
+// values of one camera, in read order, for the comparison
+struct cameraValues_t
+{
+	char	value[64][KEY_LENGTH];
+	int		count;
+};
+
+static void addValue(cameraValues_t * v, const char * value)
+{
+	if (v->count < 64)
+	{
+		strncpy(v->value[v->count], value ? value : "", KEY_LENGTH - 1);
+		v->value[v->count][KEY_LENGTH - 1] = 0;
+		v->count++;
+	}
+}
+
+static void addInt(cameraValues_t * v, int value, bool set)
+{
+	char str[16];
+	snprintf(str, sizeof(str), "%d", value);
+	addValue(v, set ? str : "");
+}
+
+static void legacyReadUsed(FILE * file, int id, const char * const keys[], int n, cameraValues_t * v)
+{
+	char value[KEY_LENGTH] = "0";
+	legacyReadKey(file, id, keys[0], value);
+	if (strcmp(value, "1"))
+	{
+		return ;
+	}
+	for (int i = 1; i < n; i++)
+	{
+		value[0] = 0;
+		legacyReadKey(file, id, keys[i], value);
+		addValue(v, value);
+	}
+}
+
+// opens every camera as the HAL did, returns the number of cameras
+static int legacyOpen(cameraValues_t * values, int maxCameras)
+{
+	int number = 0;
+	for (int id = 0; id < maxCameras && (id == 0 || id < number); id++)
+	{
+		// each CCameraConfig opened the file
+		FILE * file = fopen(CAMERA_KEY_CONFIG_PATH, "rb");
+		if (file == NULL)
+		{
+			return 0;
+		}
+
+		char value[KEY_LENGTH];
+		if (legacyReadKey(file, id, kNUMBER_OF_CAMERA, value))
+		{
+			number = atoi(value);
+		}
+
+		// the constructor keys, as CCameraConfig keeps them
+		cameraValues_t * v = &values[id];
+		v->count = 0;
+		value[0] = 0;
+		legacyReadKey(file, id, kCAMERA_FACING, value);
+		addInt(v, atoi(value), true);
+		value[0] = 0;
+		legacyReadKey(file, id, kCAMERA_DEVICE, value);
+		addValue(v, value);
+		value[0] = 0;
+		legacyReadKey(file, id, kDEVICE_ID, value);
+		addInt(v, atoi(value), true);
+		value[0] = 0;
+		legacyReadKey(file, id, kBUFFER_COUNT, value);
+		addInt(v, atoi(value), atoi(value) != 0);
+		value[0] = 0;
+		legacyReadKey(file, id, kZSL_BUFFER_COUNT, value);
+		addInt(v, atoi(value), atoi(value) != 0);
+
+		for (unsigned int i = 0; i < ARRAY_SIZE(kUsedKeys); i++)
+		{
+			legacyReadUsed(file, id, kUsedKeys[i], 3, v);
+		}
+
+		const char * exposure[5] = { kUSED_EXPOSURE_COMPENSATION };
+		memcpy(exposure + 1, kExposureKeys, sizeof(kExposureKeys));
+		legacyReadUsed(file, id, exposure, 5, v);
+
+		const char * zoom[6] = { kUSED_ZOOM };
+		memcpy(zoom + 1, kZoomKeys, sizeof(kZoomKeys));
+		legacyReadUsed(file, id, zoom, 6, v);
+
+		fclose(file);
+	}
+	return number;
+}
+
+static int tableOpen(cameraValues_t * values, int maxCameras)
+{
+	int number = 0;
+	for (int id = 0; id < maxCameras && (id == 0 || id < number); id++)
+	{
+		CCameraConfig config(id);
+		config.initParameters();
+		number = config.numberOfCamera();
+
+		// the same values, through the accessors the HAL uses
+		cameraValues_t * v = &values[id];
+		v->count = 0;
+		addInt(v, config.cameraFacing(), true);
+		addValue(v, config.cameraDevice());
+		addInt(v, config.getDeviceID(), true);
+		addInt(v, config.getBufferCount(), config.getBufferCount() != 0);
+		addInt(v, config.getZslBufferCount(), config.getZslBufferCount() != 0);
+
+#define ADD_USED(fun)											\
+		if (config.support##fun())								\
+		{														\
+			addValue(v, config.support##fun##Value());			\
+			addValue(v, config.default##fun##Value());			\
+		}
+
+		ADD_USED(PreviewSize)
+		ADD_USED(PictureSize)
+		ADD_USED(FlashMode)
+		ADD_USED(ColorEffect)
+		ADD_USED(FrameRate)
+		ADD_USED(FocusMode)
+		ADD_USED(SceneMode)
+		ADD_USED(WhiteBalance)
+
+		if (config.supportExposureCompensation())
+		{
+			addValue(v, config.minExposureCompensationValue());
+			addValue(v, config.maxExposureCompensationValue());
+			addValue(v, config.stepExposureCompensationValue());
+			addValue(v, config.defaultExposureCompensationValue());
+		}
+		if (config.supportZoom())
+		{
+			addValue(v, config.zoomSupportedValue());
+			addValue(v, config.smoothZoomSupportedValue());
+			addValue(v, config.zoomRatiosValue());
+			addValue(v, config.maxZoomValue());
+			addValue(v, config.defaultZoomValue());
+		}
+	}
+	return number;
+}
+
+/****************************************************************************
+ * Cold samples.
+ ***************************************************************************/
+
+static int64_t nowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+typedef int (*openFunc)(cameraValues_t *, int);
+
+#define MAX_CAMERAS		MAX_CONFIG_SECTIONS
+
+static cameraValues_t sLegacyValues[MAX_CAMERAS];
+static cameraValues_t sTableValues[MAX_CAMERAS];
+
+// latency of one open in a new process, -1 on error
+static int64_t coldSample(openFunc open)
+{
+	int fds[2];
+	if (pipe(fds) < 0)
+	{
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		static cameraValues_t values[MAX_CAMERAS];
+		int64_t start = nowUs();
+		int64_t us = open(values, MAX_CAMERAS) > 0 ? nowUs() - start : -1;
+		write(fds[1], &us, sizeof(us));
+		_exit(0);
+	}
+
+	int64_t us = -1;
+	::close(fds[1]);
+	if (pid < 0 || read(fds[0], &us, sizeof(us)) != sizeof(us))
+	{
+		us = -1;
+	}
+	::close(fds[0]);
+	if (pid > 0)
+	{
+		waitpid(pid, NULL, 0);
+	}
+	return us;
+}
+
+static int compareUs(const void * a, const void * b)
+{
+	int64_t d = *(const int64_t *)a - *(const int64_t *)b;
+	return (d > 0) - (d < 0);
+}
+
+static bool runSamples(const char * name, openFunc open, int count)
+{
+	static int64_t us[MAX_SAMPLES];
+	for (int i = 0; i < count; i++)
+	{
+		us[i] = coldSample(open);
+		if (us[i] < 0)
+		{
+			fprintf(stderr, "%s: open failed\n", name);
+			return false;
+		}
+	}
+
+	qsort(us, count, sizeof(us[0]), compareUs);
+	printf("%-14s n %4d  min %6lld  p50 %6lld  p90 %6lld  max %6lld us\n", name, count,
+		us[0], us[count / 2], us[(count * 9 + 9) / 10 - 1], us[count - 1]);
+	return true;
+}
+
+int main(int argc, char ** argv)
+{
+	int samples = argc > 1 ? atoi(argv[1]) : DEFAULT_SAMPLES;
+	if (samples < 1 || samples > MAX_SAMPLES)
+	{
+		samples = DEFAULT_SAMPLES;
+	}
+
+	// both parsers read the same values
+	int number = legacyOpen(sLegacyValues, MAX_CAMERAS);
+	if (number <= 0 || tableOpen(sTableValues, MAX_CAMERAS) != number)
+	{
+		fprintf(stderr, "no cameras in %s, or the parsers disagree on their number\n",
+			CAMERA_KEY_CONFIG_PATH);
+		return 1;
+	}
+	for (int id = 0; id < number && id < MAX_CAMERAS; id++)
+	{
+		const cameraValues_t * a = &sLegacyValues[id];
+		const cameraValues_t * b = &sTableValues[id];
+		for (int i = 0; i < a->count || i < b->count; i++)
+		{
+			if (i >= a->count || i >= b->count || strcmp(a->value[i], b->value[i]))
+			{
+				fprintf(stderr, "camera %d value %d differs: \"%s\" / \"%s\"\n", id, i,
+					i < a->count ? a->value[i] : "", i < b->count ? b->value[i] : "");
+				return 1;
+			}
+		}
+	}
+	printf("%d cameras in %s, both parsers read the same values\n", number, CAMERA_KEY_CONFIG_PATH);
+
+	if (!runSamples("fgets/strtok", legacyOpen, samples)
+		|| !runSamples("table", tableOpen, samples))
+	{
+		return 1;
+	}
+	return 0;
+}
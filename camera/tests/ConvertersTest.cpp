@@ -0,0 +1,288 @@
+/*
+ * Equivalence test of the YUV -> RGB converters.
+ *
+ * Converts random frames with the scalar reference kernels and with the NEON
+ * ones, through every public entry point, and memcmps the results. Widths
+ * that are not a multiple of 16 exercise the scalar row tails of the NEON
+ * kernels, a guard after each row catches writes past it. On a CPU without
+ * NEON only the reference runs. YUV420ToRGB32Transform is also checked
+ * against a per-pixel transform for every CONVERT_XXX combination.
+ *
+ * The kernels are static, the test builds Converters.cpp in.
+ */
+
+#include "../Converters.cpp"
+
+#include <stdlib.h>
+#include <linux/videodev2.h>
+
+using namespace android;
+
+#define GUARD		0x5a
+#define GUARD_PIXELS	8
+
+static const int kWidths[] = { 2, 14, 16, 18, 30, 34, 46, 176, 322, 642 };
+static const int kHeights[] = { 2, 6, 16, 144 };
+
+static const uint32_t kFormats[] =
+{
+	V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV21
+};
+
+static const int kTransforms[] =
+{
+	0, CONVERT_FLIP_H, CONVERT_FLIP_V, CONVERT_ROT_180,
+	CONVERT_ROT_90, CONVERT_ROT_90 | CONVERT_FLIP_H, CONVERT_ROT_90 | CONVERT_FLIP_V, CONVERT_ROT_270
+};
+
+static int sFailures = 0;
+
+static void useReference()
+{
+	lYUV420SToRGB565 = _YUV420SToRGB565_C;
+	lYUV420SToRGB32 = _YUV420SToRGB32_C;
+	lYUVRowToRGB32 = _YUVRowToRGB32_C;
+}
+
+static bool useNeon()
+{
+#ifdef CONVERTERS_HAVE_NEON
+	if (_CpuHasNeon())
+	{
+		lYUV420SToRGB565 = _YUV420SToRGB565_neon;
+		lYUV420SToRGB32 = _YUV420SToRGB32_neon;
+		lYUVRowToRGB32 = _YUVRowToRGB32_neon;
+		return true;
+	}
+#endif
+	return false;
+}
+
+static void fail(const char * what, uint32_t fmt, int width, int height, int transform)
+{
+	printf("FAIL %s %.4s %dx%d transform %d\n", what, (const char *)&fmt, width, height, transform);
+	sFailures++;
+}
+
+// rows of 'row_bytes' followed by a guard
+static uint8_t * allocGuarded(int rows, int row_bytes)
+{
+	const int size = rows * (row_bytes + GUARD_PIXELS * 4);
+	uint8_t * p = (uint8_t *)malloc(size);
+	memset(p, GUARD, size);
+	return p;
+}
+
+static bool guardsIntact(const uint8_t * p, int rows, int row_bytes)
+{
+	const int stride = row_bytes + GUARD_PIXELS * 4;
+	for (int y = 0; y < rows; y++)
+	{
+		for (int i = row_bytes; i < stride; i++)
+		{
+			if (p[y * stride + i] != GUARD)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// converts with the public entry point of the format, one row per dst row
+static void convertFrame(const uint8_t * src, uint32_t fmt, bool rgb565,
+						 uint8_t * dst, int width, int height)
+{
+	const int bpp = rgb565 ? 2 : 4;
+	const int stride = width * bpp + GUARD_PIXELS * 4;
+	uint8_t * packed = (uint8_t *)malloc(width * height * bpp);
+
+	switch (fmt)
+	{
+	case V4L2_PIX_FMT_YVU420:
+		rgb565 ? YV12ToRGB565(src, packed, width, height) : YV12ToRGB32(src, packed, width, height);
+		break;
+	case V4L2_PIX_FMT_YUV420:
+		// there is no YU12 to RGB565 entry point
+		YU12ToRGB32(src, packed, width, height);
+		break;
+	case V4L2_PIX_FMT_NV12:
+		rgb565 ? NV12ToRGB565(src, packed, width, height) : NV12ToRGB32(src, packed, width, height);
+		break;
+	case V4L2_PIX_FMT_NV21:
+		rgb565 ? NV21ToRGB565(src, packed, width, height) : NV21ToRGB32(src, packed, width, height);
+		break;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		memcpy(dst + y * stride, packed + y * width * bpp, width * bpp);
+	}
+	free(packed);
+}
+
+// the pixel at x, y of the source, converted one at a time
+static uint32_t referencePixel(const uint8_t * src, uint32_t fmt, int width, int height, int x, int y)
+{
+	const int pix_total = width * height;
+	const uint8_t * chroma = src + pix_total;
+	int u, v;
+
+	switch (fmt)
+	{
+	case V4L2_PIX_FMT_YVU420:
+		v = chroma[(y / 2) * (width / 2) + x / 2];
+		u = chroma[pix_total / 4 + (y / 2) * (width / 2) + x / 2];
+		break;
+	case V4L2_PIX_FMT_YUV420:
+		u = chroma[(y / 2) * (width / 2) + x / 2];
+		v = chroma[pix_total / 4 + (y / 2) * (width / 2) + x / 2];
+		break;
+	case V4L2_PIX_FMT_NV12:
+		u = chroma[(y / 2) * width + (x & ~1)];
+		v = chroma[(y / 2) * width + (x & ~1) + 1];
+		break;
+	default:
+		v = chroma[(y / 2) * width + (x & ~1)];
+		u = chroma[(y / 2) * width + (x & ~1) + 1];
+		break;
+	}
+	return YUVToRGB32(src[y * width + x], u, v);
+}
+
+static void checkTransform(const uint8_t * src, uint32_t fmt, int width, int height, int transform)
+{
+	const bool rot = (transform & CONVERT_ROT_90) != 0;
+	const int dst_w = rot ? height : width;
+	const int dst_h = rot ? width : height;
+	const int stride = dst_w + GUARD_PIXELS;
+	uint8_t * dst = allocGuarded(dst_h, dst_w * 4);
+	const uint32_t * rgb = (const uint32_t *)dst;
+
+	if (YUV420ToRGB32Transform(src, fmt, width, height, dst, stride, transform) != 0)
+	{
+		fail("transform", fmt, width, height, transform);
+		free(dst);
+		return ;
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			// flips first, then 90 degrees clockwise
+			int fx = (transform & CONVERT_FLIP_H) ? width - 1 - x : x;
+			int fy = (transform & CONVERT_FLIP_V) ? height - 1 - y : y;
+			int dx = rot ? height - 1 - fy : fx;
+			int dy = rot ? fx : fy;
+			if (rgb[dy * stride + dx] != referencePixel(src, fmt, width, height, x, y))
+			{
+				fail("transform pixel", fmt, width, height, transform);
+				free(dst);
+				return ;
+			}
+		}
+	}
+	if (!guardsIntact(dst, dst_h, dst_w * 4))
+	{
+		fail("transform guard", fmt, width, height, transform);
+	}
+	free(dst);
+}
+
+static void checkFrame(uint32_t fmt, int width, int height, bool neon)
+{
+	const int frame_size = width * height * 3 / 2;
+	uint8_t * src = (uint8_t *)malloc(frame_size);
+	for (int i = 0; i < frame_size; i++)
+	{
+		src[i] = rand() & 0xff;
+	}
+
+	for (int rgb565 = 0; rgb565 < 2; rgb565++)
+	{
+		if (rgb565 && fmt == V4L2_PIX_FMT_YUV420)
+		{
+			continue;
+		}
+
+		const int row_bytes = width * (rgb565 ? 2 : 4);
+		uint8_t * ref = allocGuarded(height, row_bytes);
+		uint8_t * out = allocGuarded(height, row_bytes);
+		const int size = height * (row_bytes + GUARD_PIXELS * 4);
+
+		useReference();
+		convertFrame(src, fmt, rgb565, ref, width, height);
+		if (neon)
+		{
+			useNeon();
+			convertFrame(src, fmt, rgb565, out, width, height);
+			if (memcmp(ref, out, size) != 0)
+			{
+				fail(rgb565 ? "rgb565" : "rgb32", fmt, width, height, 0);
+			}
+		}
+		free(ref);
+		free(out);
+	}
+
+	for (unsigned int t = 0; t < sizeof(kTransforms) / sizeof(kTransforms[0]); t++)
+	{
+		const int transform = kTransforms[t];
+		const bool rot = (transform & CONVERT_ROT_90) != 0;
+		const int dst_w = rot ? height : width;
+		const int dst_h = rot ? width : height;
+		const int size = dst_h * (dst_w + GUARD_PIXELS) * 4;
+
+		useReference();
+		checkTransform(src, fmt, width, height, transform);
+		if (!neon)
+		{
+			continue;
+		}
+
+		uint8_t * ref = allocGuarded(dst_h, dst_w * 4);
+		uint8_t * out = allocGuarded(dst_h, dst_w * 4);
+		YUV420ToRGB32Transform(src, fmt, width, height, ref, dst_w + GUARD_PIXELS, transform);
+		useNeon();
+		YUV420ToRGB32Transform(src, fmt, width, height, out, dst_w + GUARD_PIXELS, transform);
+		if (memcmp(ref, out, size) != 0)
+		{
+			fail("transform neon", fmt, width, height, transform);
+		}
+		free(ref);
+		free(out);
+	}
+
+	free(src);
+}
+
+int main(int argc, char ** argv)
+{
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+
+	// the dispatch picks NEON exactly when the CPU has it
+	_SelectConverters();
+	const bool dispatched_neon = (lYUV420SToRGB32 != _YUV420SToRGB32_C);
+	const bool neon = useNeon();
+	if (neon != dispatched_neon)
+	{
+		printf("FAIL dispatch picked the %s converters\n", dispatched_neon ? "NEON" : "C");
+		sFailures++;
+	}
+	printf("%s\n", neon ? "comparing C and NEON converters" : "no NEON, checking the C converters");
+
+	for (unsigned int f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); f++)
+	{
+		for (unsigned int w = 0; w < sizeof(kWidths) / sizeof(kWidths[0]); w++)
+		{
+			for (unsigned int h = 0; h < sizeof(kHeights) / sizeof(kHeights[0]); h++)
+			{
+				checkFrame(kFormats[f], kWidths[w], kHeights[h], neon);
+			}
+		}
+	}
+
+	printf("%s, %d failures\n", sFailures ? "FAILED" : "PASSED", sFailures);
+	return sFailures ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Equivalence test of the raw NV21 JPEG encoder.
+ *
+ * Encodes NV21 frames with compressRaw, once with the C and once with the
+ * NEON chroma deinterleave, and memcmps both against a reference that feeds
+ * libjpeg the same image through jpeg_write_scanlines, with each chroma
+ * sample replicated over its 2x2 block. libjpeg averages the block back to
+ * the same sample, so with the same settings the files must be identical
+ * byte for byte. Heights that are not a multiple of 16 check the padding of
+ * the last MCU row, widths with 16 * n + 8 chroma pairs the NEON row tail.
+ * On a CPU without NEON only the C deinterleave runs.
+ *
+ * The deinterleave functions are static, the test builds JpegCompressor.cpp
+ * in.
+ */
+
+#include "../JpegCompressor.cpp"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace android;
+
+#define QUALITY		90
+
+struct Size
+{
+	int width;
+	int height;
+};
+
+static const Size kSizes[] =
+{
+	{ 16, 16 }, { 48, 32 }, { 176, 144 }, { 320, 248 }, { 640, 480 },
+	{ 640, 482 }, { 1280, 720 }, { 1600, 1200 }, { 2048, 1538 }
+};
+
+static int sFailures = 0;
+
+// exposes the raw encoder
+class TestCompressor : public NV21JpegCompressor
+{
+public:
+	uint8_t * compress(const uint8_t * image, int width, int height, size_t * size)
+	{
+		mStream.reset();
+		if (compressRaw(image, width, height, QUALITY) != NO_ERROR)
+		{
+			return NULL;
+		}
+		*size = getCompressedSize();
+		uint8_t * data = (uint8_t *)malloc(*size);
+		getCompressedImage(data);
+		return data;
+	}
+};
+
+static void fail(const char * what, int width, int height, const char * deinterleave)
+{
+	printf("FAIL %s %dx%d %s\n", what, width, height, deinterleave);
+	sFailures++;
+}
+
+// a gradient with noise, so that every MCU has AC coefficients
+static uint8_t * makeFrame(int width, int height)
+{
+	const int frame_size = width * height * 3 / 2;
+	uint8_t * frame = (uint8_t *)malloc(frame_size);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			frame[y * width + x] = ((x + y) & 0xff) ^ (rand() & 0x1f);
+		}
+	}
+	for (int i = width * height; i < frame_size; i++)
+	{
+		frame[i] = rand() & 0xff;
+	}
+	return frame;
+}
+
+/* libjpeg destination collecting the reference in a growing buffer */
+
+struct MemDest
+{
+	struct jpeg_destination_mgr pub;
+	uint8_t * data;
+	size_t capacity;
+	size_t size;
+};
+
+static void memInit(j_compress_ptr cinfo)
+{
+	MemDest * dest = (MemDest *)cinfo->dest;
+	dest->pub.next_output_byte = dest->data;
+	dest->pub.free_in_buffer = dest->capacity;
+}
+
+static boolean memEmpty(j_compress_ptr cinfo)
+{
+	MemDest * dest = (MemDest *)cinfo->dest;
+	const size_t capacity = dest->capacity * 2;
+	dest->data = (uint8_t *)realloc(dest->data, capacity);
+	dest->pub.next_output_byte = dest->data + dest->capacity;
+	dest->pub.free_in_buffer = capacity - dest->capacity;
+	dest->capacity = capacity;
+	return TRUE;
+}
+
+static void memTerm(j_compress_ptr cinfo)
+{
+	MemDest * dest = (MemDest *)cinfo->dest;
+	dest->size = dest->capacity - dest->pub.free_in_buffer;
+}
+
+// interleaved YCbCr scanlines, chroma upsampled by replication
+static uint8_t * encodeReference(const uint8_t * frame, int width, int height, size_t * size)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	MemDest dest;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+
+	dest.pub.init_destination = memInit;
+	dest.pub.empty_output_buffer = memEmpty;
+	dest.pub.term_destination = memTerm;
+	dest.capacity = 4096;
+	dest.data = (uint8_t *)malloc(dest.capacity);
+	dest.size = 0;
+	cinfo.dest = &dest.pub;
+
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_YCbCr;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, QUALITY, TRUE);
+	jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 2;
+	cinfo.comp_info[1].h_samp_factor = 1;
+	cinfo.comp_info[1].v_samp_factor = 1;
+	cinfo.comp_info[2].h_samp_factor = 1;
+	cinfo.comp_info[2].v_samp_factor = 1;
+
+	jpeg_start_compress(&cinfo, TRUE);
+
+	const uint8_t * vu = frame + width * height;
+	uint8_t * line = (uint8_t *)malloc(width * 3);
+	while (cinfo.next_scanline < cinfo.image_height)
+	{
+		const int row = cinfo.next_scanline;
+		for (int x = 0; x < width; x++)
+		{
+			const uint8_t * pair = vu + (row / 2) * width + (x & ~1);
+			line[x * 3] = frame[row * width + x];
+			line[x * 3 + 1] = pair[1];
+			line[x * 3 + 2] = pair[0];
+		}
+		JSAMPROW rows[1] = { line };
+		jpeg_write_scanlines(&cinfo, rows, 1);
+	}
+	free(line);
+
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	*size = dest.size;
+	return dest.data;
+}
+
+static void check(TestCompressor * compressor, const uint8_t * frame, int width, int height,
+				  const uint8_t * ref, size_t ref_size, const char * deinterleave)
+{
+	size_t size = 0;
+	uint8_t * out = compressor->compress(frame, width, height, &size);
+	if (out == NULL)
+	{
+		fail("encode", width, height, deinterleave);
+		return ;
+	}
+	if (size != ref_size || memcmp(ref, out, size) != 0)
+	{
+		fail("bytes", width, height, deinterleave);
+	}
+	free(out);
+}
+
+static void checkSize(int width, int height)
+{
+	TestCompressor compressor;
+	uint8_t * frame = makeFrame(width, height);
+	size_t ref_size;
+	uint8_t * ref = encodeReference(frame, width, height, &ref_size);
+
+	lDeinterleaveVU = DeinterleaveVU_C;
+	check(&compressor, frame, width, height, ref, ref_size, "C");
+#if defined(__ARM_NEON__)
+	lDeinterleaveVU = DeinterleaveVU_neon;
+	check(&compressor, frame, width, height, ref, ref_size, "NEON");
+#endif
+
+	free(ref);
+	free(frame);
+}
+
+int main(int argc, char ** argv)
+{
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+
+	for (unsigned int s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); s++)
+	{
+		checkSize(kSizes[s].width, kSizes[s].height);
+	}
+
+	printf("%s, %d failures\n", sFailures ? "FAILED" : "PASSED", sFailures);
+	return sFailures ? 1 : 0;
+}
@@ -0,0 +1,470 @@
+/*
+ * Host profiling of the SW stages of the camera pipeline.
+ *
+ * V4L2CameraDevice, PreviewWindow and CallbackNotifier need CedarX, G2D, the
+ * display driver and binder (the callback heaps are IMemory), so the whole HAL
+ * is only benchmarked on the device, with camera_bench. This runs the parts
+ * that are plain software on the build host: FileCaptureBackend replays a
+ * frame file through the ioctl sequence V4L2CameraDevice issues, and each
+ * frame goes through the stages the device runs for a SW preview:
+ *  - YUV420ToRGB32Transform into a window buffer, as PreviewWindow does.
+ *  - A copy to the preview callback buffer, and to a video buffer while
+ *    recording, as CallbackNotifier does.
+ *  - VIDIOC_QBUF back to the backend.
+ *
+ * For a preview and a recording sequence it prints latency percentiles from
+ * capture and from DQBUF to each stage, the frame interval, the thread CPU
+ * time per frame, the frames the backend dropped for want of a queued buffer,
+ * and the FrameTrace histograms of the HAL dump.
+ *
+ * Without -f, a file of noise frames of the requested size and format is
+ * written to /tmp first.
+ *
+ * usage: camera_pipeline_bench [-f file] [-s WxH] [-o nv21|nv12|yv12|yu12]
+ *                              [-r fps] [-t s] [-b buffers] [-x transform]
+ */
+
+#define LOG_TAG "CameraPipelineBench"
+#include "../CameraDebug.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include <utils/String8.h>
+
+#include "../CaptureBackend.h"
+#include "../Converters.h"
+#include "../V4L2Camera.h"
+
+using namespace android;
+
+#define MAX_SAMPLES		8192
+
+#define DEFAULT_FRAME_FILE	"/tmp/camera_pipeline_bench.yuv"
+#define DEFAULT_FILE_FRAMES	30
+
+/****************************************************************************
+ * Samples and percentiles.
+ ***************************************************************************/
+
+struct samples_t
+{
+	const char *	name;
+	int				count;
+	int64_t			value[MAX_SAMPLES];		// us
+};
+
+static void addSample(samples_t * s, int64_t us)
+{
+	if (s->count < MAX_SAMPLES)
+	{
+		s->value[s->count++] = us;
+	}
+}
+
+static int compareSample(const void * a, const void * b)
+{
+	int64_t d = *(const int64_t *)a - *(const int64_t *)b;
+	return (d > 0) - (d < 0);
+}
+
+// nearest rank
+static int64_t percentile(const samples_t * s, int p)
+{
+	int rank = (s->count * p + 99) / 100;
+	if (rank < 1)
+	{
+		rank = 1;
+	}
+	return s->value[rank - 1];
+}
+
+static void printSamples(samples_t * s)
+{
+	if (s->count == 0)
+	{
+		printf("  %-28s no samples\n", s->name);
+		return ;
+	}
+
+	qsort(s->value, s->count, sizeof(s->value[0]), compareSample);
+	printf("  %-28s n %5d  p50 %7lld  p90 %7lld  p99 %7lld  max %7lld us\n",
+		s->name, s->count,
+		percentile(s, 50), percentile(s, 90), percentile(s, 99),
+		s->value[s->count - 1]);
+}
+
+static int64_t monotonicUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t cpuUs(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// the backend stamps frames with gettimeofday(), as the CSI driver
+static int64_t realtimeUs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/****************************************************************************
+ * Stream.
+ ***************************************************************************/
+
+static CaptureBackend *	gBackend = NULL;
+static int				gFd = -1;
+static int				gWidth = 640;
+static int				gHeight = 480;
+static uint32_t			gPixFmt = V4L2_PIX_FMT_NV21;
+static int				gBufferCount = NB_BUFFER;
+static int				gFrameSize = 0;
+static void *			gBuffers[MAX_NB_BUFFER];
+static int				gTransform = 0;
+
+// stage outputs, a SW preview window and the callback heaps
+static uint32_t *		gWindow = NULL;
+static uint8_t *		gCallback = NULL;
+static uint8_t *		gVideo = NULL;
+
+static samples_t		gInterval		= { "dequeue interval" };
+static samples_t		gCaptureLatency	= { "capture to dequeue" };
+static samples_t		gPreviewLatency	= { "dequeue to preview" };
+static samples_t		gCallbackLatency	= { "dequeue to callback" };
+static samples_t		gReleaseLatency	= { "dequeue to requeue" };
+static samples_t		gFrameCpu		= { "cpu per frame" };
+
+static bool writeFrameFile(const char * path)
+{
+	FILE * fp = fopen(path, "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "create %s failed\n", path);
+		return false;
+	}
+
+	uint8_t * frame = (uint8_t *)malloc(gFrameSize);
+	for (int f = 0; f < DEFAULT_FILE_FRAMES; f++)
+	{
+		for (int i = 0; i < gFrameSize; i++)
+		{
+			frame[i] = (i + f * 8) ^ (rand() & 0x1f);
+		}
+		fwrite(frame, 1, gFrameSize, fp);
+	}
+	free(frame);
+
+	fclose(fp);
+	return true;
+}
+
+static bool openStream(const char * name)
+{
+	gBackend = CaptureBackend::create(name);
+	gFd = gBackend->open(name, O_RDWR | O_NONBLOCK);
+	if (gFd < 0)
+	{
+		fprintf(stderr, "open %s failed\n", name);
+		return false;
+	}
+
+	struct v4l2_format format;
+	memset(&format, 0, sizeof(format));
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	format.fmt.pix.width = gWidth;
+	format.fmt.pix.height = gHeight;
+	format.fmt.pix.pixelformat = gPixFmt;
+	format.fmt.pix.field = V4L2_FIELD_NONE;
+	if (gBackend->ioctl(VIDIOC_S_FMT, &format) < 0)
+	{
+		fprintf(stderr, "VIDIOC_S_FMT failed\n");
+		return false;
+	}
+
+	struct v4l2_requestbuffers rb;
+	memset(&rb, 0, sizeof(rb));
+	rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	rb.memory = V4L2_MEMORY_MMAP;
+	rb.count = gBufferCount;
+	if (gBackend->ioctl(VIDIOC_REQBUFS, &rb) < 0)
+	{
+		fprintf(stderr, "VIDIOC_REQBUFS failed\n");
+		return false;
+	}
+	gBufferCount = rb.count;
+
+	for (int i = 0; i < gBufferCount; i++)
+	{
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (gBackend->ioctl(VIDIOC_QUERYBUF, &buf) < 0)
+		{
+			fprintf(stderr, "VIDIOC_QUERYBUF %d failed\n", i);
+			return false;
+		}
+		gBuffers[i] = gBackend->mmap(buf.length, buf.m.offset);
+		if (gBuffers[i] == MAP_FAILED)
+		{
+			fprintf(stderr, "mmap buffer %d failed\n", i);
+			return false;
+		}
+	}
+
+	gWindow = (uint32_t *)malloc(gWidth * gHeight * 4);
+	gCallback = (uint8_t *)malloc(gFrameSize);
+	gVideo = (uint8_t *)malloc(gFrameSize);
+
+	return true;
+}
+
+static void closeStream()
+{
+	if (gBackend != NULL)
+	{
+		gBackend->close();
+		delete gBackend;
+		gBackend = NULL;
+	}
+	free(gWindow);
+	free(gCallback);
+	free(gVideo);
+}
+
+/****************************************************************************
+ * Sequences.
+ ***************************************************************************/
+
+static void resetSamples()
+{
+	gInterval.count = 0;
+	gCaptureLatency.count = 0;
+	gPreviewLatency.count = 0;
+	gCallbackLatency.count = 0;
+	gReleaseLatency.count = 0;
+	gFrameCpu.count = 0;
+}
+
+static bool runSequence(const char * name, int seconds, bool recording)
+{
+	// a trace per sequence, for histograms of this one only
+	FrameTrace trace;
+	trace.setLevel(1);
+	resetSamples();
+
+	// STREAMOFF hands every buffer back, as a driver does
+	for (int i = 0; i < gBufferCount; i++)
+	{
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		gBackend->ioctl(VIDIOC_QBUF, &buf);
+	}
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (gBackend->ioctl(VIDIOC_STREAMON, &type) < 0)
+	{
+		fprintf(stderr, "VIDIOC_STREAMON failed\n");
+		return false;
+	}
+
+	const int dst_width = (gTransform & CONVERT_ROT_90) ? gHeight : gWidth;
+	const int64_t start = monotonicUs();
+	const int64_t cpu_start = cpuUs(CLOCK_PROCESS_CPUTIME_ID);
+	int64_t last = 0;
+	uint32_t last_sequence = 0;
+	int frames = 0;
+	int dropped = 0;
+	bool ok = true;
+
+	while (monotonicUs() - start < seconds * 1000000LL)
+	{
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(gFd, &fds);
+		struct timeval tv;
+		tv.tv_sec = 2;
+		tv.tv_usec = 0;
+		int ret = select(gFd + 1, &fds, NULL, NULL, &tv);
+		if (ret == 0)
+		{
+			fprintf(stderr, "%s: no frame for 2 s\n", name);
+			ok = false;
+			break;
+		}
+		if (ret < 0)
+		{
+			continue;
+		}
+
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (gBackend->ioctl(VIDIOC_DQBUF, &buf) < 0)
+		{
+			continue;
+		}
+
+		const int64_t dequeued = monotonicUs();
+		const int64_t cpu = cpuUs(CLOCK_THREAD_CPUTIME_ID);
+		trace.mark(buf.index, FRAME_STAGE_DEQUEUE);
+
+		addSample(&gCaptureLatency, realtimeUs()
+			- ((int64_t)buf.timestamp.tv_sec * 1000000LL + buf.timestamp.tv_usec));
+		if (last != 0)
+		{
+			addSample(&gInterval, dequeued - last);
+			dropped += buf.sequence - last_sequence - 1;
+		}
+		last = dequeued;
+		last_sequence = buf.sequence;
+
+		const void * frame = gBuffers[buf.index];
+		YUV420ToRGB32Transform(frame, gPixFmt, gWidth, gHeight, gWindow, dst_width, gTransform);
+		trace.mark(buf.index, FRAME_STAGE_PREVIEW);
+		addSample(&gPreviewLatency, monotonicUs() - dequeued);
+
+		memcpy(gCallback, frame, gFrameSize);
+		if (recording)
+		{
+			memcpy(gVideo, frame, gFrameSize);
+		}
+		trace.mark(buf.index, FRAME_STAGE_CALLBACK);
+		addSample(&gCallbackLatency, monotonicUs() - dequeued);
+
+		gBackend->ioctl(VIDIOC_QBUF, &buf);
+		trace.mark(buf.index, FRAME_STAGE_RELEASE);
+		addSample(&gReleaseLatency, monotonicUs() - dequeued);
+		addSample(&gFrameCpu, cpuUs(CLOCK_THREAD_CPUTIME_ID) - cpu);
+
+		frames++;
+	}
+
+	gBackend->ioctl(VIDIOC_STREAMOFF, &type);
+
+	const int64_t elapsed = monotonicUs() - start;
+	const int64_t cpu_used = cpuUs(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+	printf("%s: %d frames in %.2f s (%.1f fps), %d dropped, process cpu %.1f%%\n",
+		name, frames, elapsed / 1000000.0, frames * 1000000.0 / elapsed, dropped,
+		cpu_used * 100.0 / elapsed);
+	printSamples(&gInterval);
+	printSamples(&gCaptureLatency);
+	printSamples(&gPreviewLatency);
+	printSamples(&gCallbackLatency);
+	printSamples(&gReleaseLatency);
+	printSamples(&gFrameCpu);
+
+	String8 result;
+	trace.dump(result);
+	printf("%s", result.string());
+
+	return ok;
+}
+
+static bool parseFormat(const char * name)
+{
+	if (strcmp(name, "nv21") == 0)
+	{
+		gPixFmt = V4L2_PIX_FMT_NV21;
+	}
+	else if (strcmp(name, "nv12") == 0)
+	{
+		gPixFmt = V4L2_PIX_FMT_NV12;
+	}
+	else if (strcmp(name, "yv12") == 0)
+	{
+		gPixFmt = V4L2_PIX_FMT_YVU420;
+	}
+	else if (strcmp(name, "yu12") == 0)
+	{
+		gPixFmt = V4L2_PIX_FMT_YUV420;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char ** argv)
+{
+	const char * path = NULL;
+	int fps = 30;
+	int seconds = 5;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "f:s:o:r:t:b:x:")) != -1)
+	{
+		bool ok = true;
+		switch (opt)
+		{
+		case 'f': path = optarg; break;
+		case 's': ok = (sscanf(optarg, "%dx%d", &gWidth, &gHeight) == 2); break;
+		case 'o': ok = parseFormat(optarg); break;
+		case 'r': fps = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		case 'b': gBufferCount = atoi(optarg); break;
+		case 'x': gTransform = atoi(optarg); break;
+		default: ok = false; break;
+		}
+		if (!ok)
+		{
+			fprintf(stderr, "usage: %s [-f file] [-s WxH] [-o nv21|nv12|yv12|yu12]"
+				" [-r fps] [-t s] [-b buffers] [-x transform]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (gWidth <= 0 || gHeight <= 0 || (gWidth & 1) || (gHeight & 1))
+	{
+		fprintf(stderr, "frame size must be even\n");
+		return 1;
+	}
+	gFrameSize = gWidth * gHeight * 3 / 2;
+
+	if (path == NULL)
+	{
+		path = DEFAULT_FRAME_FILE;
+		if (!writeFrameFile(path))
+		{
+			return 1;
+		}
+	}
+
+	char name[160];
+	snprintf(name, sizeof(name), "%s%s@%d", CAPTURE_FILE_PREFIX, path, fps);
+	printf("%s, %dx%d, %d buffers, transform %d\n", name, gWidth, gHeight, gBufferCount, gTransform);
+
+	bool ok = openStream(name);
+	if (ok)
+	{
+		ok = runSequence("preview", seconds, false);
+	}
+	if (ok)
+	{
+		ok = runSequence("recording", seconds, true);
+	}
+	closeStream();
+
+	return ok ? 0 : 1;
+}